@@ -0,0 +1,118 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+
+// Voice prompts over a background track, arriving at random with random
+// priorities, half of them only worth saying within 4 s.  A jq8400Announcer
+// against interjectFileByIndexNumber() as each one arrives, which cuts off a
+// prompt still playing for good.  Every prompt must be played, or expire, or
+// still be waiting, none may fail, and the background must be playing again
+// at the end.
+
+#include "jq8400_announcer.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define RUN_MS          300000
+#define BACKGROUND      1
+#define PROMPTS         8           // Indexes 2 to 9, of 2 to 4 s
+
+
+static void addFiles(jq8400Emulator &emu) {
+  emu.addFile(MP3_SRC_SDCARD, 1, "BG", 600);
+  for(int x = 0; x < PROMPTS; x++) {
+    char name[8];
+    sprintf(name, "P%d", x);
+    emu.addFile(MP3_SRC_SDCARD, 1, name, 2 + x % 3);
+  }
+  emu.setSourcePresent(MP3_SRC_SDCARD, 1);
+}
+
+
+// Returns 1 if the announcer lost a prompt or the background
+static int run(int useAnnouncer) {
+  jq8400Emulator emu;
+  addFiles(emu);
+  jq8400 mp3(emu);
+  mp3.playFileByIndexNumber(BACKGROUND);
+
+  jq8400Announcer announcer(mp3);
+  srand(7);
+  int arrivals = 0, cutOff = 0;
+  int nextAt   = 1000 + rand() % 4000;
+
+  while(emu.now() < RUN_MS * 1000LL) {
+    int now = mp3.millis();
+    if(now - nextAt >= 0) {
+      int fileNumber = 2 + rand() % PROMPTS;
+      int priority   = rand() % 3;
+      int expiresMs  = rand() % 2 ? 4000 : 0;
+      arrivals++;
+      if(useAnnouncer) {
+        announcer.announce(fileNumber, priority, expiresMs);
+      } else {
+        if(emu.currentIndex() != BACKGROUND) cutOff++;
+        mp3.interjectFileByIndexNumber(fileNumber);
+      }
+      nextAt = now + 500 + rand() % 6000;
+    }
+    if(useAnnouncer) announcer.service(); else mp3.poll();
+    mp3.delay(1);
+  }
+
+  // Time to finish what is waiting
+  for(long long until = emu.now() + 15000000LL; emu.now() < until; ) {
+    if(useAnnouncer) announcer.service(); else mp3.poll();
+    mp3.delay(1);
+  }
+  int background = emu.currentIndex() == BACKGROUND && emu.status() == MP3_STATUS_PLAYING;
+
+  if(!useAnnouncer) {
+    printf("interject as they come: %d prompts, %d cut off for good by the next, background %s\n",
+      arrivals, cutOff, background ? "playing" : "lost");
+    return 0;
+  }
+
+  printf("jq8400Announcer:        %d prompts, %d played whole, %d preempted and said again, %d expired, %d failed, background %s\n",
+    arrivals, announcer.promptsPlayed(), announcer.promptsPreempted(), announcer.promptsExpired(), announcer.promptsFailed(),
+    background ? "playing" : "lost");
+  printf("  start latency p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, %d status queries\n",
+    announcer.startLatencyUs(50) / 1000.0, announcer.startLatencyUs(90) / 1000.0, announcer.startLatencyUs(99) / 1000.0,
+    announcer.monitor().queriesSent());
+
+  int accounted = announcer.promptsPlayed() + announcer.promptsExpired() + announcer.waiting() == arrivals;
+  return !accounted || announcer.promptsFailed() || !background;
+}
+
+
+int main() {
+  printf("%d s of a background track, prompts every 0.5 to 6.5 s, priorities 0 to 2\n\n", RUN_MS / 1000);
+  int bad = run(0);
+  bad += run(1);
+  return bad ? 1 : 0;
+}
@@ -0,0 +1,236 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+
+// Device scripts on a jq8400Executor, against the same steps as blocking calls
+// one module after another.  Each module runs "source, count, seek, volume,
+// play, until stopped" on a 3 s track.  Every module has its own emulator and
+// so its own clock: the blocking calls take the sum of them (the thread is
+// held throughout), the executor the longest.  Then where the coroutine
+// frames came from, and built with MP3_NO_HEAP (make coro-noheap) what a
+// script sees when the pool runs out.
+//
+// Built as C++20 (make coro), to anything older jq8400_coro.hpp is empty.
+
+#include "jq8400_coro.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+#include <chrono>
+#include <optional>
+
+#if !(__cplusplus >= 202002L && defined(__cpp_impl_coroutine))
+#error "bench/coro needs C++20 coroutines, build it with make coro"
+#endif
+
+#define MODULES     8
+#define TRACK       3
+
+// Everything else that comes from the heap, to show that frames do not
+static long heapAllocations = 0;
+void *operator new(std::size_t size)    { heapAllocations++; void *p = malloc(size); if(!p) throw std::bad_alloc(); return p; }
+void  operator delete(void *p) noexcept                 { free(p); }
+void  operator delete(void *p, std::size_t) noexcept    { free(p); }
+
+static int finished = 0;
+
+static jq8400Task<> play(jq8400Async &mp3) {
+  co_await mp3.setSource(MP3_SRC_SDCARD);
+  int files = co_await mp3.countFiles();
+  co_await mp3.seekFileByIndexNumber(TRACK <= files ? TRACK : 1);
+  co_await mp3.setVolume(20);
+  co_await mp3.play();
+  co_await mp3.untilStopped();
+  finished++;
+}
+
+
+struct Rack {
+  jq8400Emulator *emu[MODULES];
+  jq8400         *mp3[MODULES];
+  int             count;
+
+  Rack(int modules) : count(modules) {
+    for(int x = 0; x < count; x++) {
+      emu[x] = new jq8400Emulator();
+      for(int f = 1; f <= 5; f++) {
+        char name[8];
+        sprintf(name, "F%d", f);
+        emu[x]->addFile(MP3_SRC_SDCARD, 1, name, 3);
+      }
+      emu[x]->setSourcePresent(MP3_SRC_SDCARD, 1);
+      mp3[x] = new jq8400(*emu[x]);
+    }
+  }
+  ~Rack() {
+    for(int x = 0; x < count; x++) { delete mp3[x]; delete emu[x]; }
+  }
+
+  long long clock(int x) { return emu[x]->now(); }
+
+  // Every module left playing the track at volume 20 and then stopped
+  int right() {
+    for(int x = 0; x < count; x++) {
+      if(emu[x]->currentIndex() != TRACK || emu[x]->status() != MP3_STATUS_STOPPED || emu[x]->volume() != 20) return 0;
+    }
+    return 1;
+  }
+};
+
+
+static long long blocking(int modules, int rounds) {
+  Rack rack(modules);
+  long long started[MODULES], total = 0;
+  for(int x = 0; x < modules; x++) started[x] = rack.clock(x);
+
+  for(int round = 0; round < rounds; round++) {
+    for(int x = 0; x < modules; x++) {
+      jq8400 &mp3 = *rack.mp3[x];
+      mp3.setSource(MP3_SRC_SDCARD);
+      int files = mp3.countFiles();
+      mp3.seekFileByIndexNumber(TRACK <= files ? TRACK : 1);
+      mp3.setVolume(20);
+      mp3.play();
+      while(mp3.getStatus() != MP3_STATUS_STOPPED) mp3.delay(MP3_PLAYBACK_CACHE_MS);
+    }
+  }
+
+  for(int x = 0; x < modules; x++) total += rack.clock(x) - started[x];
+  return rack.right() ? total : -1;
+}
+
+
+struct Scripted {
+  long long   us;
+  double      runNs;
+  int         allocations, highWater, fromHeap;
+  long        heapAfterFirst;
+};
+
+// -1 in us if a script did not finish or left a module wrong
+static Scripted scripted(int modules, int rounds) {
+  Scripted result = { 0, 0, 0, 0, 0, 0 };
+  Rack rack(modules);
+  jq8400Executor executor;
+  std::optional<jq8400Async> async[MODULES];
+  for(int x = 0; x < modules; x++) async[x].emplace(*rack.mp3[x], executor);
+
+  long long started[MODULES];
+  for(int x = 0; x < modules; x++) started[x] = rack.clock(x);
+  int  allocations = jq8400FramePool::allocations();
+  int  fromHeap    = jq8400FramePool::fromHeap();
+  long heap = 0, passes = 0;
+  finished = 0;
+
+  for(int round = 0; round < rounds; round++) {
+    for(int x = 0; x < modules; x++) executor.spawn(play(*async[x]));
+    if(round == 0) heap = heapAllocations;
+
+    while(1) {
+      std::chrono::steady_clock::time_point before = std::chrono::steady_clock::now();
+      int running = executor.run();
+      result.runNs += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - before).count();
+      passes++;
+      if(!running) break;
+      for(int x = 0; x < modules; x++) rack.mp3[x]->delay(1);
+    }
+  }
+
+  for(int x = 0; x < modules; x++) {
+    if(rack.clock(x) - started[x] > result.us) result.us = rack.clock(x) - started[x];
+  }
+  if(finished != modules * rounds || !rack.right()) result.us = -1;
+  result.runNs         /= passes;
+  result.allocations    = jq8400FramePool::allocations() - allocations;
+  result.highWater      = jq8400FramePool::highWater();
+  result.fromHeap       = jq8400FramePool::fromHeap() - fromHeap;
+  result.heapAfterFirst = heapAllocations - heap;
+  return result;
+}
+
+
+#if MP3_NO_HEAP
+static int      statusSeen, filesSeen;
+static jq8400Task<> idle()                      { co_return; }
+static jq8400Task<> ask(jq8400Async &mp3)       { statusSeen = co_await mp3.getStatus(); filesSeen = co_await mp3.countFiles(); }
+
+// With all but one frame of the pool held (by tasks made but never run), a
+// script gets the frame it runs in and its queries, which need one more, fail
+static int exhausted() {
+  Rack rack(1);
+  jq8400Executor executor;
+  jq8400Async    mp3(*rack.mp3[0], executor);
+
+  static std::optional<jq8400Task<>> held[MP3_CORO_FRAMES];
+  for(int x = 0; x < MP3_CORO_FRAMES - 1; x++) held[x].emplace(idle());
+
+  statusSeen = filesSeen = 0;
+  int spawned = executor.spawn(ask(mp3));
+  while(executor.run()) rack.mp3[0]->delay(1);
+  int refusedStatus = statusSeen, refusedFiles = filesSeen;
+
+  // One more task than the pool holds never gets a frame, and spawn() refuses it
+  held[MP3_CORO_FRAMES - 1].emplace(idle());
+  int overflow = executor.spawn(ask(mp3));
+
+  for(int x = 0; x < MP3_CORO_FRAMES; x++) held[x].reset();
+  executor.spawn(ask(mp3));
+  while(executor.run()) rack.mp3[0]->delay(1);
+
+  printf("\nMP3_NO_HEAP, %d frame pool with %d held: script %s, getStatus() %d and countFiles() %d, the next task %s; "
+         "once released getStatus() %d and countFiles() %d, %d frames wanted the heap\n",
+    MP3_CORO_FRAMES, MP3_CORO_FRAMES - 1, spawned ? "ran" : "refused", refusedStatus, refusedFiles,
+    overflow ? "spawned" : "refused", statusSeen, filesSeen, jq8400FramePool::fromHeap());
+  return !spawned || refusedStatus != -1 || refusedFiles != -1 || overflow || statusSeen != MP3_STATUS_STOPPED || filesSeen != 5;
+}
+#endif
+
+
+int main() {
+  static const int sizes[][2] = { { 1, 1 }, { 4, 1 }, { 8, 5 } };
+  int bad = 0;
+
+  printf("%-8s %-7s %14s %14s %16s\n", "modules", "rounds", "blocking s", "executor s", "run() per pass");
+  Scripted last = { 0, 0, 0, 0, 0, 0 };
+  for(const int *size : sizes) {
+    long long one = blocking(size[0], size[1]);
+    last = scripted(size[0], size[1]);
+    printf("%-8d %-7d %14.1f %14.1f %13.0f ns\n", size[0], size[1], one / 1e6, last.us / 1e6, last.runNs);
+    if(one < 0 || last.us < 0) bad++;
+  }
+
+  printf("\n%d modules, %d rounds: %d frame allocations, pool high water %d of %d, %d frames from the heap, %ld heap allocations after the first round\n",
+    sizes[2][0], sizes[2][1], last.allocations, last.highWater, MP3_CORO_FRAMES, last.fromHeap, last.heapAfterFirst);
+  if(last.fromHeap || last.heapAfterFirst) bad++;
+
+#if MP3_NO_HEAP
+  bad += exhausted();
+#endif
+
+  return bad ? 1 : 0;
+}
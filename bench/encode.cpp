@@ -0,0 +1,109 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+
+// Every frame the driver builds while running, put through encodeFrame() and
+// compared with the same bytes as the compile time checks in jq8400.cpp, then
+// the cost of encoding each one.  Exits 1 if any frame is wrong, so that
+// "make run" fails.
+
+#include "jq8400.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+// encodeFrame() is for the driver and its helpers, a subclass may call it
+struct jq8400Encoder : public jq8400
+{
+  using jq8400::encodeFrame;
+};
+
+struct Golden {
+  const char *name;
+  int         command;
+  int         length;
+  uint8_t     data[10];
+  const char *frame;
+  int         frameLength;
+};
+
+#define GOLDEN(name, command, frame, length, ...) { name, jq8400::command, length, { __VA_ARGS__ }, frame, sizeof(frame) - 1 }
+
+static const Golden goldens[] = {
+  GOLDEN("setVolume(20)",         MP3_CMD_VOL_SET,            "\xAA\x13\x01\x14\xD2",                          1,  20),
+  GOLDEN("setEqualizer(2)",       MP3_CMD_EQ_SET,             "\xAA\x1A\x01\x02\xC7",                          1,  2),
+  GOLDEN("setLoopMode(2)",        MP3_CMD_LOOP_SET,           "\xAA\x18\x01\x02\xC5",                          1,  2),
+  GOLDEN("setSource(1)",          MP3_CMD_SOURCE_SET,         "\xAA\x0B\x01\x01\xB7",                          1,  1),
+  GOLDEN("play index 1",          MP3_CMD_PLAY_IDX,           "\xAA\x07\x02\x00\x01\xB4",                      2,  0, 1),
+  GOLDEN("play index 300",        MP3_CMD_PLAY_IDX,           "\xAA\x07\x02\x01\x2C\xE0",                      2,  1, 44),
+  GOLDEN("seek index 300",        MP3_CMD_SEEK_IDX,           "\xAA\x1F\x02\x01\x2C\xF8",                      2,  1, 44),
+  GOLDEN("insert index 3",        MP3_CMD_INSERT_IDX,         "\xAA\x16\x03\x01\x00\x03\xC7",                  3,  1, 0, 3),
+  GOLDEN("fastForward(5)",        MP3_CMD_FFWD,               "\xAA\x23\x02\x00\x05\xD4",                      2,  0, 5),
+  GOLDEN("rewind(5)",             MP3_CMD_RWND,               "\xAA\x22\x02\x00\x05\xD3",                      2,  0, 5),
+  GOLDEN("abLoopPlay(10, 65)",    MP3_CMD_AB_PLAY,            "\xAA\x20\x04\x00\x0A\x01\x05\xDE",              4,  0, 10, 1, 5),
+  GOLDEN("playlist 01 02",        MP3_CMD_PLAYLIST,           "\xAA\x1B\x04\x30\x31\x30\x32\x8C",              4,  '0', '1', '0', '2'),
+  GOLDEN("folder path /42*/*???", MP3_CMD_PLAY_FILE_FOLDER,   "\xAA\x08\x0A\x01\x2F\x34\x32\x2A\x2F\x2A\x3F\x3F\x3F\x92", 10, 1, '/', '4', '2', '*', '/', '*', '?', '?', '?'),
+  GOLDEN("getStatus()",           MP3_CMD_STATUS,             "\xAA\x01\x00\xAB",                              0,  0),
+};
+
+static const int goldenCount = sizeof(goldens) / sizeof(goldens[0]);
+static const int rounds      = 1000000;
+
+
+int main() {
+  uint8_t frame[MP3_MAX_FRAME_LENGTH];
+  int     wrong = 0;
+
+  for(int g = 0; g < goldenCount; g++) {
+    int length = jq8400Encoder::encodeFrame(frame, goldens[g].command, goldens[g].data, goldens[g].length);
+    if(length != goldens[g].frameLength || memcmp(frame, goldens[g].frame, length) != 0) {
+      printf("WRONG %s:", goldens[g].name);
+      for(int x = 0; x < length; x++) printf(" %02X", frame[x]);
+      printf("\n");
+      wrong++;
+    }
+  }
+  if(wrong) {
+    return 1;
+  }
+  printf("%d frames encode as expected\n\n", goldenCount);
+
+  printf("%-24s %10s %8s\n", "frame", "ns/call", "bytes");
+  unsigned sink = 0;
+  for(int g = 0; g < goldenCount; g++) {
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    long long bytes = 0;
+    for(int r = 0; r < rounds; r++) {
+      bytes += jq8400Encoder::encodeFrame(frame, goldens[g].command, goldens[g].data, goldens[g].length);
+      sink  += frame[bytes & 3];
+    }
+    long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count();
+    printf("%-24s %10.1f %8.1f\n", goldens[g].name, (double)ns / rounds, (double)bytes / rounds);
+  }
+  return sink == 1 ? 2 : 0; // Keeps the loops from being optimised away
+}
@@ -0,0 +1,185 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+
+
+// Volume fades from 30 to 0 with a status query submitted every 100 ms
+// alongside: setVolume() and delay(50) in a loop, against a jq8400Fader on
+// each of its curves and over a few durations.  How many frames each took,
+// how long the application was held up, how far each level change was from
+// when the curve says it is due (the frame's time on the wire included), and
+// what the queries took meanwhile.  Then when each curve gets to a few levels
+// on the way.  Exits 1 if a fade does not end at 0, or the driver's idea of
+// the volume differs.
+
+#include "jq8400_fade.hpp"
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+
+#define QUERY_EVERY     100
+#define SETTLE_MS       300     // Run on after the fade, for the last level to land
+
+static const char *curveNames[] = { "linear", "log", "S-curve" };
+
+struct Fade {
+  int     frames;
+  int     blockedMs;
+  double  errorMean, errorMax;
+  int     queries;
+  double  queryP50, queryMax;
+  int     reached[MP3_FADE_LEVELS + 1];   // ms at which the module got to each level
+};
+
+
+// What the curve says the volume is at t ms in
+static int level(int curve, int durationMs, double t) {
+  return (int)floor(30 - 30 * jq8400FadeShape(curve, t / durationMs) + 0.5);
+}
+
+
+// Returns 1 if it did not end at 0 with the driver knowing so
+static int fade(int useFader, int curve, int durationMs, Fade &result) {
+  jq8400Emulator emu;
+  emu.addFile(MP3_SRC_SDCARD, 1, "001", 600);
+  emu.setSourcePresent(MP3_SRC_SDCARD, 1);
+  jq8400 mp3(emu);
+  mp3.setVolume(30);
+  mp3.playFileByIndexNumber(1);
+  for(int x = 0; x < 100; x++) { mp3.poll(); mp3.delay(1); }
+
+  // When each level is due, to a tenth of a ms
+  double due[MP3_FADE_LEVELS + 1];
+  for(int x = 0; x <= MP3_FADE_LEVELS; x++) due[x] = -1;
+  int was = MP3_FADE_LEVELS;
+  for(int t = 0; t <= durationMs * 10; t++) {
+    int now = level(curve, durationMs, t / 10.0);
+    for(int x = was - 1; x >= now; x--) due[x] = t / 10.0;
+    if(now < was) was = now;
+  }
+
+  for(int x = 0; x <= MP3_FADE_LEVELS; x++) result.reached[x] = -1;
+  int     frames  = emu.framesReceived();
+  int     started = mp3.millis();
+  int     queries[256];
+  int     queryCount = 0;
+  result.blockedMs = 0;
+
+  if(!useFader) {
+    for(int t = 0; t <= durationMs; t += 50) {
+      int before = mp3.millis();
+      mp3.setVolume(level(curve, durationMs, t));
+      mp3.delay(50);
+      result.blockedMs += mp3.millis() - before;
+      for(int x = MP3_FADE_LEVELS - 1; x >= emu.volume(); x--) {
+        if(result.reached[x] < 0) result.reached[x] = mp3.millis() - started;
+      }
+    }
+  } else {
+    jq8400Fader fader(mp3);
+    fader.fadeTo(0, durationMs, curve);
+
+    uint8_t response[1];
+    int     handle  = 0;
+    int     askedAt = 0;
+    int     nextAt  = started + 37;
+    while(mp3.millis() - started < durationMs + SETTLE_MS) {
+      fader.service();
+      if(!handle && mp3.millis() - nextAt >= 0) {
+        handle  = mp3.submit(jq8400::MP3_CMD_STATUS, 0, 0, response, 1);
+        askedAt = mp3.micros();
+        nextAt  = mp3.millis() + QUERY_EVERY;
+      }
+      mp3.poll();
+      if(handle && mp3.complete(handle)) {
+        if(queryCount < 256) queries[queryCount++] = mp3.micros() - askedAt;
+        mp3.result(handle);
+        handle = 0;
+      }
+      for(int x = MP3_FADE_LEVELS - 1; x >= emu.volume(); x--) {
+        if(result.reached[x] < 0) result.reached[x] = mp3.millis() - started;
+      }
+      mp3.delay(1);
+    }
+  }
+
+  result.frames    = emu.framesReceived() - frames - queryCount; // Volume frames only
+  result.errorMean = result.errorMax = 0;
+  int levels = 0;
+  for(int x = 0; x < MP3_FADE_LEVELS; x++) {
+    if(result.reached[x] < 0 || due[x] < 0) continue;
+    double error = fabs(result.reached[x] - due[x]);
+    result.errorMean += error;
+    if(error > result.errorMax) result.errorMax = error;
+    levels++;
+  }
+  if(levels) result.errorMean /= levels;
+
+  std::sort(queries, queries + queryCount);
+  result.queries  = queryCount;
+  result.queryP50 = queryCount ? queries[queryCount / 2] / 1000.0 : 0;
+  result.queryMax = queryCount ? queries[queryCount - 1] / 1000.0 : 0;
+  return emu.volume() != 0 || mp3.getVolume() != 0;
+}
+
+
+int main() {
+  static const struct { int fader, curve, durationMs; } runs[] = {
+    { 0, MP3_FADE_LINEAR, 3000 },
+    { 1, MP3_FADE_LINEAR, 3000 },
+    { 1, MP3_FADE_LOG,    3000 },
+    { 1, MP3_FADE_SCURVE, 3000 },
+    { 1, MP3_FADE_SCURVE, 10000 },
+    { 1, MP3_FADE_LINEAR, 300 },
+  };
+  const int runCount = sizeof(runs) / sizeof(runs[0]);
+  Fade results[runCount];
+  int  bad = 0;
+
+  printf("volume 30 to 0, a status query every %d ms with the fader\n\n", QUERY_EVERY);
+  printf("%-36s %7s %8s %16s %18s\n", "", "volume", "held up", "step error ms", "queries ms");
+  printf("%-36s %7s %8s %8s %7s %9s %8s\n", "", "frames", "ms", "mean", "max", "p50", "max");
+  for(int r = 0; r < runCount; r++) {
+    bad += fade(runs[r].fader, runs[r].curve, runs[r].durationMs, results[r]);
+    char label[40];
+    sprintf(label, "%s %s %d ms", runs[r].fader ? "fader" : "setVolume+delay(50)", curveNames[runs[r].curve], runs[r].durationMs);
+    Fade &f = results[r];
+    printf("%-36s %7d %8d %8.1f %7.1f", label, f.frames, f.blockedMs, f.errorMean, f.errorMax);
+    if(f.queries) printf(" %9.1f %8.1f\n", f.queryP50, f.queryMax); else printf(" %9s %8s\n", "-", "-");
+  }
+
+  printf("\nms into a 3 s fade the module is at\n%-10s", "curve");
+  for(int x = 25; x >= 0; x -= 5) printf(" %6d", x);
+  printf("\n");
+  for(int r = 1; r <= 3; r++) {
+    printf("%-10s", curveNames[runs[r].curve]);
+    for(int x = 25; x >= 0; x -= 5) printf(" %6d", results[r].reached[x]);
+    printf("\n");
+  }
+  return bad ? 1 : 0;
+}
@@ -0,0 +1,52 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+
+// The RAM each part of the driver takes with the MP3_* settings it is built
+// with, so that it can be tracked from one configuration to another:
+//
+//   make footprint CONFIG="-DMP3_QUEUE_DEPTH=4 -DMP3_MAX_REQUEST_LENGTH=16"
+//
+// The coroutine lines are only there when built as C++20 (eg
+// CXXFLAGS="-O2 -std=c++20").
+
+#include "jq8400_footprint.hpp"
+#include <stdio.h>
+
+int main() {
+  printf("MP3_QUEUE_DEPTH %d, MP3_MAX_REQUEST_LENGTH %d, MP3_MAX_RESPONSE_LENGTH %d, MP3_RX_BUFFER_SIZE %d, MP3_TX_BUFFER_SIZE %d,\n",
+    MP3_QUEUE_DEPTH, MP3_MAX_REQUEST_LENGTH, MP3_MAX_RESPONSE_LENGTH, MP3_RX_BUFFER_SIZE, MP3_TX_BUFFER_SIZE);
+  printf("MP3_CATALOG_MAX_FOLDERS %d, MP3_METADATA_TRACKS %d, MP3_METRICS %d, MP3_TRACE %d\n\n",
+    MP3_CATALOG_MAX_FOLDERS, MP3_METADATA_TRACKS, MP3_METRICS, MP3_TRACE);
+
+  printf("%-32s %8s\n", "", "bytes");
+  for(const jq8400FootprintEntry &entry : jq8400Footprint) {
+    printf("%-32s %8d\n", entry.name, entry.bytes);
+  }
+  return 0;
+}
@@ -0,0 +1,143 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+
+// N producer threads each asking the module's status over and over (with a
+// volume set every fourth time), through a jq8400Frontend drained by an owner
+// thread, and through a mutex around the blocking calls.
+//
+// Throughput and latency are in the emulator's time, which is the module's
+// and the line's, send() is the real time a producer spends queueing.  Every
+// answer must be one byte saying it is playing, or it counts as wrong.
+
+#include "jq8400_frontend.hpp"
+#include <stdio.h>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+static const int producerCounts[] = { 1, 2, 4, 8 };
+static const int queries          = 100;    // Per producer
+
+
+static void run(int producers, int useMutex) {
+  jq8400Emulator emu;
+  emu.addFile(MP3_SRC_SDCARD, 1, "001", 600);
+  emu.setSourcePresent(MP3_SRC_SDCARD, 1);
+
+  jq8400 mp3(emu);
+  mp3.playFileByIndexNumber(1);
+  jq8400Frontend frontend(mp3);
+
+  std::atomic<long long> now(emu.now());   // The emulator's clock as the owner last saw it
+  std::atomic<int>       sends(0), wrong(0);
+  std::atomic<bool>      stop(false);
+  std::mutex             lock;
+  std::vector<long long> latency[8];
+  std::vector<double>    sendNs[8];
+  long long              started = emu.now();
+
+  // Only the owner touches the jq8400, it sleeps (yields) while there is nothing to do
+  std::thread owner;
+  if(!useMutex) {
+    owner = std::thread([&] {
+      int seen = 0;
+      while(!stop) {
+        int busy = frontend.service();
+        now = emu.now();
+        if(!busy) {
+          while(!stop && sends == seen) std::this_thread::yield();
+          seen = sends;
+        }
+      }
+    });
+  }
+
+  std::vector<std::thread> threads;
+  for(int p = 0; p < producers; p++) {
+    threads.push_back(std::thread([&, p] {
+      jq8400Future future;
+      uint8_t      volume = 10 + p;
+      for(int q = 0; q < queries; q++) {
+        long long asked = now;
+        if(useMutex) {
+          std::lock_guard<std::mutex> hold(lock);
+          mp3.invalidateCache(); // So that it really asks
+          if(mp3.getStatus() != MP3_STATUS_PLAYING) wrong++;
+          if(q % 4 == 0) mp3.setVolume(volume);
+          now = emu.now();
+        } else {
+          std::chrono::steady_clock::time_point sendStarted = std::chrono::steady_clock::now();
+          while(!frontend.send(jq8400::MP3_CMD_STATUS, 0, 0, &future, 1)) std::this_thread::yield();
+          sends++;
+          if(q % 4 == 0) {
+            while(!frontend.send(jq8400::MP3_CMD_VOL_SET, &volume, 1)) std::this_thread::yield();
+            sends++;
+          }
+          sendNs[p].push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - sendStarted).count());
+
+          while(!future.ready()) std::this_thread::yield();
+          if(future.result() != MP3_FRAME_OK || future.length() != 1 || future.value() != MP3_STATUS_PLAYING) wrong++;
+        }
+        latency[p].push_back(now - asked);
+      }
+    }));
+  }
+  for(size_t t = 0; t < threads.size(); t++) threads[t].join();
+  stop = true;
+  if(owner.joinable()) owner.join();
+
+  std::vector<long long> latencies;
+  std::vector<double>    ns;
+  for(int p = 0; p < producers; p++) {
+    latencies.insert(latencies.end(), latency[p].begin(), latency[p].end());
+    ns.insert(ns.end(), sendNs[p].begin(), sendNs[p].end());
+  }
+  std::sort(latencies.begin(), latencies.end());
+  std::sort(ns.begin(), ns.end());
+
+  double seconds = (emu.now() - started) / 1e6;
+  printf("%-9s %9d %7d %10.1f %8.1f %8.1f", useMutex ? "mutex" : "frontend", producers, (int)wrong,
+    producers * queries / seconds, latencies[latencies.size() / 2] / 1000.0, latencies[latencies.size() * 99 / 100] / 1000.0);
+  if(!useMutex) {
+    printf(" %10.0f %10.0f", ns[ns.size() / 2], ns[ns.size() * 99 / 100]);
+  }
+  printf("\n");
+}
+
+
+int main() {
+  printf("%-9s %9s %7s %10s %8s %8s %10s %10s\n", "", "producers", "wrong", "queries/s", "p50 ms", "p99 ms", "send p50ns", "send p99ns");
+  for(int c = 0; c < (int)(sizeof(producerCounts) / sizeof(producerCounts[0])); c++) {
+    run(producerCounts[c], 0);
+    run(producerCounts[c], 1);
+  }
+  return 0;
+}
@@ -0,0 +1,225 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+
+// Faults injected into an emulated module every 30 to 60 s for 40 minutes,
+// under ordinary application traffic, with a jq8400HealthMonitor watching:
+// how long each kind takes to be noticed and put right, and how often that
+// took a reset().  Against it, what a reset() and restoring the settings
+// costs, and a fault free run, which must see no divergence at all.
+
+#include "jq8400_health.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+
+static const char *faultNames[] = {
+  "brown out", "lost play", "lost pause", "stray next", "stray pause", "corrupt 4 s", "card out 5 s", "lost stop"
+};
+static const int faultKinds = sizeof(faultNames) / sizeof(faultNames[0]);
+
+static int divergedAt, recoveredAt;
+static void diverged(jq8400 &device, int, void *)  { divergedAt  = device.millis(); }
+static void recovered(jq8400 &device, int, void *) { recoveredAt = device.millis(); }
+
+
+// A command as from some other controller on the line, which the driver does not know about
+static void stray(jq8400Emulator &emu, int command) {
+  emu.hostWrite(0xAA);
+  emu.hostWrite(command);
+  emu.hostWrite(0);
+  emu.hostWrite((0xAA + command) & 0xFF);
+}
+
+
+static void addFiles(jq8400Emulator &emu) {
+  for(int x = 1; x <= 10; x++) {
+    char name[8];
+    sprintf(name, "T%02d", x);
+    emu.addFile(MP3_SRC_SDCARD, 1, name, 40 + x * 5);
+  }
+  emu.setSourcePresent(MP3_SRC_SDCARD, 1);
+}
+
+
+static void setUp(jq8400 &mp3) {
+  mp3.setSource(MP3_SRC_SDCARD);
+  mp3.setVolume(25);
+  mp3.setEqualizer(MP3_EQ_ROCK);
+  mp3.setLoopMode(MP3_LOOP_ALL);
+  mp3.countFiles();
+  mp3.playFileByIndexNumber(3);
+}
+
+
+// Returns the number of recoveries which left the settings wrong
+static int run(int injectFaults, int minutes) {
+  jq8400Emulator emu;
+  addFiles(emu);
+  jq8400 mp3(emu);
+  setUp(mp3);
+
+  jq8400HealthMonitor health(mp3);
+  health.onDiverged(&diverged, 0);
+  health.onRecovered(&recovered, 0);
+  srand(7);
+
+  int faults = 0, wrong = 0, kind = -1, injectedAt = -1, undoAt = -1;
+  int total[faultKinds] = { 0 }, count[faultKinds] = { 0 };
+  int started   = mp3.millis();
+  int nextFault = started + 20000;
+  int nextApp   = started + 7000;
+
+  while(mp3.millis() - (started + minutes * 60000) < 0) {
+    health.service();
+    mp3.delay(1);
+    int now = mp3.millis();
+
+    if(undoAt >= 0 && now - undoAt >= 0) {
+      emu.setCorruptRate(0);
+      emu.setSourcePresent(MP3_SRC_SDCARD, 1);
+      undoAt = -1;
+    }
+
+    // What the application does anyway, none of it is a fault
+    if(now - nextApp >= 0 && injectedAt < 0) {
+      switch(rand() % 5) {
+        case 0: mp3.pause(); break;
+        case 1: mp3.play(); break;
+        case 2: mp3.setVolume(15 + rand() % 15); break;
+        case 3: mp3.playFileByIndexNumber(1 + rand() % 10); break;
+        case 4: mp3.getStatus(); break;
+      }
+      nextApp = now + 3000 + rand() % 9000;
+    }
+
+    if(injectFaults && now - nextFault >= 0 && injectedAt < 0 && health.healthy()) {
+      kind        = faults++ % faultKinds;
+      injectedAt  = now;
+      divergedAt  = recoveredAt = -1;
+      switch(kind) {
+        case 0: emu.powerOn(300); break;
+        case 1: emu.setDropRate(1000); mp3.playFileByIndexNumber(emu.currentIndex() % 10 + 1); emu.setDropRate(0); break;
+        case 2:
+          if(mp3.getStatus() != MP3_STATUS_PLAYING) { mp3.play(); mp3.delay(100); }
+          emu.setDropRate(1000); mp3.pause(); emu.setDropRate(0);
+          break;
+        case 3: while(mp3.poll()) mp3.delay(1); mp3.delay(20); stray(emu, jq8400::MP3_CMD_NEXT); break;
+        case 4:
+          while(mp3.poll()) mp3.delay(1);
+          mp3.delay(20);
+          if(emu.status() != MP3_STATUS_PLAYING) { faults--; injectedAt = -1; break; }
+          stray(emu, jq8400::MP3_CMD_PAUSE);
+          break;
+        case 5: emu.setCorruptRate(1000); undoAt = now + 4000; break;
+        case 6: emu.setSourcePresent(MP3_SRC_SDCARD, 0); stray(emu, jq8400::MP3_CMD_STOP); undoAt = now + 5000; break;
+        case 7: emu.setDropRate(1000); mp3.stop(); emu.setDropRate(0); break;
+      }
+      nextFault = now + 30000 + rand() % 30000;
+    }
+
+    if(injectedAt >= 0 && recoveredAt >= 0 && undoAt < 0) {
+      total[kind] += recoveredAt - injectedAt;
+      count[kind]++;
+      mp3.delay(60);
+      if(emu.volume() != mp3.getVolume() || emu.equalizer() != MP3_EQ_ROCK || emu.loopMode() != MP3_LOOP_ALL || emu.source() != MP3_SRC_SDCARD) {
+        wrong++;
+      }
+      injectedAt = -1;
+    } else if(injectedAt >= 0 && now - injectedAt > 20000) {
+      printf("  %s not recovered\n", faultNames[kind]);
+      wrong++;
+      injectedAt = -1;
+    }
+  }
+
+  if(injectFaults) {
+    printf("%-14s %4s %12s\n", "fault", "n", "recover ms");
+    for(int k = 0; k < faultKinds; k++) {
+      if(count[k]) printf("%-14s %4d %12d\n", faultNames[k], count[k], total[k] / count[k]);
+    }
+    printf("\n");
+  }
+  printf("%s, %d min: %d divergences, %d resyncs, %d resets, %d of %d recoveries without a reset, mean %d ms worst %d ms, %d left wrong\n",
+    injectFaults ? "faults" : "no faults", minutes, health.divergences(), health.resyncs(), health.resets(),
+    health.resetsAvoided(), health.divergences(), health.meanRecoveryMs(), health.worstRecoveryMs(), wrong);
+  return wrong + (injectFaults ? 0 : health.divergences());
+}
+
+
+// The old way out: reset() then put everything back, from the start of the track
+static void resetAndRestore() {
+  jq8400Emulator emu;
+  addFiles(emu);
+  jq8400 mp3(emu);
+  setUp(mp3);
+
+  long total = 0;
+  const int rounds = 20;
+  for(int r = 0; r < rounds; r++) {
+    mp3.delay(5000);
+    emu.powerOn(300);
+    int started = mp3.millis();
+    mp3.reset();
+    setUp(mp3);
+    total += mp3.millis() - started;
+  }
+  printf("reset() and restore: mean %ld ms, and the position is lost\n", total / rounds);
+}
+
+
+// The line dead for 25 s, long enough for the monitor to fall back to a reset()
+static void deadLine() {
+  jq8400Emulator emu;
+  addFiles(emu);
+  jq8400 mp3(emu);
+  setUp(mp3);
+
+  jq8400HealthMonitor health(mp3);
+  health.onRecovered(&recovered, 0);
+  recoveredAt = -1;
+
+  int started = mp3.millis();
+  while(mp3.millis() - started < 5000) { health.service(); mp3.delay(1); }
+  emu.setDropRate(1000);
+  int cut = mp3.millis();
+  while(mp3.millis() - cut < 25000) { health.service(); mp3.delay(1); }
+  emu.setDropRate(0);
+  while(recoveredAt < 0 && mp3.millis() - cut < 60000) { health.service(); mp3.delay(1); }
+
+  printf("line dead 25 s: %d resets, recovered %.1f s after it was cut, playing %d index %d volume %d\n",
+    health.resets(), (recoveredAt - cut) / 1000.0, emu.status() == MP3_STATUS_PLAYING, emu.currentIndex(), emu.volume());
+}
+
+
+int main() {
+  int bad = run(1, 40);
+  bad += run(0, 30);
+  resetAndRestore();
+  deadLine();
+  return bad ? 1 : 0;
+}
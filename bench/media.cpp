@@ -0,0 +1,225 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+
+// Failover when the card is pulled while playing: a jq8400MediaWatcher going to
+// a track on the flash, against the usual poll of sourceAvailable() every
+// MP3_MEDIA_WATCH_MS and then setSource(), countFiles() and play.  How long
+// from the card being pulled until the fallback is heard, and from it being
+// put back until the card is playing again, with a USB stick coming and going
+// in between.  The watcher must resume the card at the track it was on.
+
+#include "jq8400_media.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CYCLES          10
+#define CARD_TRACK      7
+#define FLASH_TRACK     2
+#define GIVE_UP_MS      5000
+
+static jq8400MediaWatcher *watcher;
+
+// Back to the card as soon as it is put back
+static void inserted(jq8400 &, int source, void *) {
+  if(source == MP3_SRC_SDCARD) watcher->switchTo(MP3_SRC_SDCARD);
+}
+
+
+struct Latency {
+  long  sum;
+  int   worst, count;
+
+  Latency() : sum(0), worst(0), count(0) { }
+  void add(int ms)  { sum += ms; count++; if(ms > worst) worst = ms; }
+  int  mean()       { return count ? (int)(sum / count) : -1; }
+};
+
+
+static void addFiles(jq8400Emulator &emu) {
+  char name[8];
+  for(int x = 1; x <= 20; x++) { sprintf(name, "S%02d", x); emu.addFile(MP3_SRC_SDCARD, 1, name, 200); }
+  for(int x = 1; x <= 5;  x++) { sprintf(name, "U%02d", x); emu.addFile(MP3_SRC_USB,    1, name, 200); }
+  for(int x = 1; x <= 3;  x++) { sprintf(name, "F%02d", x); emu.addFile(MP3_SRC_FLASH,  1, name, 200); }
+  emu.setSourcePresent(MP3_SRC_SDCARD, 1);
+  emu.setSourcePresent(MP3_SRC_FLASH, 1);
+}
+
+
+// Returns 1 if it did not fail over or back in time, or the watcher resumed
+// the card on the wrong track
+static int run(int useWatcher) {
+  jq8400Emulator emu;
+  addFiles(emu);
+  jq8400 mp3(emu);
+  mp3.setSource(MP3_SRC_SDCARD);
+  mp3.setVolume(20);
+
+  jq8400MediaWatcher media(mp3);
+  watcher = &media;
+  if(useWatcher) {
+    media.setFallback(MP3_SRC_FLASH, FLASH_TRACK);
+    media.onInserted(inserted, 0);
+    media.scan();
+  }
+  mp3.playFileByIndexNumber(CARD_TRACK);
+
+  Latency failover, failback;
+  long    failoverFrames = 0;
+  int     wrongTrack = 0;
+  int     polledAt = mp3.millis();
+  srand(5);
+
+  for(int cycle = 0; cycle < CYCLES; cycle++) {
+    // A while on the card, with the USB stick going in or out part way
+    int started = mp3.millis();
+    int stickAt = started + 2000 + rand() % 3000;
+    int leaveAt = started + 8000 + rand() % 900;
+    while(mp3.millis() - leaveAt < 0) {
+      if(useWatcher) {
+        media.service();
+      } else {
+        if(mp3.millis() - polledAt >= MP3_MEDIA_WATCH_MS) { polledAt = mp3.millis(); mp3.sourceAvailable(MP3_SRC_SDCARD); }
+        mp3.poll();
+      }
+      mp3.delay(1);
+      if(mp3.millis() == stickAt) emu.setSourcePresent(MP3_SRC_USB, !(cycle & 1));
+    }
+
+    emu.setSourcePresent(MP3_SRC_SDCARD, 0);
+    int pulled = mp3.millis();
+    int frames = emu.framesReceived();
+    while(!(emu.source() == MP3_SRC_FLASH && emu.status() == MP3_STATUS_PLAYING && emu.currentIndex() == FLASH_TRACK)) {
+      if(useWatcher) {
+        media.service();
+      } else {
+        if(mp3.millis() - polledAt >= MP3_MEDIA_WATCH_MS) {
+          polledAt = mp3.millis();
+          if(!mp3.sourceAvailable(MP3_SRC_SDCARD)) {
+            mp3.setSource(MP3_SRC_FLASH);
+            mp3.countFiles();
+            mp3.playFileByIndexNumber(FLASH_TRACK);
+          }
+        }
+        mp3.poll();
+      }
+      mp3.delay(1);
+      if(mp3.millis() - pulled > GIVE_UP_MS) {
+        printf("no failover after %d ms\n", GIVE_UP_MS);
+        return 1;
+      }
+    }
+    failover.add(mp3.millis() - pulled);
+    failoverFrames += emu.framesReceived() - frames;
+
+    // A while on the flash, then the card goes back in
+    started = mp3.millis();
+    while(mp3.millis() - started < 3000) {
+      if(useWatcher) media.service(); else mp3.poll();
+      mp3.delay(1);
+    }
+    emu.setSourcePresent(MP3_SRC_SDCARD, 1);
+    int insertedAt = mp3.millis();
+    while(!(emu.source() == MP3_SRC_SDCARD && emu.status() == MP3_STATUS_PLAYING)) {
+      if(useWatcher) {
+        media.service();
+      } else {
+        if(mp3.millis() - polledAt >= MP3_MEDIA_WATCH_MS) {
+          polledAt = mp3.millis();
+          if(mp3.sourceAvailable(MP3_SRC_SDCARD)) {
+            mp3.setSource(MP3_SRC_SDCARD);
+            mp3.countFiles();
+            mp3.playFileByIndexNumber(CARD_TRACK);
+          }
+        }
+        mp3.poll();
+      }
+      mp3.delay(1);
+      if(mp3.millis() - insertedAt > GIVE_UP_MS) {
+        printf("no failback after %d ms\n", GIVE_UP_MS);
+        return 1;
+      }
+    }
+    failback.add(mp3.millis() - insertedAt);
+    if(emu.currentIndex() != CARD_TRACK) wrongTrack++;
+  }
+
+  printf("%-22s %8d %8d %14.1f %14d %8d\n", useWatcher ? "jq8400MediaWatcher" : "sourceAvailable() poll",
+    failover.mean(), failover.worst, (double)failoverFrames / CYCLES, failback.mean(), wrongTrack);
+  if(useWatcher) {
+    printf("  removal seen to fallback sent: worst %d ms, %d inserts, %d removals, %d failovers, %d source queries\n",
+      media.worstFailoverMs(), media.inserts(), media.removals(), media.failovers(), media.queriesSent());
+  }
+  return useWatcher && wrongTrack;
+}
+
+
+static void ignore(jq8400Request *, void *) { }
+
+// The card pulled while the jq8400's queue is kept full, so the fallback can
+// not be sent when the removal is seen.  Returns 1 if it is never sent.
+static int busyQueue() {
+  jq8400Emulator emu;
+  addFiles(emu);
+  jq8400 mp3(emu);
+  mp3.setSource(MP3_SRC_SDCARD);
+
+  jq8400MediaWatcher media(mp3);
+  media.setFallback(MP3_SRC_FLASH, FLASH_TRACK);
+  media.scan();
+  mp3.playFileByIndexNumber(CARD_TRACK);
+  for(int started = mp3.millis(); mp3.millis() - started < 2000; mp3.delay(1)) media.service();
+
+  static uint8_t response[1];
+  emu.setSourcePresent(MP3_SRC_SDCARD, 0);
+  int pulled = mp3.millis();
+  while(!(emu.source() == MP3_SRC_FLASH && emu.status() == MP3_STATUS_PLAYING && emu.currentIndex() == FLASH_TRACK)) {
+    if(mp3.millis() - pulled < 3 * MP3_MEDIA_WATCH_MS) {
+      while(mp3.submit(jq8400::MP3_CMD_STATUS, 0, 0, response, 1, ignore, 0)) { }
+    }
+    media.service();
+    mp3.delay(1);
+    if(mp3.millis() - pulled > GIVE_UP_MS) {
+      printf("\nqueue kept full for %d ms as the card went: no failover after %d ms\n", 3 * MP3_MEDIA_WATCH_MS, GIVE_UP_MS);
+      return 1;
+    }
+  }
+  printf("\nqueue kept full for %d ms as the card went: fallback playing after %d ms\n", 3 * MP3_MEDIA_WATCH_MS, mp3.millis() - pulled);
+  return 0;
+}
+
+
+int main() {
+  printf("%d card pulls while playing, to track %d on the flash and back\n\n", CYCLES, FLASH_TRACK);
+  printf("%-22s %8s %8s %14s %14s %8s\n", "", "failover", "", "frames", "failback", "wrong");
+  printf("%-22s %8s %8s %14s %14s %8s\n", "failed over by", "mean ms", "worst ms", "per failover", "mean ms", "track");
+  int bad = run(1);
+  bad += run(0);
+  bad += busyQueue();
+  return bad ? 1 : 0;
+}
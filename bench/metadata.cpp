@@ -0,0 +1,178 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+
+
+// A display showing the name and length of the track playing, refreshed
+// every 100 ms for two minutes over 40 short tracks in loop all, with the
+// name and length asked of the module every time (as they used to be) and
+// answered from the metadata cache, with and without a jq8400StatusMonitor.
+// Then crawlMetadata() from stopped, and the display after it.  A refresh
+// showing the track that has just ended is stale, any other is wrong.  Exits
+// 1 on a wrong one, a stale one from the cache with the monitor running, or
+// if the crawl misses a track or leaves the module elsewhere.
+
+#include "jq8400_monitor.hpp"
+#include <stdio.h>
+#include <string.h>
+
+#define TRACKS          40
+#define REFRESH_MS      100
+#define RUN_MS          120000
+
+static const char *names[] = { "INTRO", "01", "02", "03", "01", "02", "OUTRO" };
+static const int   nameCount = sizeof(names) / sizeof(names[0]);
+
+// sendCommand() is for the driver and its helpers, a subclass may call it
+struct jq8400Uncached : public jq8400
+{
+  jq8400Uncached(jq8400Emulator &emulator) : jq8400(emulator) { }
+
+  // currentFileName() and currentFileLengthInSeconds() as they were
+  void askName(char *buffer, int bufferLength) {
+    this->sendCommand<MP3_CMD_CURRENT_FILE_NAME>((uint8_t *)buffer, bufferLength);
+    buffer[bufferLength - 1] = 0;
+  }
+  int askLength() {
+    uint8_t buf[3];
+    this->sendCommand<MP3_CMD_CURRENT_FILE_LEN>(buf, 3);
+    return lastFrameResult == MP3_FRAME_OK ? (buf[0] * 60 * 60) + (buf[1] * 60) + buf[2] : -1;
+  }
+};
+
+
+static void addFiles(jq8400Emulator &emu) {
+  for(int x = 0; x < TRACKS; x++) emu.addFile(MP3_SRC_SDCARD, 1 + x / 10, names[x % nameCount], 2 + x % 3);
+  emu.setSourcePresent(MP3_SRC_SDCARD, 1);
+}
+
+
+static int shows(const char *name, int length, int index) {
+  return !strcmp(name, names[(index - 1) % nameCount]) && length == 2 + (index - 1) % 3;
+}
+
+
+// The display loop, returns how many refreshes showed a name or length of
+// neither the track playing nor the one before it, stale counts those which
+// showed the one before
+static int display(jq8400Emulator &emu, jq8400Uncached &mp3, int cached, int monitored, int *commands, int *asked, int *stale) {
+  jq8400StatusMonitor monitor(mp3);
+  int sent    = mp3.commandsSent();
+  int wrong   = 0;
+  *asked      = 0;
+  *stale      = 0;
+  int started = mp3.millis();
+  int nextAt  = started;
+  while(mp3.millis() - started < RUN_MS) {
+    if(monitored) monitor.service(); else mp3.poll();
+    if(mp3.millis() - nextAt >= 0) {
+      nextAt += REFRESH_MS;
+      char name[16];
+      int  length;
+      if(cached) {
+        int index = mp3.currentFileIndexNumber();
+        if(!mp3.trackName(index, name, sizeof(name)) || mp3.trackLengthInSeconds(index) < 0) (*asked)++;
+        mp3.currentFileName(name, sizeof(name));
+        length = mp3.currentFileLengthInSeconds();
+      } else {
+        mp3.askName(name, sizeof(name));
+        length = mp3.askLength();
+        (*asked)++;
+      }
+      int index = emu.currentIndex();
+      if(index > 0 && !shows(name, length, index)) {
+        if(shows(name, length, index > 1 ? index - 1 : TRACKS)) (*stale)++; else wrong++;
+      }
+    }
+    mp3.delay(1);
+  }
+  *commands = mp3.commandsSent() - sent;
+  return wrong;
+}
+
+
+// Returns 1 if it should fail the bench
+static int run(int cached, int monitored) {
+  jq8400Emulator emu;
+  addFiles(emu);
+  jq8400Uncached mp3(emu);
+  mp3.setSource(MP3_SRC_SDCARD);
+  mp3.countFiles();
+  mp3.setLoopMode(MP3_LOOP_ALL);
+  mp3.playFileByIndexNumber(1);
+
+  int commands, asked, stale;
+  int wrong = display(emu, mp3, cached, monitored, &commands, &asked, &stale);
+  printf("%-8s %-14s %10d %10d %10d %10d\n", cached ? "cached" : "asking", monitored ? "status monitor" : "-", commands, asked, stale, wrong);
+  return wrong || (cached && monitored && stale);
+}
+
+
+static int crawl() {
+  jq8400Emulator emu;
+  addFiles(emu);
+  jq8400Uncached mp3(emu);
+  mp3.setSource(MP3_SRC_SDCARD);
+  mp3.countFiles();
+  mp3.setLoopMode(MP3_LOOP_ALL);
+  mp3.seekFileByIndexNumber(5);
+  mp3.getStatus();
+
+  int sent    = mp3.commandsSent();
+  int started = mp3.millis();
+  while(mp3.crawlMetadata() && mp3.millis() - started < 60000) {
+    mp3.poll();
+    mp3.delay(1);
+  }
+  while(mp3.poll()) mp3.delay(1);
+  int took     = mp3.millis() - started;
+  int commands = mp3.commandsSent() - sent;
+  mp3.delay(50);
+  printf("\ncrawled %d of %d tracks in %d ms and %d commands, left on index %d\n", mp3.tracksKnown(), TRACKS, took, commands, emu.currentIndex());
+  int bad = mp3.tracksKnown() != TRACKS || emu.currentIndex() != 5;
+
+  // After which the display asks for no names or lengths at all
+  mp3.playFileByIndexNumber(1);
+  mp3.delay(50);
+  int asked, stale;
+  int wrong = display(emu, mp3, 1, 1, &commands, &asked, &stale);
+  printf("display after it, with the status monitor: %d commands, %d refreshes asked the module, %d stale, %d wrong\n", commands, asked, stale, wrong);
+  return bad || wrong;
+}
+
+
+int main() {
+  printf("%d tracks in loop all, name and length shown every %d ms for %d s\n\n", TRACKS, REFRESH_MS, RUN_MS / 1000);
+  printf("%-8s %-14s %10s %10s %10s %10s\n", "names", "alongside", "commands", "asked", "stale", "wrong");
+  int bad = run(0, 0);
+  bad += run(1, 0);
+  bad += run(0, 1);
+  bad += run(1, 1);
+  bad += crawl();
+  return bad ? 1 : 0;
+}
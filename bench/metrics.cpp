@@ -0,0 +1,145 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+
+
+// Ten minutes of an application's traffic on a noisy line, built with
+// MP3_METRICS=1, and what jq8400::metrics() makes of it: the counters, then
+// the latency histogram of each command that was sent.  Exits 1 if the
+// histograms do not add up to the command counts or the line's corruption
+// went unseen.
+
+#include "jq8400.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+
+#if !MP3_METRICS
+  #error Build with -DMP3_METRICS=1
+#endif
+
+#define RUN_MS          600000
+#define CORRUPT         20      // Responses in 1000
+#define DROPPED         2       // Bytes in 1000
+
+struct Named {
+  int         command;
+  const char *name;
+};
+
+static const Named names[] = {
+  { jq8400::MP3_CMD_STATUS,             "status" },
+  { jq8400::MP3_CMD_PLAY,               "play" },
+  { jq8400::MP3_CMD_PAUSE,              "pause" },
+  { jq8400::MP3_CMD_PLAY_IDX,           "play index" },
+  { jq8400::MP3_CMD_VOL_SET,            "volume" },
+  { jq8400::MP3_CMD_EQ_SET,             "equalizer" },
+  { jq8400::MP3_CMD_SOURCE_SET,         "set source" },
+  { jq8400::MP3_CMD_GET_SOURCES,        "sources" },
+  { jq8400::MP3_CMD_COUNT_FILES,        "count files" },
+  { jq8400::MP3_CMD_CURRENT_FILE_IDX,   "current index" },
+  { jq8400::MP3_CMD_CURRENT_FILE_LEN,   "length" },
+  { jq8400::MP3_CMD_CURRENT_FILE_NAME,  "name" },
+};
+static const int nameCount = sizeof(names) / sizeof(names[0]);
+
+static const char *nameOf(int command) {
+  for(int x = 0; x < nameCount; x++) {
+    if(names[x].command == command) return names[x].name;
+  }
+  return "?";
+}
+
+
+int main() {
+  jq8400Emulator emu;
+  char name[8];
+  for(int x = 1; x <= 30; x++) { sprintf(name, "T%02d", x); emu.addFile(MP3_SRC_SDCARD, 1, name, 30 + x * 7); }
+  emu.setSourcePresent(MP3_SRC_SDCARD, 1);
+  emu.setCorruptRate(CORRUPT);
+  emu.setDropRate(DROPPED);
+  emu.setSeed(9);
+
+  jq8400 mp3(emu);
+  mp3.setSource(MP3_SRC_SDCARD);
+  mp3.countFiles();
+  mp3.resetMetrics();
+
+  // A status every 250 ms, the volume every 2 s, another track every 20 s
+  // with what is known of it, now and then a pause or the equalizer
+  srand(4);
+  char    trackName[16];
+  int     started = mp3.millis();
+  for(int tick = 0; mp3.millis() - started < RUN_MS; tick++) {
+    mp3.getStatus();
+    if(tick % 8 == 0)   mp3.setVolume(10 + rand() % 20);
+    if(tick % 80 == 0) {
+      mp3.playFileByIndexNumber(1 + rand() % 30);
+      mp3.currentFileIndexNumber();
+      mp3.currentFileLengthInSeconds();
+      mp3.currentFileName(trackName, sizeof(trackName));
+    }
+    if(tick % 120 == 60)  { mp3.pause(); mp3.play(); }
+    if(tick % 240 == 100) mp3.setEqualizer(rand() % 5);
+    if(tick % 400 == 200) mp3.sourceAvailable(MP3_SRC_SDCARD);
+    mp3.delay(250);
+    mp3.invalidateCache();
+  }
+
+  jq8400Metrics metrics;
+  mp3.metrics(metrics);
+  printf("%d minutes, %d in 1000 responses corrupt, %d in 1000 bytes lost\n\n", RUN_MS / 60000, CORRUPT, DROPPED);
+  printf("bytes sent %u, received %u, discarded %u\n", metrics.bytesSent, metrics.bytesReceived, metrics.bytesDiscarded);
+  printf("checksum failures %u, timeouts %u, retries %u, rx overflows %u\n\n",
+    metrics.checksumFailures, metrics.timeouts, metrics.retries, metrics.rxOverflows);
+
+  printf("%-14s %6s %8s %8s  latency, up to ms\n", "", "", "mean", "max");
+  printf("%-14s %6s %8s %8s ", "command", "count", "ms", "ms");
+  for(int b = 0; b < MP3_METRICS_BUCKETS; b++) {
+    if(jq8400Metrics::bucketLimitMs(b) < 0) printf(" %5s", "over"); else printf(" %5d", jq8400Metrics::bucketLimitMs(b));
+  }
+  printf("\n");
+
+  int bad = 0;
+  for(int command = 0; command < MP3_METRICS_COMMANDS; command++) {
+    jq8400CommandMetrics &counted = metrics.commands[command];
+    if(!counted.count) continue;
+
+    printf("%-14s %6u %8.2f %8.2f ", nameOf(command), counted.count, counted.totalUs / 1000.0 / counted.count, counted.maxUs / 1000.0);
+    unsigned inBuckets = 0;
+    for(int b = 0; b < MP3_METRICS_BUCKETS; b++) {
+      printf(" %5u", counted.latency[b]);
+      inBuckets += counted.latency[b];
+    }
+    printf("\n");
+    if(inBuckets != counted.count && counted.count < 65535) bad++;
+  }
+
+  if(!metrics.checksumFailures) bad++;
+  printf("\nsizeof(jq8400) %d bytes with the metrics\n", (int)sizeof(jq8400));
+  return bad ? 1 : 0;
+}
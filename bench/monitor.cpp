@@ -0,0 +1,104 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+
+
+// A 20 s and a 5 s track played through and stopped, watched for 30 s by a
+// jq8400StatusMonitor, by a busy() loop, and by one which also asks for the
+// index to see the track change: how many frames each sent, and how long
+// after the module went on to the second track and stopped each noticed.  Exits 1 if the monitor misses either.
+
+#include "jq8400_monitor.hpp"
+#include <stdio.h>
+
+#define WATCH_MS        30000
+
+static long long stoppedAt, changedAt;
+static void stopped(jq8400 &device, int, void *) { if(stoppedAt < 0) stoppedAt = device.micros(); }
+static void changed(jq8400 &device, int, void *) { if(changedAt < 0) changedAt = device.micros(); }
+
+
+struct Watched {
+  int   frames;
+  int   changeMs;       ///< Noticed after the module went on, -1 if never
+  int   stopMs;
+};
+
+
+// How 0 is busy(), 1 the monitor, 2 busy() and the index
+static void watch(int how, Watched &result) {
+  jq8400Emulator emu;
+  emu.addFile(MP3_SRC_SDCARD, 1, "001", 20);
+  emu.addFile(MP3_SRC_SDCARD, 1, "002", 5);
+  emu.setSourcePresent(MP3_SRC_SDCARD, 1);
+  jq8400 mp3(emu);
+  mp3.setLoopMode(MP3_LOOP_ALL_STOP);
+
+  jq8400StatusMonitor monitor(mp3);
+  monitor.onStopped(stopped, 0);
+  monitor.onTrackChanged(changed, 0);
+  mp3.playFileByIndexNumber(1);
+
+  stoppedAt = changedAt = -1;
+  long long wentOn = -1, ended = -1;
+  int       frames = emu.framesReceived();
+  long long started = emu.now();
+  int       lastIndex = 1;
+  while(emu.now() - started < WATCH_MS * 1000LL) {
+    if(how == 1) {
+      monitor.service();
+    } else {
+      int playing = mp3.busy();
+      int index   = how == 2 ? mp3.currentFileIndexNumber() : lastIndex;
+      if(index != lastIndex && changedAt < 0) changedAt = emu.now();
+      if(!playing && stoppedAt < 0 && emu.now() - started > 1000000) stoppedAt = emu.now();
+      lastIndex = index;
+    }
+    if(wentOn < 0 && emu.currentIndex() == 2) wentOn = emu.now();
+    if(ended < 0 && wentOn >= 0 && emu.status() == MP3_STATUS_STOPPED) ended = emu.now();
+  }
+
+  result.frames   = emu.framesReceived() - frames;
+  result.changeMs = changedAt >= wentOn && wentOn >= 0 ? (int)((changedAt - wentOn) / 1000) : -1;
+  result.stopMs   = stoppedAt >= ended && ended >= 0 ? (int)((stoppedAt - ended) / 1000) : -1;
+}
+
+
+int main() {
+  Watched monitor, busy, indexed;
+  watch(1, monitor);
+  watch(0, busy);
+  watch(2, indexed);
+
+  printf("a 20 s and a 5 s track, then stopped, watched for %d s\n\n", WATCH_MS / 1000);
+  printf("%-20s %8s %16s %16s\n", "", "frames", "next track, ms", "stopped, ms");
+  printf("%-20s %8d %16d %16d\n", "jq8400StatusMonitor", monitor.frames, monitor.changeMs, monitor.stopMs);
+  printf("%-20s %8d %16s %16d\n", "busy() loop", busy.frames, "-", busy.stopMs);
+  printf("%-20s %8d %16d %16d\n", "and the index", indexed.frames, indexed.changeMs, indexed.stopMs);
+  return monitor.changeMs < 0 || monitor.stopMs < 0;
+}
@@ -0,0 +1,160 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+
+// Many modules from one thread, on the tty transport: each an emulator behind
+// a pseudo-tty (jq8400EmulatorPty), served in real time by a second thread as
+// a module would be.  Status queries at 115200 baud, one module after another
+// waiting for each answer, against submitted to every module at once and
+// driven by jq8400Multiplexer::run().  Every query must be answered.
+//
+// Built with JQ8400_POSIX (make multiplexer), and run in real time, so the
+// numbers move a little from run to run.
+
+#include "jq8400.hpp"
+#include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define MAX_MODULES     16
+#define QUERIES         40      // Per module
+#define BAUD            115200
+
+static jq8400EmulatorPty *ptys[MAX_MODULES];
+static int                ptyCount;
+static volatile int       serving;
+
+static void *serve(void *) {
+  while(serving) {
+    for(int x = 0; x < ptyCount; x++) ptys[x]->service();
+    usleep(100);
+  }
+  return 0;
+}
+
+
+static int answered, failed;
+
+static void arrived(jq8400Request *request, void *) {
+  if(request->result == MP3_FRAME_OK) answered++; else failed++;
+}
+
+
+struct Modules {
+  jq8400Emulator *emu[MAX_MODULES];
+  jq8400         *mp3[MAX_MODULES];
+  int             count;
+  pthread_t       server;
+
+  Modules(int modules) : count(modules) {
+    for(int x = 0; x < count; x++) {
+      emu[x] = new jq8400Emulator();
+      emu[x]->addFile(MP3_SRC_SDCARD, 1, "001", 100);
+      emu[x]->setSourcePresent(MP3_SRC_SDCARD, 1);
+      emu[x]->setBaud(BAUD);
+      ptys[x] = new jq8400EmulatorPty(*emu[x]);
+      mp3[x]  = new jq8400(ptys[x]->name(), BAUD);
+    }
+    ptyCount = count;
+    serving  = 1;
+    pthread_create(&server, 0, serve, 0);
+  }
+  ~Modules() {
+    serving = 0;
+    pthread_join(server, 0);
+    for(int x = 0; x < count; x++) { delete mp3[x]; delete ptys[x]; delete emu[x]; }
+  }
+
+  int open() {
+    for(int x = 0; x < count; x++) {
+      if(ptys[x]->fd() < 0 || !mp3[x]->isOpen()) return 0;
+    }
+    return 1;
+  }
+};
+
+
+// Queries a second, -1 if the pseudo-ttys could not be had
+static double oneAfterAnother(int modules) {
+  Modules rack(modules);
+  if(!rack.open()) return -1;
+
+  static uint8_t response[1];
+  answered = failed = 0;
+  long long started = jq8400PosixTransport::monotonicUs();
+  for(int query = 0; query < QUERIES; query++) {
+    for(int x = 0; x < modules; x++) {
+      int handle;
+      while(!(handle = rack.mp3[x]->submit(jq8400::MP3_CMD_STATUS, 0, 0, response, 1, arrived, 0))) rack.mp3[x]->poll();
+      while(!rack.mp3[x]->complete(handle)) rack.mp3[x]->poll();
+    }
+  }
+  return (answered + failed) * 1e6 / (jq8400PosixTransport::monotonicUs() - started);
+}
+
+
+static double multiplexed(int modules) {
+  Modules rack(modules);
+  if(!rack.open()) return -1;
+
+  jq8400Multiplexer mux;
+  for(int x = 0; x < modules; x++) mux.add(*rack.mp3[x]);
+
+  static uint8_t response[MAX_MODULES][1];
+  int submitted[MAX_MODULES] = { 0 };
+  answered = failed = 0;
+  long long started = jq8400PosixTransport::monotonicUs();
+  while(answered + failed < modules * QUERIES) {
+    for(int x = 0; x < modules; x++) {
+      if(submitted[x] < QUERIES && rack.mp3[x]->submit(jq8400::MP3_CMD_STATUS, 0, 0, response[x], 1, arrived, 0)) submitted[x]++;
+    }
+    mux.run(1);
+  }
+  return (answered + failed) * 1e6 / (jq8400PosixTransport::monotonicUs() - started);
+}
+
+
+int main() {
+  static const int sizes[] = { 1, 4, 16 };
+  int bad = 0;
+
+  printf("%d status queries per module at %d baud\n\n", QUERIES, BAUD);
+  printf("%-8s %22s %22s %8s\n", "modules", "one after another /s", "jq8400Multiplexer /s", "failed");
+  for(int size : sizes) {
+    double one = oneAfterAnother(size);
+    int    oneFailed = failed;
+    double mux = multiplexed(size);
+    if(one < 0 || mux < 0) {
+      printf("no pseudo-ttys to be had\n");
+      return 1;
+    }
+    printf("%-8d %22.0f %22.0f %8d\n", size, one, mux, oneFailed + failed);
+    bad += oneFailed + failed;
+  }
+  return bad ? 1 : 0;
+}
@@ -0,0 +1,196 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+
+// Utterances said by a jq8400Phrase, as one MP3_CMD_PLAYLIST (or a few, when
+// too long for one), against the usual play a clip, wait while busy(), play
+// the next.  How long until the first clip is heard, how long the whole thing
+// takes, how many gaps there are between clips, and the frames sent to play
+// the clips and to poll the status.  Both must say the same clips in the
+// same order.
+
+#include "jq8400_phrase.hpp"
+#include <stdio.h>
+#include <string.h>
+
+// Every clip a second long, named by its index less one so that the clip-by-
+// clip side can play it by index
+static constexpr jq8400Clip clips[] = {
+  {"0", "00"}, {"1", "01"}, {"2", "02"}, {"3", "03"}, {"4", "04"}, {"5", "05"}, {"6", "06"},
+  {"7", "07"}, {"8", "08"}, {"9", "09"}, {"10", "10"}, {"11", "11"}, {"12", "12"}, {"13", "13"},
+  {"14", "14"}, {"15", "15"}, {"16", "16"}, {"17", "17"}, {"18", "18"}, {"19", "19"},
+  {"20", "20"}, {"30", "21"}, {"40", "22"}, {"50", "23"}, {"60", "24"}, {"70", "25"},
+  {"80", "26"}, {"90", "27"}, {"hundred", "28"}, {"thousand", "29"}, {"and", "30"},
+  {"minus", "31"}, {"platform", "32"}, {"minutes", "33"}, {"the train to", "34"},
+  {"departs from", "35"}, {"in", "36"}, {"seconds", "37"}
+};
+static const int clipCount = sizeof(clips) / sizeof(clips[0]);
+
+static constexpr int PLATFORM = jq8400FindClip(clips, "platform");
+static_assert(PLATFORM == 32, "looked up by the compiler");
+
+
+// What was heard while an utterance was said
+struct Heard {
+  int     latencyMs, totalMs, gaps, gapMs;
+  int     plays, polls;                 ///< Frames sent, the clips and the status queries
+  int     clips[MP3_PHRASE_CLIPS], clipCount;
+  int     lastIndex, stoppedAt;
+
+  Heard() : latencyMs(-1), totalMs(0), gaps(0), gapMs(0), plays(0), polls(0), clipCount(0), lastIndex(-1), stoppedAt(-1) { }
+
+  void sample(jq8400Emulator &emu, int ms) {
+    int playing = emu.status() == MP3_STATUS_PLAYING;
+    if(playing && latencyMs < 0) {
+      latencyMs = ms;
+    }
+    if(!playing && latencyMs >= 0 && stoppedAt < 0) {
+      stoppedAt = ms;
+    }
+    if(playing && emu.currentIndex() != lastIndex) {
+      if(stoppedAt >= 0) {
+        gaps++;
+        gapMs += ms - stoppedAt;
+      }
+      lastIndex = emu.currentIndex();
+      if(clipCount < MP3_PHRASE_CLIPS) clips[clipCount++] = lastIndex - 1;
+    }
+    if(playing) {
+      stoppedAt = -1;
+    }
+  }
+
+  void print(const char *name) {
+    printf("  %-14s %10d %10d %6d %8d %6d %6d\n", name, latencyMs, totalMs, gaps, gapMs, plays, polls);
+  }
+};
+
+
+static void addFiles(jq8400Emulator &emu) {
+  for(int x = 0; x < clipCount; x++) {
+    emu.addFile(MP3_SRC_SDCARD, 1, clips[x].name, 1);
+  }
+  emu.setSourcePresent(MP3_SRC_SDCARD, 1);
+}
+
+
+static Heard composed(jq8400Emulator &emu, jq8400 &mp3, jq8400Phrase &phrase) {
+  Heard heard;
+  int plays   = phrase.framesSent();
+  int polls   = phrase.queriesSent();
+  int started = mp3.millis();
+  phrase.say();
+  while(phrase.speaking() || emu.status() != MP3_STATUS_STOPPED) {
+    phrase.service();
+    mp3.delay(1);
+    heard.sample(emu, mp3.millis() - started);
+  }
+  heard.totalMs = mp3.millis() - started;
+  heard.plays   = phrase.framesSent() - plays;
+  heard.polls   = phrase.queriesSent() - polls;
+  return heard;
+}
+
+
+static Heard clipByClip(jq8400Emulator &emu, jq8400 &mp3, const int *entries, int count) {
+  Heard heard;
+  int frames  = emu.framesReceived();
+  int started = mp3.millis();
+  for(int x = 0; x < count; x++) {
+    mp3.playFileByIndexNumber(entries[x] + 1);
+    while(mp3.busy()) heard.sample(emu, mp3.millis() - started);
+    heard.sample(emu, mp3.millis() - started);
+  }
+  heard.totalMs = mp3.millis() - started;
+  heard.plays   = count;
+  heard.polls   = emu.framesReceived() - frames - count;
+  return heard;
+}
+
+
+// Says the utterance both ways, returns 1 if they did not say the same
+static int compare(const char *title, jq8400Emulator &emu, jq8400 &mp3, jq8400Phrase &phrase) {
+  Heard a = composed(emu, mp3, phrase);
+  Heard b = clipByClip(emu, mp3, a.clips, a.clipCount);
+
+  printf("\n%s: %d clips of 1 s in %d part%s\n", title, phrase.length(), phrase.parts(), phrase.parts() == 1 ? "" : "s");
+  printf("  %-14s %10s %10s %6s %8s %6s %6s\n", "said by", "latency ms", "total ms", "gaps", "gap ms", "plays", "polls");
+  a.print("jq8400Phrase");
+  b.print("clip by clip");
+
+  int same = a.clipCount == phrase.length() && b.clipCount == a.clipCount && !memcmp(a.clips, b.clips, a.clipCount * sizeof(int));
+  if(!same) {
+    printf("  said different clips\n");
+  }
+  return !same;
+}
+
+
+int main() {
+  jq8400Emulator emu;
+  addFiles(emu);
+  jq8400 mp3(emu);
+  mp3.setSource(MP3_SRC_SDCARD);
+  mp3.setVolume(20);
+  jq8400Phrase phrase(mp3, clips);
+
+  int bad = 0;
+
+  phrase.clear();
+  phrase.clip(PLATFORM);
+  phrase.number(12);
+  phrase.number(3);
+  phrase.word("minutes");
+  bad += compare("platform 12, 3 minutes", emu, mp3, phrase);
+
+  phrase.clear();
+  phrase.word("the train to");
+  phrase.clip(PLATFORM);
+  phrase.number(7);
+  phrase.word("departs from");
+  phrase.word("in");
+  phrase.number(2345);
+  phrase.word("seconds");
+  bad += compare("the train to platform 7 departs in 2345 seconds", emu, mp3, phrase);
+
+  // Longer than one MP3_CMD_PLAYLIST carries
+  phrase.clear();
+  phrase.number(-987654);
+  phrase.word("seconds");
+  phrase.number(101);
+  phrase.number(40);
+  phrase.number(0);
+  phrase.number(1000);
+  bad += compare("-987654 seconds 101 40 0 1000", emu, mp3, phrase);
+
+  phrase.clear();
+  int refused = !phrase.number(1000000) && !phrase.word("banana") && !phrase.length();
+  printf("\nout of range and unknown words refused: %s\n", refused ? "yes" : "no");
+
+  return bad || !refused ? 1 : 0;
+}
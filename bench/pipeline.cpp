@@ -0,0 +1,87 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+
+// A spinning volume knob: a burst of volumeUp()/volumeDn() calls with a few
+// setEqualizer()/setLoopMode() among them, sent paced (each frame drained and
+// gapped before the next) and pipelined (queued, coalesced, sent from poll()).
+//
+// "caller ms" is how long the burst held up the code making the calls, and
+// "settled ms" is from the first call until the module has the last setting.
+
+#include "jq8400.hpp"
+#include <stdio.h>
+
+static const int bursts[] = { 10, 50, 200 };
+
+
+static void burst(jq8400 &mp3, int calls) {
+  for(int x = 0; x < calls; x++) {
+    if(x % 16 == 15)     mp3.setEqualizer(x % 5);
+    else if(x % 16 == 7) mp3.setLoopMode(x % 3);
+    else if(x % 3 == 2)  mp3.volumeDn();
+    else                 mp3.volumeUp();
+  }
+}
+
+
+int main() {
+  printf("%-10s %6s %10s %10s %8s %10s %12s\n", "mode", "calls", "caller ms", "settled ms", "frames", "coalesced", "calls/s");
+
+  for(int b = 0; b < (int)(sizeof(bursts) / sizeof(bursts[0])); b++) {
+    for(int pipelined = 0; pipelined < 2; pipelined++) {
+      jq8400Emulator emu;
+      emu.addFile(MP3_SRC_SDCARD, 1, "001", 120);
+      emu.setSourcePresent(MP3_SRC_SDCARD, 1);
+
+      jq8400 mp3(emu);
+      mp3.setVolume(10);
+      mp3.delay(MP3_COMMAND_GAP);
+      mp3.setPipelined(pipelined);
+
+      int       frames  = emu.framesReceived();
+      long long started = emu.now();
+      burst(mp3, bursts[b]);
+      long long queued  = emu.now();
+
+      while(mp3.poll()) { }
+      int volume = mp3.getVolume(), equalizer = mp3.getEqualizer(), loop = mp3.getLoopMode();
+      while(emu.volume() != volume || emu.equalizer() != equalizer || emu.loopMode() != loop) {
+        emu.advance(100);
+      }
+      long long settled = emu.now();
+
+      printf("%-10s %6d %10.1f %10.1f %8d %10d %12.0f\n",
+        pipelined ? "pipelined" : "paced", bursts[b],
+        (queued - started) / 1000.0, (settled - started) / 1000.0,
+        emu.framesReceived() - frames, mp3.commandsCoalesced(),
+        bursts[b] * 1e6 / (settled - started));
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,160 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+
+// The silence between tracks when a jq8400Playlist sequences them, against the
+// usual play, wait while busy(), play the next.  Then a short list shuffled on
+// repeat, which must play every entry once per round and never the same track
+// twice in a row, and must leave the loop mode as it found it.
+
+#include "jq8400_playlist.hpp"
+#include <stdio.h>
+
+static const int order[]    = { 1, 2, 3, 6, 4, 5, 8, 9, 12, 10 };
+static const int orderCount = sizeof(order) / sizeof(order[0]);
+
+
+// Watches the emulator for the module going from one track to another
+struct Gaps {
+  long long silentSince, total, worst;
+  int       lastIndex, transitions;
+
+  Gaps() : silentSince(-1), total(0), worst(0), lastIndex(-1), transitions(0) { }
+
+  void sample(jq8400Emulator &emu) {
+    int playing = emu.status() == MP3_STATUS_PLAYING;
+    if(!playing && silentSince < 0) {
+      silentSince = emu.now();
+    }
+    if(playing && emu.currentIndex() != lastIndex) {
+      if(lastIndex >= 0) {
+        long long gap = silentSince < 0 ? 0 : emu.now() - silentSince;
+        total += gap;
+        if(gap > worst) worst = gap;
+        transitions++;
+      }
+      lastIndex = emu.currentIndex();
+    }
+    if(playing) {
+      silentSince = -1;
+    }
+  }
+
+  void print(const char *name, jq8400Emulator &emu) {
+    printf("%-16s %12d %12.1f %12.1f %8d\n", name, transitions,
+      transitions ? total / 1000.0 / transitions : 0.0, worst / 1000.0, emu.framesReceived());
+  }
+};
+
+
+static void addFiles(jq8400Emulator &emu) {
+  for(int x = 1; x <= 12; x++) {
+    char name[8];
+    sprintf(name, "%03d", x);
+    emu.addFile(MP3_SRC_SDCARD, 1, name, 2 + x % 3);
+  }
+  emu.setSourcePresent(MP3_SRC_SDCARD, 1);
+}
+
+
+int main() {
+  printf("%-16s %12s %12s %12s %8s\n", "sequenced by", "transitions", "mean gap ms", "worst ms", "frames");
+  {
+    jq8400Emulator emu;
+    addFiles(emu);
+    jq8400 mp3(emu);
+    static uint16_t arena[16];
+    jq8400Playlist list(mp3, arena, 16);
+    for(int x = 0; x < orderCount; x++) list.add(order[x]);
+
+    Gaps gaps;
+    list.start();
+    while(list.running()) {
+      list.service();
+      gaps.sample(emu);
+    }
+    gaps.print("jq8400Playlist", emu);
+  }
+  {
+    jq8400Emulator emu;
+    addFiles(emu);
+    jq8400 mp3(emu);
+
+    Gaps gaps;
+    for(int x = 0; x < orderCount; x++) {
+      mp3.playFileByIndexNumber(order[x]);
+      while(mp3.busy()) gaps.sample(emu);
+      gaps.sample(emu);
+    }
+    gaps.print("busy() loop", emu);
+  }
+
+  // Shuffled on repeat, round after round
+  {
+    jq8400Emulator emu;
+    addFiles(emu);
+    jq8400 mp3(emu);
+    mp3.setLoopMode(MP3_LOOP_FOLDER);
+
+    static uint16_t arena[4];
+    jq8400Playlist list(mp3, arena, 4);
+    for(int x = 1; x <= 4; x++) list.add(x);
+    list.setRepeat(MP3_PLAYLIST_REPEAT_ALL);
+    list.setShuffle(1, 1234);
+    list.start();
+
+    int seen[64], seenCount = 0, last = -1;
+    long long started = emu.now();
+    while(seenCount < 64 && emu.now() - started < 600000000LL) {
+      list.service();
+      if(emu.status() == MP3_STATUS_PLAYING && emu.currentIndex() != last) {
+        last = emu.currentIndex();
+        seen[seenCount++] = last;
+      }
+    }
+    list.stop();
+    while(mp3.poll()) { }
+    mp3.delay(MP3_COMMAND_GAP);
+
+    int repeats = 0, badRounds = 0;
+    for(int x = 1; x < seenCount; x++) {
+      if(seen[x] == seen[x - 1]) repeats++;
+    }
+    for(int round = 0; round + 4 <= seenCount; round += 4) {
+      int mask = 0;
+      for(int x = 0; x < 4; x++) mask |= 1 << seen[round + x];
+      if(mask != 0x1E) badRounds++;
+    }
+    printf("\nshuffle, repeat all: %d tracks, %d rounds not all 4 entries, %d repeated back to back, loop mode %d after stop (was %d)\n",
+      seenCount, badRounds, repeats, emu.loopMode(), MP3_LOOP_FOLDER);
+    if(seenCount < 64 || badRounds || repeats || emu.loopMode() != MP3_LOOP_FOLDER) {
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,140 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+
+// A session with the emulator recorded on the wire (MP3_TRACE), exported, and
+// played back to the driver (JQ8400_REPLAY), once on a clean line and once
+// with 10% of the responses corrupt.  The same source is built twice:
+//
+//   replay-record   runs the session against the emulator and writes the
+//                   exportTrace() of each line to replay-*.trace
+//   replay          analyses each trace with jq8400AnalyseCapture() and
+//                   replays the session from it, at the driver's own speed
+//                   and with every clock reading costing 40 us (a slower
+//                   driver), and fails if what the driver sends differs
+//                   from the trace or it does not get to the end of it
+//
+// make run builds both and runs them in that order.
+
+#include "jq8400.hpp"
+#include "jq8400_replay.hpp"
+#include <stdio.h>
+
+static const char *traces[]     = { "replay-clean.trace", "replay-corrupt.trace" };
+static const int   corruptions[] = { 0, 100 };     // Per thousand responses
+
+static unsigned char blob[5 + 5 * 2 * MP3_TRACE_LENGTH];
+
+static void session(jq8400 &mp3) {
+  mp3.playFileByIndexNumber(2);
+  mp3.setVolume(25);
+  for(int x = 0; x < 20; x++) {
+    mp3.getStatus();
+    mp3.currentFileIndexNumber();
+    mp3.invalidateCache();
+    mp3.delay(50);
+  }
+  mp3.currentFileLengthInSeconds();
+  mp3.next();
+  mp3.getStatus();
+}
+
+
+#if !defined(JQ8400_REPLAY)
+
+#if !MP3_TRACE
+#error "replay-record is built with MP3_TRACE 1, make replay-record"
+#endif
+
+int main() {
+  for(int x = 0; x < 2; x++) {
+    jq8400Emulator emu;
+    for(int f = 1; f <= 5; f++) {
+      char name[8];
+      sprintf(name, "%03d", f);
+      emu.addFile(MP3_SRC_SDCARD, 1, name, 30);
+    }
+    emu.setSourcePresent(MP3_SRC_SDCARD, 1);
+    emu.setCorruptRate(corruptions[x]);
+    jq8400 mp3(emu);
+
+    long long started = emu.now();
+    session(mp3);
+    int length = mp3.exportTrace(blob, sizeof(blob));
+
+    FILE *file = fopen(traces[x], "wb");
+    if(!file || (int)fwrite(blob, 1, length, file) != length) {
+      printf("could not write %s\n", traces[x]);
+      return 1;
+    }
+    fclose(file);
+    printf("%-22s %3d%% corrupt, session %.1f ms, %d bytes on the wire\n",
+      traces[x], corruptions[x] / 10, (emu.now() - started) / 1000.0, (length - 5) / 5);
+  }
+  return 0;
+}
+
+#else
+
+int main() {
+  int bad = 0;
+  for(int x = 0; x < 2; x++) {
+    FILE *file = fopen(traces[x], "rb");
+    if(!file) {
+      printf("no %s, run replay-record first\n", traces[x]);
+      return 1;
+    }
+    int length = fread(blob, 1, sizeof(blob), file);
+    fclose(file);
+
+    jq8400Capture capture(blob, length);
+    if(!capture.valid()) {
+      printf("%s is not a trace\n", traces[x]);
+      return 1;
+    }
+    jq8400CaptureStats stats;
+    jq8400AnalyseCapture(capture, stats);
+    printf("%s: %d bytes sent, %d received, %d good frames, %d bad checksums, response mean %.2f ms worst %.2f ms, %.1f ms long\n",
+      traces[x], stats.bytesSent, stats.bytesReceived, stats.frames, stats.badChecksums,
+      stats.meanResponseUs / 1000.0, stats.maxResponseUs / 1000.0, stats.durationUs / 1000.0);
+
+    static const int costs[] = { 5, 40 };
+    for(int cost : costs) {
+      jq8400 mp3(capture);
+      mp3.setCostPerCall(cost);
+      long long started = mp3.elapsedUs();
+      session(mp3);
+      printf("  replayed, %2d us a clock reading: %.1f ms, %d mismatches, %s\n",
+        cost, (mp3.elapsedUs() - started) / 1000.0, mp3.mismatches(), mp3.finished() ? "to the end" : "NOT to the end");
+      if(mp3.mismatches() || !mp3.finished()) bad++;
+    }
+  }
+  return bad ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,126 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+
+
+// reset() on a module that takes a while to boot again: probing until it
+// answers, against the fixed sleeps reset() used to have (two seconds, then a
+// sources query and a second's sleep until it answered, where a query that
+// timed out with -1 counted as an answer).  How long each took, how many
+// frames the module heard, and whether the seek to index 1 reached it.  Exits 1 if reset() gave up on a module that did answer in time, or did
+// not give up on one that never did.
+
+#include "jq8400.hpp"
+#include <stdio.h>
+
+#define NEVER_MS        60000   // Boot time of a module which never comes back
+
+// sendCommand() is for the driver and its helpers, a subclass may call it
+struct jq8400Sleeper : public jq8400
+{
+  jq8400Sleeper(jq8400Emulator &emulator) : jq8400(emulator) { }
+
+  // reset() as it was
+  int sleepingReset() {
+    int started = this->millis();
+    int retry   = 5;
+    this->invalidateCache();
+    do {
+      this->sendCommand<MP3_CMD_STOP>();  this->delay(1000);
+      this->sendCommand<MP3_CMD_RESET>(); this->delay(1000);
+
+      this->setVolume(20);
+      this->setEqualizer(0);
+      this->setLoopMode(2);
+      this->seekFileByIndexNumber(1);
+      this->sendCommand<MP3_CMD_STOP>();
+
+      int timeout = 9;
+      while(timeout-- > 0) {
+        if(this->getAvailableSources()) {
+          retry = 0;
+          break;
+        }
+        this->delay(1000);
+      }
+    } while(retry-- > 0);
+    return this->millis() - started;
+  }
+};
+
+
+struct Outcome {
+  int ms;
+  int frames;
+  int seeked;
+};
+
+
+static Outcome measure(int bootMs, int probing) {
+  jq8400Emulator emu;
+  emu.addFile(MP3_SRC_SDCARD, 1, "001", 60);
+  emu.addFile(MP3_SRC_SDCARD, 1, "002", 60);
+  emu.setSourcePresent(MP3_SRC_SDCARD, 1);
+  jq8400Sleeper mp3(emu);
+  mp3.setSource(MP3_SRC_SDCARD);
+  mp3.playFileByIndexNumber(2);
+
+  emu.powerOn(bootMs);
+  int frames  = emu.framesReceived();
+  int started = mp3.millis();
+  Outcome outcome;
+  if(probing) {
+    outcome.ms = mp3.reset() < 0 ? -1 : mp3.millis() - started;
+  } else {
+    outcome.ms = mp3.sleepingReset();
+  }
+  mp3.delay(100); // For the last command to get there
+  outcome.frames = emu.framesReceived() - frames;
+  outcome.seeked = emu.currentIndex() == 1;
+  return outcome;
+}
+
+
+int main() {
+  static const int boots[] = { 0, 300, 1500, 2500, 8000, NEVER_MS };
+  int bad = 0;
+
+  printf("%-10s %26s   %26s\n", "", "fixed sleeps", "probing");
+  printf("%-10s %8s %8s %8s   %8s %8s %8s\n", "boot ms", "ms", "frames", "seeked", "ms", "frames", "seeked");
+  for(unsigned x = 0; x < sizeof(boots) / sizeof(boots[0]); x++) {
+    Outcome before = measure(boots[x], 0);
+    Outcome after  = measure(boots[x], 1);
+    if(boots[x] == NEVER_MS) printf("%-10s", "never"); else printf("%-10d", boots[x]);
+    printf(" %8d %8d %8s   %8d %8d %8s\n", before.ms, before.frames, before.seeked ? "yes" : "no",
+      after.ms, after.frames, after.seeked ? "yes" : "no");
+
+    int answers = boots[x] < MP3_READY_TIMEOUT;
+    if((after.ms >= 0) != answers || (answers && !after.seeked)) bad++;
+  }
+  return bad ? 1 : 0;
+}
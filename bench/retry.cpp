@@ -0,0 +1,87 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+
+
+// 1000 getStatus() reads of a module playing, on a line corrupting responses,
+// dropping bytes, and both, with the default jq8400RetryPolicy: how many
+// answers were wrong (the driver said a status the module was not in), how
+// many reads failed and why, and how long they took.  Exits 1 on a wrong
+// answer, a failure is allowed as the caller is told.
+
+#include "jq8400.hpp"
+#include <stdio.h>
+
+#define READS           1000
+
+static int line(const char *name, int corrupt, int dropped) {
+  jq8400Emulator emu;
+  emu.addFile(MP3_SRC_SDCARD, 1, "001", 600);
+  emu.setSourcePresent(MP3_SRC_SDCARD, 1);
+  jq8400 mp3(emu);
+  mp3.playFileByIndexNumber(1);
+  mp3.delay(100);
+  emu.setCorruptRate(corrupt);
+  emu.setDropRate(dropped);
+
+  int       wrong = 0, timeouts = 0, corrupted = 0, others = 0;
+  long long total = 0, worst = 0;
+  for(int x = 0; x < READS; x++) {
+    mp3.invalidateCache();
+    long long started = emu.now();
+    int status = mp3.getStatus();
+    long long took = emu.now() - started;
+    total += took;
+    if(took > worst) worst = took;
+
+    if(status >= 0) {
+      if(status != emu.status()) wrong++;
+    } else if(mp3.lastResult() == MP3_FRAME_TIMEOUT) {
+      timeouts++;
+    } else if(mp3.lastResult() == MP3_FRAME_BAD_CHECKSUM) {
+      corrupted++;
+    } else {
+      others++;
+    }
+  }
+
+  printf("%-28s %6d %8d %8d %6d %8.1f %8.1f\n", name, wrong, timeouts, corrupted, others, total / 1000.0 / READS, worst / 1000.0);
+  return wrong;
+}
+
+
+int main() {
+  printf("%d getStatus() reads\n\n", READS);
+  printf("%-28s %6s %26s %17s\n", "", "", "failed, as", "ms");
+  printf("%-28s %6s %8s %8s %6s %8s %8s\n", "line", "wrong", "timeout", "checksum", "other", "mean", "worst");
+  int bad = line("clean", 0, 0);
+  bad += line("10% corrupt responses", 100, 0);
+  bad += line("1% dropped bytes", 0, 10);
+  bad += line("both", 100, 10);
+  return bad ? 1 : 0;
+}
@@ -0,0 +1,101 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+
+// Round trip of a query, from starting to send it to having its answer, as the
+// driver does it now (done at the checksum byte) and as it used to (done once
+// the line had been quiet for MP3_BYTE_TIMEOUT).
+
+#include "jq8400.hpp"
+#include <stdio.h>
+
+static const int queries[] = {
+  jq8400::MP3_CMD_STATUS, jq8400::MP3_CMD_GET_SOURCE, jq8400::MP3_CMD_COUNT_FILES, jq8400::MP3_CMD_CURRENT_FILE_IDX
+};
+static const char *names[] = { "getStatus()", "getSource()", "countFiles()", "currentFileIndexNumber()" };
+static const int rounds = 50;
+
+
+// The old way, straight onto the emulated line: send the frame, then read
+// until nothing has come for MP3_BYTE_TIMEOUT
+static long long quietRoundTrip(jq8400Emulator &emu, int command) {
+  uint8_t frame[4] = { 0xAA, (uint8_t)command, 0, (uint8_t)(0xAA + command) };
+  long long started = emu.now();
+
+  for(int x = 0; x < 4; x++) {
+    while(!emu.hostWriteable()) emu.advance(10);
+    emu.hostWrite(frame[x]);
+  }
+
+  long long lastByte = -1;
+  while(lastByte < 0 ? emu.now() - started < MP3_RESPONSE_TIMEOUT * 1000LL : emu.now() - lastByte < MP3_BYTE_TIMEOUT * 1000LL) {
+    emu.advance(100);
+    while(emu.hostReadable()) {
+      emu.hostRead();
+      lastByte = emu.now();
+    }
+  }
+  return emu.now() - started;
+}
+
+
+int main() {
+  jq8400Emulator emu;
+  for(int x = 1; x <= 10; x++) {
+    char name[8];
+    sprintf(name, "%03d", x);
+    emu.addFile(MP3_SRC_SDCARD, 1, name, 120);
+  }
+  emu.setSourcePresent(MP3_SRC_SDCARD, 1);
+
+  jq8400 mp3(emu);
+  mp3.setSource(MP3_SRC_SDCARD);
+  mp3.playFileByIndexNumber(3);
+
+  printf("%-26s %12s %12s\n", "query (9600 baud)", "before ms", "after ms");
+  for(int q = 0; q < 4; q++) {
+    long long before = 0, after = 0;
+    for(int r = 0; r < rounds; r++) {
+      mp3.delay(MP3_COMMAND_GAP);
+      before += quietRoundTrip(emu, queries[q]);
+
+      mp3.delay(MP3_COMMAND_GAP);
+      mp3.invalidateCache(); // So that it really asks
+      long long started = emu.now();
+      switch(q) {
+        case 0: mp3.getStatus(); break;
+        case 1: mp3.getSource(); break;
+        case 2: mp3.countFiles(); break;
+        case 3: mp3.currentFileIndexNumber(); break;
+      }
+      after += emu.now() - started;
+    }
+    printf("%-26s %12.1f %12.1f\n", names[q], before / 1000.0 / rounds, after / 1000.0 / rounds);
+  }
+  return 0;
+}
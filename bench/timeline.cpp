@@ -0,0 +1,189 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+
+
+// A twenty minute show on a jq8400Timeline: a list of cues streamed in as room
+// is made for them, with volume cues added on the way and every other one
+// cancelled before it is due, while the application asks getStatus() every
+// 0.5 to 1.5 s, paced and pipelined.  How late the cues went to the jq8400 by
+// the lateness buckets, then the cost of at() and cancel() with the wheel
+// empty and nearly full.  Exits 1 if a cancelled cue fires, one is lost, or a
+// list with a delay past 28 bits is taken.
+
+#include "jq8400_cue.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+#define SHOW_MS         1200000
+#define CHUNK           16      // Bytes of the list given to stream() at once
+#define KEEP_ROOM       16      // Left free in the wheel for the cues added on the way
+
+static unsigned char script[4096];
+
+
+// The list, about one cue every 4 s, with groups due at the same moment
+static int writeScript(int *cues) {
+  int length = 0;
+  int n      = 0;
+  script[length++] = MP3_CUE_VERSION;
+  srand(3);
+  for(int t = 0; t < SHOW_MS; ) {
+    int gap = 1000 + rand() % 6000;
+    t += gap;
+    unsigned char *out  = &script[length];
+    int            room = sizeof(script) - length;
+    int            used;
+    switch(rand() % 5) {
+      case 0:  used = jq8400Timeline::encode(out, room, gap, MP3_CUE_PLAY, 1 + rand() % 20); n++; break;
+      case 1:  used = jq8400Timeline::encode(out, room, gap, MP3_CUE_FADE, rand() % 30, 1500, MP3_FADE_LINEAR); n++; break;
+      case 2:  used = jq8400Timeline::encode(out, room, gap, MP3_CUE_EQUALIZER, rand() % 5); n++; break;
+      case 3:
+        used  = jq8400Timeline::encode(out, room, gap, MP3_CUE_PLAY, 2);
+        used += jq8400Timeline::encode(out + used, room - used, 0, MP3_CUE_AB_LOOP, 5, 9);
+        n += 2;
+        break;
+      default:
+        used  = jq8400Timeline::encode(out, room, gap, MP3_CUE_VOLUME, 25);
+        used += jq8400Timeline::encode(out + used, room - used, 0, MP3_CUE_LOOP_MODE, rand() % 3);
+        used += jq8400Timeline::encode(out + used, room - used, 0, MP3_CUE_PLAY, 3);
+        n += 3;
+        break;
+    }
+    length += used;
+  }
+  *cues = n;
+  return length;
+}
+
+
+// Returns 1 if the cues that fired are not those streamed and kept
+static int show(int pipelined, int length, int streamed) {
+  jq8400Emulator emu;
+  char name[8];
+  for(int x = 1; x <= 20; x++) { sprintf(name, "T%02d", x); emu.addFile(MP3_SRC_SDCARD, 1, name, 60); }
+  emu.setSourcePresent(MP3_SRC_SDCARD, 1);
+  jq8400 mp3(emu);
+  mp3.setSource(MP3_SRC_SDCARD);
+  mp3.setVolume(20);
+  mp3.setPipelined(pipelined);
+
+  jq8400Timeline timeline(mp3);
+  timeline.openStream(mp3.millis());
+
+  int fed     = 0;
+  int added   = 0;
+  int kept    = 0;
+  int held    = 0;      // Handle of the cue added last, cancelled with the next
+  int addAt   = mp3.millis();
+  int queryAt = mp3.millis();
+  srand(11);
+  while(fed < length || timeline.waiting()) {
+    while(fed < length && timeline.room() > KEEP_ROOM) {
+      int used = timeline.stream(&script[fed], length - fed < CHUNK ? length - fed : CHUNK);
+      if(used < 0) {
+        printf("list refused at byte %d\n", fed);
+        return 1;
+      }
+      if(!used) break;
+      fed += used;
+    }
+
+    // A volume cue now and then, the one before it cancelled if still waiting
+    if(fed < length && mp3.millis() - addAt >= 0) {
+      addAt = mp3.millis() + 2000 + rand() % 2000;
+      if(held && timeline.cancel(held)) kept--;
+      held = timeline.after(500 + rand() % 5000, MP3_CUE_VOLUME, 10 + rand() % 20);
+      if(held) { added++; kept++; }
+    }
+
+    // And the application asking the module things, which holds the timeline up
+    if(mp3.millis() - queryAt >= 0) {
+      queryAt = mp3.millis() + 500 + rand() % 1000;
+      mp3.getStatus();
+    }
+
+    timeline.service();
+    mp3.delay(1);
+  }
+
+  printf("%-10s %6d %6d %6d %8d %8.2f %6d ", pipelined ? "pipelined" : "paced",
+    timeline.dispatched(), added, added - kept, timeline.bursts(), timeline.latenessMeanUs() / 1000.0, timeline.latenessMaxMs());
+  for(int b = 0; b < MP3_CUE_LATE_BUCKETS; b++) printf(" %5d", timeline.lateness(b));
+  printf("\n");
+  return timeline.dispatched() != streamed + kept;
+}
+
+
+// The cost of adding a cue and cancelling it again, with that many waiting
+static void costs(int fill) {
+  jq8400Emulator emu;
+  jq8400 mp3(emu);
+  jq8400Timeline timeline(mp3);
+  srand(5);
+  for(int x = 0; x < fill; x++) timeline.after(rand() % 3600000, MP3_CUE_PLAY, 1);
+
+  const int rounds = 1000000;
+  std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+  for(int r = 0; r < rounds; r++) {
+    timeline.cancel(timeline.after(rand() % 3600000, MP3_CUE_VOLUME, 10));
+  }
+  long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count();
+  printf("%-10d %14.1f\n", fill, (double)ns / rounds);
+}
+
+
+int main() {
+  int cues;
+  int length = writeScript(&cues);
+  printf("%d minute show, %d cues in a %d byte list, a volume cue added every 2 to 4 s, getStatus() every 0.5 to 1.5 s\n\n", SHOW_MS / 60000, cues, length);
+  printf("%-10s %6s %6s %6s %8s %8s %6s  lateness, up to ms\n", "", "fired", "added", "cancel", "requests", "mean ms", "max ms");
+  printf("%-10s %6s %6s %6s %8s %8s %6s ", "", "", "", "", "", "", "");
+  for(int b = 0; b < MP3_CUE_LATE_BUCKETS; b++) {
+    if(jq8400Timeline::bucketLimitMs(b) < 0) printf(" %5s", "over"); else printf(" %5d", jq8400Timeline::bucketLimitMs(b));
+  }
+  printf("\n");
+  int bad = show(0, length, cues);
+  bad += show(1, length, cues);
+
+  printf("\n%-10s %14s\n", "waiting", "at+cancel ns");
+  costs(0);
+  costs(MP3_CUE_CAPACITY - 8);
+
+  // A delay with the top bit still set after 28 bits is not a cue list
+  jq8400Emulator emu;
+  jq8400 mp3(emu);
+  jq8400Timeline timeline(mp3);
+  static const unsigned char tooLong[] = { MP3_CUE_VERSION, 0xFF, 0xFF, 0xFF, 0xFF, 0x01, MP3_CUE_STOP };
+  timeline.openStream(mp3.millis());
+  int used = timeline.stream(tooLong, sizeof(tooLong));
+  printf("\n29 bit delay: stream() gives %d, %d cues waiting\n", used, timeline.waiting());
+  bad += used != -1 || timeline.waiting();
+  return bad ? 1 : 0;
+}
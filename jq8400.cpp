@@ -26,92 +26,162 @@
  * @file
  */
 
-#include "mbed.h"
 #include "jq8400.hpp"
 
+void jq8400::begin() {
+  rxHead        = 0;
+  rxTail        = 0;
+  rxDropped     = 0;
+  txHead        = 0;
+  txTail        = 0;
+  active        = 0;
+  nextHandle    = 1;
+  totalCpuUs    = 0;
+  totalCommands = 0;
+  totalCoalesced = 0;
+  pipelineMode  = 0;
+  responseTimeout = MP3_RESPONSE_TIMEOUT;
+  lastReadyMs   = -1;
+  retryPolicy.attempts     = MP3_RETRY_ATTEMPTS;
+  retryPolicy.deadlineMs   = MP3_RETRY_DEADLINE;
+  retryPolicy.backoffMs    = MP3_RETRY_BACKOFF;
+  retryPolicy.backoffMaxMs = MP3_RETRY_BACKOFF_MAX;
+  jitterState   = 1;
+  memset(queue, 0, sizeof(queue));
+  
+  lastActivity    = 0;
+  lastCompleted   = -MP3_COMMAND_GAP;
+  responseStarted = 0;
+  pollStarted     = 0;
+  lastReceived    = 0;
+  decoder.reset(-1, frameData, MP3_MAX_RESPONSE_LENGTH);
+  metadata.clear();
+  metadata.flushes = 0;
+  MP3_METRIC(this->resetMetrics();)
+  MP3_TRACED(this->resetTrace();)
+  
+  this->attachRx(&jq8400::rxHandler, this);
+}
+
 void  jq8400::play() {
-  this->sendCommand(MP3_CMD_PLAY);
+  this->invalidatePlayback(MP3_STATUS_PLAYING);
+  this->sendCommand<MP3_CMD_PLAY>();
 }
 
 
 void  jq8400::restart() {
-  this->sendCommand(MP3_CMD_STOP); // Make sure really will restart
-  this->sendCommand(MP3_CMD_PLAY);
+  this->invalidatePlayback(MP3_STATUS_PLAYING);
+  this->sendCommand<MP3_CMD_STOP>(); // Make sure really will restart
+  this->sendCommand<MP3_CMD_PLAY>();
 }
 
 
 void  jq8400::pause() {
-  this->sendCommand(MP3_CMD_PAUSE);
+  this->invalidatePlayback(MP3_STATUS_PAUSED);
+  this->sendCommand<MP3_CMD_PAUSE>();
 }
 
 
 void  jq8400::stop() {
-  this->sendCommand(MP3_CMD_STOP);
+  this->invalidatePlayback(MP3_STATUS_STOPPED);
+  this->sendCommand<MP3_CMD_STOP>();
 }
 
 
 void  jq8400::next() {
-  this->sendCommand(MP3_CMD_NEXT);
+  this->invalidatePlayback();
+  this->sendCommand<MP3_CMD_NEXT>();
 }
 
 
 void  jq8400::prev() {
-  this->sendCommand(MP3_CMD_PREV);
+  this->invalidatePlayback();
+  this->sendCommand<MP3_CMD_PREV>();
 }
 
 
 void  jq8400::playFileByIndexNumber(int fileNumber) {  
   // this->sendCommand(MP3_CMD_PLAY_IDX, (fileNumber>>8) & 0xFF, fileNumber & (int)0xFF);
-  this->sendCommand(MP3_CMD_PLAY_IDX, fileNumber);
+  this->sendCommandWord(MP3_CMD_PLAY_IDX, fileNumber);
+  this->selectIndex(fileNumber, MP3_STATUS_PLAYING);
 }
 
 
 void  jq8400::interjectFileByIndexNumber(int fileNumber) {  
-  int buf[3] = { getSource(), (int)((fileNumber>>8)&0xFF), (int)(fileNumber & (int)0xFF) };
+  int source = this->getSource();
+  if(source < 0) {
+    return; // Not answering, and an insert on source 0xFF plays nothing, lastResult() says why
+  }
+  
+  uint8_t buf[3] = { (uint8_t)source, (uint8_t)(fileNumber>>8), (uint8_t)fileNumber };
+  this->invalidatePlayback();
   this->sendCommandData(MP3_CMD_INSERT_IDX, buf, 3, 0, 0);
 }
 
 
 void  jq8400::seekFileByIndexNumber(int fileNumber) {  
   // this->sendCommand(MP3_CMD_SEEK_IDX, (fileNumber>>8) & 0xFF, fileNumber & (int)0xFF);
-  this->sendCommand(MP3_CMD_SEEK_IDX, fileNumber);
+  this->sendCommandWord(MP3_CMD_SEEK_IDX, fileNumber);
+  this->selectIndex(fileNumber, MP3_STATUS_STOPPED);
 }
 
 
 void jq8400::abLoopPlay(int secondsStart, int secondsEnd) {
-  int buf[4] = { (int)(secondsStart / 60), (int)(secondsStart % 60), (int)(secondsEnd / 60), (int)(secondsEnd % 60) };
-  this->sendCommandData(MP3_CMD_AB_PLAY, buf, sizeof(buf), 0, 0);
+  uint8_t buf[4] = { (uint8_t)(secondsStart / 60), (uint8_t)(secondsStart % 60), (uint8_t)(secondsEnd / 60), (uint8_t)(secondsEnd % 60) };
+  this->sendCommandData(MP3_CMD_AB_PLAY, buf, 4, 0, 0);
 }
 
 
 void jq8400::abLoopClear() {
-  this->sendCommand(MP3_CMD_AB_PLAY_STOP);
+  this->sendCommand<MP3_CMD_AB_PLAY_STOP>();
 }
 
 
 void jq8400::fastForward(int seconds) {
   //this->sendCommand(MP3_CMD_FFWD, (seconds>>8)&0xFF, seconds&0xFF);
-  this->sendCommand(MP3_CMD_FFWD, seconds);
+  this->sendCommandWord(MP3_CMD_FFWD, seconds);
 }
 
 
 void jq8400::rewind(int seconds) {
   //this->sendCommand(MP3_CMD_RWND, (seconds>>8)&0xFF, seconds&0xFF);
-  this->sendCommand(MP3_CMD_RWND, seconds);
+  this->sendCommandWord(MP3_CMD_RWND, seconds);
 }
 
 
 void  jq8400::nextFolder() {
-  this->sendCommand(MP3_CMD_NEXT_FOLDER);
+  this->invalidatePlayback();
+  this->sendCommand<MP3_CMD_NEXT_FOLDER>();
 }
 
 
 void  jq8400::prevFolder() {
-  this->sendCommand(MP3_CMD_PREV_FOLDER);
+  this->invalidatePlayback();
+  this->sendCommand<MP3_CMD_PREV_FOLDER>();
+}
+
+
+// Zero padded decimal, without the null itoa() would write over the next character
+static void writeDigits(char *buf, int value, int digits) {
+  while(digits-- > 0) {
+    buf[digits] = '0' + (value % 10);
+    value /= 10;
+  }
 }
 
 
 void  jq8400::playFileNumberInFolderNumber(int folderNumber, int fileNumber) {
+  // With a catalog of the source this is just a play by index, no filesystem search
+  int source = this->getSource();
+  if(source < 0) {
+    return; // lastResult() says why
+  }
+  if(catalogSource == source && folderNumber >= 0 && folderNumber < MP3_CATALOG_MAX_FOLDERS 
+      && catalogFirst[folderNumber] && fileNumber >= 1 && fileNumber <= catalogCount[folderNumber]) {
+    this->playFileByIndexNumber(catalogFirst[folderNumber] + fileNumber - 1);
+    return;
+  }
+  
   // This is kinda weird, the wildcard is *REQUIRED*, without it, it WILL NOT find the file you want.
   //
   // Really Weird.  Anyway this is the format for the data
@@ -121,97 +191,200 @@ void  jq8400::playFileNumberInFolderNumber(int folderNumber, int fileNumber) {
   //  3 question mark character wildcards, you can't even match on ".mp3", damn this is weird
   
   char buf[] = " /42*/032*???";
-  buf[0] = this->getSource();
+  buf[0] = source;
   
-  int i = 2; // 1st digit folder component
-  if(folderNumber<10) {
-    buf[i] = '0';
-    i++;
+  writeDigits(&buf[2], folderNumber, 2); // 1st digit folder component
+  writeDigits(&buf[6], fileNumber,   3); // 1st digit filename component
+  
+  this->sendPath(buf, sizeof(buf)-1);
+}
+
+
+void  jq8400::playInFolderNumber(int folderNumber) {
+  int source = this->getSource();
+  if(source < 0) {
+    return; // lastResult() says why
+  }
+  if(catalogSource == source && folderNumber >= 0 && folderNumber < MP3_CATALOG_MAX_FOLDERS && catalogFirst[folderNumber]) {
+    this->playFileByIndexNumber(catalogFirst[folderNumber]);
+    return;
   }
-  itoa(folderNumber,&buf[i], 10);
   
-  i = 4;
-  buf[i] = '*'; // itoa clobbered this with it's null
+  this->playFolderPath(source, folderNumber);
+}
+
+
+void  jq8400::playFolderPath(int source, int folderNumber) {
+  char buf[] = " /42*/*???";
   
-  i = 6; // 1st digit filename component
-  if(fileNumber < 100)
-  {
-    buf[i] = '0';
-    i++;
+  buf[0] = source;
+  
+  writeDigits(&buf[2], folderNumber, 2); // 1st digit folder component
+  
+  this->sendPath(buf, sizeof(buf)-1);
+}
+
+
+void  jq8400::sendPath(const char *path, int length) {
+  this->invalidatePlayback();
+  this->sendCommandData(MP3_CMD_PLAY_FILE_FOLDER, (const uint8_t *)path, length, 0, 0);
+}
+
+
+// Finds the first index and number of files of each numbered folder on the 
+// current source, by playing each folder (muted) and asking the module.  This
+// stops playback, and takes a few hundred ms per folder so persist the result 
+// with exportCatalog() and importCatalog() it on the next boot.
+//
+// Assumes, as the path search does, that the files in a folder are 001, 002...
+// in the order they were copied to the medium.
+//
+// Returns the number of folders found.
+int  jq8400::buildCatalog() {
+  int source = this->getSource();
+  int total  = this->countFiles();
+  int volume = currentVolume;
+  this->getAvailableSources(); // So that a media change after this is noticed
+  int found  = 0;
+  int seen   = 0;
+  
+  catalogSource = -1;
+  memset(catalogFirst, 0, sizeof(catalogFirst));
+  memset(catalogCount, 0, sizeof(catalogCount));
+  
+  this->setVolume(0);
+  for(int folder = 0; folder < MP3_CATALOG_MAX_FOLDERS && seen < total; folder++) {
+    this->stop();
+    this->playFolderPath(source, folder);
+    
+    // The module ignores a path that matches nothing, so nothing will be playing
+    if(this->getStatus() != MP3_STATUS_PLAYING) {
+      continue;
+    }
+    
+    int first = this->sendCommandWithUnsignedIntResponse<MP3_CMD_FIRST_FILE_IN_FOLDER_IDX>();
+    int count = this->sendCommandWithUnsignedIntResponse<MP3_CMD_COUNT_IN_FOLDER>();
+    if(first > 0 && count > 0) {
+      catalogFirst[folder] = first;
+      catalogCount[folder] = count;
+      seen += count;
+      found++;
+    }
   }
+  this->stop();
+  this->setVolume(volume);
   
-  if(fileNumber < 10) {
-      buf[i] = '0';
-      i++;
+  catalogSource    = source;
+  catalogFileCount = total;
+  return found;
+}
+
+
+// The catalog as a compact blob
+//   [VERSION] [SOURCE] [FILES_HI] [FILES_LO] [FOLDERS] then for each folder
+//   [FOLDER] [FIRST_HI] [FIRST_LO] [COUNT_HI] [COUNT_LO]
+// Returns the number of bytes written, 0 if there is no catalog or it will not fit
+int  jq8400::exportCatalog(unsigned char *blob, int blobLength) {
+  if(catalogSource < 0) {
+    return 0;
   }
-  itoa(fileNumber, &buf[i], 10);
   
-  buf[9] = '*'; // itoa clobbered this with it's null
+  int folders = 0;
+  for(int folder = 0; folder < MP3_CATALOG_MAX_FOLDERS; folder++) {
+    if(catalogFirst[folder]) folders++;
+  }
+  if(blobLength < 5 + folders * 5) {
+    return 0;
+  }
   
-  this->sendCommandData(MP3_CMD_PLAY_FILE_FOLDER, (int*)buf, sizeof(buf)-1, 0, 0);
+  int i = 0;
+  blob[i++] = MP3_CATALOG_VERSION;
+  blob[i++] = catalogSource;
+  blob[i++] = (catalogFileCount >> 8) & 0xFF;
+  blob[i++] = catalogFileCount & 0xFF;
+  blob[i++] = folders;
+  for(int folder = 0; folder < MP3_CATALOG_MAX_FOLDERS; folder++) {
+    if(!catalogFirst[folder]) continue;
+    blob[i++] = folder;
+    blob[i++] = (catalogFirst[folder] >> 8) & 0xFF;
+    blob[i++] = catalogFirst[folder] & 0xFF;
+    blob[i++] = (catalogCount[folder] >> 8) & 0xFF;
+    blob[i++] = catalogCount[folder] & 0xFF;
+  }
+  return i;
 }
 
 
-void  jq8400::playInFolderNumber(int folderNumber) {
-  char buf[] = " /42*/*???";
-  
-  buf[0] = this->getSource();
+// Loads a blob from exportCatalog(), it is only accepted if it is for the current
+// source and that source still has the same number of files.  Returns 1 if accepted.
+int  jq8400::importCatalog(const unsigned char *blob, int blobLength) {
+  if(blobLength < 5 || blob[0] != MP3_CATALOG_VERSION || blobLength < 5 + blob[4] * 5) {
+    return 0;
+  }
   
-  int i = 2; // 1st digit folder component
-  if(folderNumber<10)
-  {
-    buf[i] = '0';
-    i++;
+  int files = (blob[2] << 8) | blob[3];
+  this->getAvailableSources(); // So that a media change after this is noticed
+  if(blob[1] != this->getSource() || files != this->countFiles()) {
+    return 0;
   }
-  itoa(folderNumber,&buf[i], 10);
   
-  i = 4;
-  buf[i] = '*'; // itoa clobbered this with it's null
+  memset(catalogFirst, 0, sizeof(catalogFirst));
+  memset(catalogCount, 0, sizeof(catalogCount));
+  for(int x = 0; x < blob[4]; x++) {
+    const unsigned char *entry = &blob[5 + x * 5];
+    if(entry[0] >= MP3_CATALOG_MAX_FOLDERS) continue;
+    catalogFirst[entry[0]] = (entry[1] << 8) | entry[2];
+    catalogCount[entry[0]] = (entry[3] << 8) | entry[4];
+  }
   
-  this->sendCommandData(MP3_CMD_PLAY_FILE_FOLDER, (int*)buf, sizeof(buf)-1, 0, 0);
+  catalogSource    = blob[1];
+  catalogFileCount = files;
+  return 1;
 }
 
 
+// Two digit file names, so 00 to 99, as many entries as fit in one frame are
+// sent.  The list stops at the first entry which can not be written in two 
+// digits, rather than play the wrong file, use a jq8400Playlist for more.
 void jq8400::playSequenceByFileNumber(int playList[], int listLength) {
-  char buf[listLength*2+1]; // itoa will need an extra null
+  char buf[MP3_MAX_REQUEST_LENGTH];
   
   int i = 0;
-  for(int x = 0; x < listLength; x++)
+  for(int x = 0; x < listLength && i + 2 <= MP3_MAX_REQUEST_LENGTH && playList[x] >= 0 && playList[x] <= 99; x++)
   {
-    if(playList[x]<10)
-    {
-      buf[i++] = '0';
-    }
-    itoa(playList[x], &buf[i++], 10);
+    writeDigits(&buf[i], playList[x], 2);
+    i += 2;
   }
   
-  this->sendCommandData(MP3_CMD_PLAYLIST, (int *)buf, sizeof(buf)-1, 0, 0);
+  this->invalidatePlayback();
+  this->sendCommandData(MP3_CMD_PLAYLIST, (const uint8_t *)buf, i, 0, 0);
 }
 
 
 void jq8400::playSequenceByFileName(const char * playList[], int listLength) {
-  char buf[listLength*2];
+  char buf[MP3_MAX_REQUEST_LENGTH];
   
   int i = 0;
-  for(int x = 0; x < listLength; x++)
+  for(int x = 0; x < listLength && i + 2 <= MP3_MAX_REQUEST_LENGTH; x++)
   {
     buf[i++] = playList[x][0];
     buf[i++] = playList[x][1];
   }
   
-  this->sendCommandData(MP3_CMD_PLAYLIST, (int *)buf, sizeof(buf), 0, 0);
+  this->invalidatePlayback();
+  this->sendCommandData(MP3_CMD_PLAYLIST, (const uint8_t *)buf, i, 0, 0);
 }
 
 
 void  jq8400::volumeUp() {
   if(currentVolume < 30) currentVolume++;
-  this->sendCommand(MP3_CMD_VOL_UP); // We still send the command just in case we got out of sync somehow
+  this->sendCommand<MP3_CMD_VOL_UP>(); // We still send the command just in case we got out of sync somehow
 }
 
 
 void  jq8400::volumeDn() {
   if(currentVolume > 0 ) currentVolume--;
-  this->sendCommand(MP3_CMD_VOL_DN); // We still send the command just in case we got out of sync somehow
+  this->sendCommand<MP3_CMD_VOL_DN>(); // We still send the command just in case we got out of sync somehow
 }
 
 
@@ -233,75 +406,237 @@ void  jq8400::setLoopMode(int loopMode) {
 
 
 int jq8400::getAvailableSources()  {
-  return this->sendCommandWithintResponse(MP3_CMD_GET_SOURCES);
+  if(availableSources >= 0 && this->fresh(sourcesReadAt, MP3_SOURCES_CACHE_MS)) {
+    cacheHits++;
+    return availableSources;
+  }
+  
+  cacheMisses++;
+  int sources = this->sendCommandWithintResponse<MP3_CMD_GET_SOURCES>();
+  if(lastFrameResult != MP3_FRAME_OK) {
+    return sources;
+  }
+  
+  this->sourcesRead(sources);
+  return sources;
+}
+
+
+// A reading of the sources bitmask, asked for here or by a watcher
+void jq8400::sourcesRead(int sources) {
+  // Media changed, whatever we knew about the files is suspect
+  if(availableSources >= 0 && sources != availableSources) {
+    this->invalidateCache();
+    catalogSource = -1;
+    metadata.clear();
+    crawlNext  = 1;
+    crawlTries = 0;
+  }
+  availableSources = sources;
+  sourcesReadAt    = this->millis();
 }
 
 
 void  jq8400::setSource(int source) {
   this->sendCommand(MP3_CMD_SOURCE_SET, source);
+  this->invalidatePlayback();
+  currentSource = source;
+  fileCount     = -1;
 }
 
 
 int jq8400::getSource()  {
-  return this->sendCommandWithintResponse(MP3_CMD_GET_SOURCE);
+  if(currentSource >= 0) {
+    cacheHits++;
+    return currentSource;
+  }
+  
+  cacheMisses++;
+  int source = this->sendCommandWithintResponse<MP3_CMD_GET_SOURCE>();
+  if(lastFrameResult == MP3_FRAME_OK) {
+    currentSource = source;
+  }
+  return source;
+}
+
+
+// Forget everything we know about the module except volume, equalizer and loop
+// mode which it can not tell us anyway
+void  jq8400::invalidateCache() {
+  this->invalidatePlayback();
+  currentSource    = -1;
+  availableSources = -1;
+  fileCount        = -1;
+}
+
+
+// A play or seek by index, which we know the index of without asking
+void  jq8400::selectIndex(int index, int expected) {
+  this->invalidatePlayback(expected);
+  currentIndex = index;
+  indexReadAt  = this->millis();
+}
+
+
+// What the methods above would have remembered of a command sent some other
+// way (jq8400Frontend, jq8400Async), before it is queued
+void  jq8400::remember(int command, const uint8_t *data, int length, int responseLength) {
+  switch(command) {
+    case MP3_CMD_VOL_SET:
+      if(length) currentVolume = data[0];
+      break;
+
+    case MP3_CMD_VOL_UP:
+      if(currentVolume < 30) currentVolume++;
+      break;
+
+    case MP3_CMD_VOL_DN:
+      if(currentVolume > 0) currentVolume--;
+      break;
+
+    case MP3_CMD_EQ_SET:
+      if(length) currentEq = data[0];
+      break;
+
+    case MP3_CMD_LOOP_SET:
+      if(length) currentLoop = data[0];
+      break;
+
+    case MP3_CMD_SOURCE_SET:
+      this->invalidatePlayback();
+      currentSource = length ? data[0] : -1;
+      fileCount     = -1;
+      break;
+
+    case MP3_CMD_PLAY_IDX:
+    case MP3_CMD_SEEK_IDX:
+      this->selectIndex(length >= 2 ? (data[0] << 8) | data[1] : -1, command == MP3_CMD_PLAY_IDX ? MP3_STATUS_PLAYING : MP3_STATUS_STOPPED);
+      break;
+
+    case MP3_CMD_PLAY:
+      this->invalidatePlayback(MP3_STATUS_PLAYING);
+      break;
+
+    case MP3_CMD_PAUSE:
+      this->invalidatePlayback(MP3_STATUS_PAUSED);
+      break;
+
+    case MP3_CMD_STOP:
+      this->invalidatePlayback(MP3_STATUS_STOPPED);
+      break;
+
+    case MP3_CMD_FFWD:
+    case MP3_CMD_RWND:
+      break; // Same track, same status, as fastForward() and rewind()
+
+    default:
+      if(!responseLength) {
+        this->invalidatePlayback();
+      }
+  }
 }
 
 
 void  jq8400::sleep() {
-  this->sendCommand(MP3_CMD_SLEEP);
-  this->sendCommand(MP3_CMD_STOP);
+  this->invalidatePlayback(MP3_STATUS_STOPPED);
+  this->sendCommand<MP3_CMD_SLEEP>();
+  this->sendCommand<MP3_CMD_STOP>();
 }
 
 
-void  jq8400::reset() {
-  int retry = 5; // Try really hard to make ourselves heard.
-  do {
-    // The datasheet defined two stop commands but has no reset command
-    //  I have elected to make what looks more like "universal stop" 0x10
-    //  to be stop, and have defined for sake of convenience the other stop
-    //  command as "RESET", we will issue both to be sure and then 
-    //  set things back to "defaults", in absense of an actual reset
-    
-    this->sendCommand(MP3_CMD_STOP);  wait_ms(1000); // There seems to be something
-    this->sendCommand(MP3_CMD_RESET); wait_ms(1000); //  related to timing here
-        
-    // Reset to the startup defaults
-    this->setVolume(20);
-    this->setEqualizer(0);
-    this->setLoopMode(2);
-    this->seekFileByIndexNumber(1);
-    this->sendCommand(MP3_CMD_STOP);
+// Returns the ms until the module answered, -1 if it never did
+int  jq8400::reset() {
+  int started = this->millis();
+  this->invalidateCache();
+  
+  // The datasheet defined two stop commands but has no reset command
+  //  I have elected to make what looks more like "universal stop" 0x10
+  //  to be stop, and have defined for sake of convenience the other stop
+  //  command as "RESET", we will issue both to be sure and then 
+  //  set things back to "defaults", in absense of an actual reset
+  this->sendCommand<MP3_CMD_STOP>();
+  this->sendCommand<MP3_CMD_RESET>();
+  
+  // Instead of sleeping for as long as it might take, ask until it answers
+  if(this->waitUntilReady() < 0) {
+    return -1;
+  }
+  
+  // Reset to the startup defaults.  Whether the module really reset or not, 
+  // it already has any of them which we last set it to.
+  if(currentVolume != 20) this->setVolume(20);
+  if(currentEq     != 0)  this->setEqualizer(0);
+  if(currentLoop   != 2)  this->setLoopMode(2);
+  this->seekFileByIndexNumber(1); // Selects without playing, so no stop after
+  
+  lastReadyMs = this->millis() - started;
+  return lastReadyMs;
+}
+
+
+// Probes the module with a sources query, quickly at first then backing off,
+// until it answers with a good frame.  For after power on, or a reset.
+//
+// Returns the ms it took, -1 if it never answered within timeoutMs.
+int  jq8400::waitUntilReady(int timeoutMs) {
+  int started = this->millis();
+  int backoff = MP3_PROBE_BACKOFF_MIN;
+  
+  // Each probe is one short try, the backoff here takes the place of retries
+  jq8400RetryPolicy policy = retryPolicy;
+  retryPolicy.attempts   = 1;
+  retryPolicy.deadlineMs = MP3_PROBE_TIMEOUT;
+  lastReadyMs     = -1;
+  availableSources = -1; // So the probe really goes to the module
+  while(this->millis() - started < timeoutMs) {
+    MP3_METRIC(if(backoff > MP3_PROBE_BACKOFF_MIN) metricsData.retries++;)
+    this->getAvailableSources();
+    if(lastFrameResult == MP3_FRAME_OK) {
+      lastReadyMs = this->millis() - started;
+      break;
+    }
     
-    int timeout = 9;
-    while(timeout-- > 0 ) {
-      if(getAvailableSources()) {
-        retry = 0;
-        break; 
-      }
-      wait_ms(1000);
+    this->delay(backoff);
+    backoff *= 2;
+    if(backoff > MP3_PROBE_BACKOFF_MAX) {
+      backoff = MP3_PROBE_BACKOFF_MAX;
     }
   }
-  while(retry-- > 0);
+  retryPolicy = policy;
+  
+  return lastReadyMs;
 }
 
 
 int jq8400::getStatus() {
-      if(MP3_STATUS_CHECKS_IN_AGREEMENT <= 1) {
-        return this->sendCommandWithintResponse(MP3_CMD_STATUS); 
+      if(currentStatus >= 0 && this->fresh(statusReadAt, MP3_PLAYBACK_CACHE_MS)) {
+        cacheHits++;
+        return currentStatus;
       }
       
-      int statTotal = 0;
-      int stat      = 0;
-      do {
-        statTotal = 0;
-        for(int x = 0; x < MP3_STATUS_CHECKS_IN_AGREEMENT; x++) {
-          stat = this->sendCommandWithintResponse(MP3_CMD_STATUS);      
-          if(stat == 0) return 0; // STOP is fairly reliable
-          statTotal += stat;
+      cacheMisses++;
+      
+      // Playing and paused need to be read the same MP3_STATUS_CHECKS_IN_AGREEMENT
+      // times running, but within MP3_STATUS_MAX_READS, if the module can not 
+      // make its mind up by then the last reading will have to do
+      int stat   = -1;
+      int agreed = 0;
+      for(int reads = 0; reads < MP3_STATUS_MAX_READS && agreed < MP3_STATUS_CHECKS_IN_AGREEMENT; reads++) {
+        int reading = this->sendCommandWithintResponse<MP3_CMD_STATUS>();
+        if(lastFrameResult != MP3_FRAME_OK) {
+          return -1; // Do not guess, lastResult() says why
+        }
+        if(reading == MP3_STATUS_STOPPED) {
+          stat = reading; // STOP is fairly reliable
+          break;
         }
-      } while (statTotal != 1 * MP3_STATUS_CHECKS_IN_AGREEMENT && statTotal != 2 * MP3_STATUS_CHECKS_IN_AGREEMENT);
+        agreed = (reading == stat) ? agreed + 1 : 1;
+        stat   = reading;
+      }
       
-  return statTotal / MP3_STATUS_CHECKS_IN_AGREEMENT;      
+  currentStatus = stat;
+  statusReadAt  = this->millis();
+  return currentStatus;
 }
 
 
@@ -321,147 +656,1055 @@ int  jq8400::getLoopMode() {
 
 
 int  jq8400::countFiles() {
-  return this->sendCommandWithUnsignedIntResponse(MP3_CMD_COUNT_FILES); 
+  if(fileCount >= 0) {
+    cacheHits++;
+    return fileCount;
+  }
+  
+  cacheMisses++;
+  int count = this->sendCommandWithUnsignedIntResponse<MP3_CMD_COUNT_FILES>(); 
+  if(lastFrameResult == MP3_FRAME_OK) {
+    fileCount = count;
+  }
+  return count;
 }
 
 
 int  jq8400::currentFileIndexNumber() {
-  return this->sendCommandWithUnsignedIntResponse(MP3_CMD_CURRENT_FILE_IDX); 
+  if(currentIndex >= 0 && this->fresh(indexReadAt, MP3_PLAYBACK_CACHE_MS)) {
+    cacheHits++;
+    return currentIndex;
+  }
+  
+  cacheMisses++;
+  int index = this->sendCommandWithUnsignedIntResponse<MP3_CMD_CURRENT_FILE_IDX>(); 
+  if(lastFrameResult == MP3_FRAME_OK) {
+    currentIndex = index;
+    indexReadAt  = this->millis();
+  }
+  return index;
+}
+
+
+// The module keeps reporting the position every second from now until
+// unsubscribePosition(), the reports are picked up by poll() and the position
+// can be read at any time without asking the module.
+void jq8400::subscribePosition() {
+  positionSubscribed = 1;
+  positionAt         = -1; // Anything from an earlier subscription is stale
+  this->sendCommand<MP3_CMD_CURRENT_FILE_POS>(frameScratch, 3);
+}
+
+
+void jq8400::unsubscribePosition() {
+  positionSubscribed = 0;
+  this->sendCommand<MP3_CMD_CURRENT_FILE_POS_STOP>();
+}
+
+
+// Position from the last report, moved on by the time since.  Reports only come
+// while playing, so never more than a second is added on, a paused track does 
+// not appear to keep going.  The reports are taken in by the caller's poll(),
+// this does not poll itself so it is safe to call from a request callback.
+int  jq8400::currentFilePositionInMs() {
+  if(!positionSubscribed) {
+    int seconds = this->currentFilePositionInSeconds();
+    return seconds < 0 ? -1 : seconds * 1000;
+  }
+  
+  if(positionAt < 0) {
+    return -1; // No report yet
+  }
+  int since = this->millis() - positionAt;
+  return positionMs + (since < 1000 ? since : 1000);
 }
 
 
 int  jq8400::currentFilePositionInSeconds() {
-  int buf[3];
+  if(positionSubscribed) {
+    int ms = this->currentFilePositionInMs();
+    return ms < 0 ? -1 : ms / 1000;
+  }
+  
+  uint8_t buf[3];
   // This turns on continuous position reporting, every second
-  this->sendCommandData(MP3_CMD_CURRENT_FILE_POS, 0, 0, buf, 3);
+  this->sendCommand<MP3_CMD_CURRENT_FILE_POS>(buf, 3);
+  int result = lastFrameResult;
   // Stop it doing that
-  this->sendCommand(MP3_CMD_CURRENT_FILE_POS_STOP);
-  return (buf[0]*60*60) + (buf[1]*60) + buf[2];
+  this->sendCommand<MP3_CMD_CURRENT_FILE_POS_STOP>();
+  lastFrameResult = result;
+  return result == MP3_FRAME_OK ? (buf[0]*60*60) + (buf[1]*60) + buf[2] : -1;
 }
 
 
 int jq8400::currentFileLengthInSeconds() {
-  int buf[3];
-  this->sendCommandData(MP3_CMD_CURRENT_FILE_LEN, 0, 0, buf, 3);
-  return (buf[0]*60*60) + (buf[1]*60) + buf[2];
-  return 0; /* FIXME this->sendCommandWithUnsignedIntResponse(MP3_CMD_CURRENT_FILE_LEN_SEC); */ 
+  int index = this->currentFileIndexNumber();
+  int known = this->trackLengthInSeconds(index);
+  if(known >= 0) {
+    cacheHits++;
+    return known;
+  }
+  
+  cacheMisses++;
+  uint8_t buf[3];
+  this->sendCommand<MP3_CMD_CURRENT_FILE_LEN>(buf, 3);
+  if(lastFrameResult != MP3_FRAME_OK) {
+    return -1;
+  }
+  int seconds = (buf[0]*60*60) + (buf[1]*60) + buf[2];
+  this->rememberLength(index, seconds);
+  return seconds;
 }
 
 
 void jq8400::currentFileName(char *buffer, int bufferLength) {
-  this->sendCommand(MP3_CMD_CURRENT_FILE_NAME, (int *)buffer, bufferLength);
+  int index = this->currentFileIndexNumber();
+  if(this->trackName(index, buffer, bufferLength)) {
+    cacheHits++;
+    return;
+  }
+  
+  cacheMisses++;
+  memset(buffer, 0, bufferLength);
+  this->sendCommand<MP3_CMD_CURRENT_FILE_NAME>((uint8_t *)buffer, bufferLength);
   buffer[bufferLength-1] = 0; // Ensure null termination since this is a string.
+  
+  // Only a name that was not cut short by the buffer is worth keeping
+  if(lastFrameResult == MP3_FRAME_OK && (int)strlen(buffer) < bufferLength - 1) {
+    this->rememberName(index, buffer);
+  }
 }
 
 
-int jq8400::sendCommandWithUnsignedIntResponse(int command) {      
-  int buffer[4];
-  this->sendCommand(command, buffer, sizeof(buffer));
-  return ((int)buffer[0]<<8) | ((int)buffer[1]);
+void jq8400Metadata::clear() {
+  memset(tracks, 0, sizeof(tracks));
+  memset(names, 0, sizeof(names));
+  arenaUsed = 0;
+  count     = 0;
 }
 
 
-int jq8400::sendCommandWithintResponse(int command) {
-  int response = 0;
-  this->sendCommand(command, &response, 1);
-  return response;
+jq8400Metadata::Track *jq8400Metadata::find(int index) {
+  if(index <= 0 || index > 0xFFFF) {
+    return 0;
+  }
+  
+  for(int probe = 0, at = (index * 40503u) & (MP3_METADATA_TRACKS - 1); probe < MP3_METADATA_TRACKS; probe++, at = (at + 1) & (MP3_METADATA_TRACKS - 1)) {
+    if(tracks[at].index == index) {
+      return &tracks[at];
+    }
+    if(!tracks[at].index) {
+      return 0;
+    }
+  }
+  return 0;
 }
 
 
-void  jq8400::sendCommandData(int command, int *requestBuffer, int requestLength, int *responseBuffer, int bufferLength) {
-      // Calculate the checksum which forms the end int
-  int MP3_CHECKSUM = MP3_CMD_BEGIN + command + requestLength;
-  for(int x = 0; x < requestLength; x++) {
-    MP3_CHECKSUM += (int)requestBuffer[x];
+jq8400Metadata::Track *jq8400Metadata::insert(int index) {
+  if(index <= 0 || index > 0xFFFF) {
+    return 0;
+  }
+  
+  Track *track = this->find(index);
+  if(track) {
+    return track;
+  }
+  
+  // Kept at most three quarters full, so a miss finds an empty slot soon
+  if(count >= MP3_METADATA_TRACKS * 3 / 4) {
+    this->clear();
+    flushes++;
+  }
+  
+  int at = (index * 40503u) & (MP3_METADATA_TRACKS - 1);
+  while(tracks[at].index) {
+    at = (at + 1) & (MP3_METADATA_TRACKS - 1);
+  }
+  
+  track         = &tracks[at];
+  track->index  = index;
+  track->name   = 0;
+  track->length = -1;
+  track->folder = -1;
+  count++;
+  return track;
+}
+
+
+int jq8400Metadata::intern(const char *name) {
+  unsigned hash = 2166136261u; // FNV-1a
+  int      length;
+  for(length = 0; name[length]; length++) {
+    hash = (hash ^ (uint8_t)name[length]) * 16777619u;
+  }
+  
+  int at = hash & (MP3_METADATA_TRACKS - 1);
+  for(int probe = 0; probe < MP3_METADATA_TRACKS && names[at]; probe++, at = (at + 1) & (MP3_METADATA_TRACKS - 1)) {
+    if(strcmp(&arena[names[at] - 1], name) == 0) {
+      return names[at];
+    }
+  }
+  
+  // There is always room in the table, there are never more names than tracks
+  if(names[at] || arenaUsed + length + 1 > MP3_METADATA_ARENA) {
+    return 0;
+  }
+  memcpy(&arena[arenaUsed], name, length + 1);
+  names[at]  = arenaUsed + 1;
+  arenaUsed += length + 1;
+  return names[at];
+}
+
+
+// The entry for a track of the source in use, if it is known, after dropping
+// what was known of another source
+jq8400Metadata::Track *jq8400::metadataFor(int index) {
+  if(currentSource >= 0 && currentSource != metadataSource) {
+    metadata.clear();
+    metadataSource = currentSource;
+    crawlNext      = 1;
+    crawlTries     = 0;
+  }
+  return metadata.find(index);
+}
+
+
+int jq8400::catalogFolderOf(int index) {
+  if(catalogSource < 0 || catalogSource != metadataSource) {
+    return -1;
+  }
+  for(int folder = 0; folder < MP3_CATALOG_MAX_FOLDERS; folder++) {
+    if(catalogFirst[folder] && index >= catalogFirst[folder] && index < catalogFirst[folder] + catalogCount[folder]) {
+      return folder;
+    }
+  }
+  return -1;
+}
+
+
+void jq8400::rememberName(int index, const char *name) {
+  this->metadataFor(index);
+  jq8400Metadata::Track *track = metadata.insert(index);
+  if(!track) {
+    return;
+  }
+  
+  int interned = metadata.intern(name);
+  if(!interned) {
+    metadata.clear(); // The arena is full, start again
+    metadata.flushes++;
+    track    = metadata.insert(index);
+    interned = metadata.intern(name);
+  }
+  track->name   = interned;
+  track->folder = this->catalogFolderOf(index);
+}
+
+
+void jq8400::rememberLength(int index, int seconds) {
+  this->metadataFor(index);
+  jq8400Metadata::Track *track = metadata.insert(index);
+  if(track) {
+    track->length = seconds;
+    track->folder = this->catalogFolderOf(index);
+  }
+}
+
+
+int jq8400::trackName(int index, char *buffer, int bufferLength) {
+  jq8400Metadata::Track *track = this->metadataFor(index);
+  if(!track || !track->name) {
+    if(bufferLength > 0) buffer[0] = 0;
+    return 0;
   }
   
-  // If there is any random garbage on the line, clear that out now.
-  while(this->waitUntilAvailable(10)) this->->read();
+  strncpy(buffer, metadata.text(track), bufferLength);
+  buffer[bufferLength-1] = 0;
+  return 1;
+}
+
 
-  this->->putc(MP3_CMD_BEGIN);
-  this->->putc(command);
-  this->->putc(requestLength);
+int jq8400::trackLengthInSeconds(int index) {
+  jq8400Metadata::Track *track = this->metadataFor(index);
+  return track ? track->length : -1;
+}
+
+
+int jq8400::trackFolder(int index) {
+  jq8400Metadata::Track *track = this->metadataFor(index);
+  if(track && track->folder < 0) {
+    track->folder = this->catalogFolderOf(index); // The catalog may have come since
+  }
+  return track ? track->folder : -1;
+}
+
+
+int jq8400::crawlMetadata() {
+  if(crawlIndex) {
+    return -1; // Still waiting on the last one
+  }
+  if(currentStatus != MP3_STATUS_STOPPED || fileCount < 0 || currentIndex <= 0) {
+    return -1;
+  }
+  
+  jq8400Metadata::Track *track = 0;
+  while(crawlNext <= fileCount) {
+    track = this->metadataFor(crawlNext);
+    if(!track || !track->name || track->length < 0) break;
+    crawlNext++;
+  }
+  
+  // No further than the table holds, or it would forget what it just learnt
+  if(crawlNext > fileCount || (!track && metadata.count >= MP3_METADATA_TRACKS * 3 / 4)) {
+    return 0;
+  }
+  
+  // All four in the one go, so that nothing else gets between the seek and
+  // the questions, or is left out
+  if(this->queueRoom() < 4) {
+    return -1;
+  }
+  
+  uint8_t there[] = { (uint8_t)(crawlNext >> 8), (uint8_t)crawlNext };
+  uint8_t back[]  = { (uint8_t)(currentIndex >> 8), (uint8_t)currentIndex };
+  memset(crawlName, 0, sizeof(crawlName));
+  crawlIndex = crawlNext;
+  this->submit(MP3_CMD_SEEK_IDX, there, 2);
+  this->submit(MP3_CMD_CURRENT_FILE_NAME, 0, 0, crawlName, sizeof(crawlName) - 1, &jq8400::crawlNameArrived, this);
+  this->submit(MP3_CMD_CURRENT_FILE_LEN, 0, 0, crawlLength, 3, &jq8400::crawlLengthArrived, this);
+  this->submit(MP3_CMD_SEEK_IDX, back, 2);
+  
+  return fileCount - crawlNext + 1;
+}
+
+
+void jq8400::crawlNameArrived(jq8400Request *request, void *context) {
+  jq8400 *self = (jq8400 *)context;
+  if(request->result == MP3_FRAME_OK) {
+    self->crawlName[request->responseLength] = 0;
+    self->rememberName(self->crawlIndex, (const char *)self->crawlName);
+  }
+}
+
+
+void jq8400::crawlLengthArrived(jq8400Request *request, void *context) {
+  jq8400 *self = (jq8400 *)context;
+  if(request->result == MP3_FRAME_OK) {
+    self->rememberLength(self->crawlIndex, (self->crawlLength[0]*60*60) + (self->crawlLength[1]*60) + self->crawlLength[2]);
+  }
+  
+  // The length comes after the name, so the track is as known as it will be
+  jq8400Metadata::Track *track = self->metadata.find(self->crawlIndex);
+  if(track && track->name && track->length >= 0) {
+    self->crawlTries = 0; // The crawl goes past it next time
+  } else if(++self->crawlTries >= MP3_METADATA_CRAWL_TRIES) {
+    self->crawlNext++;    // Skip a track which will not answer, rather than ask forever
+    self->crawlTries = 0;
+  }
+  self->crawlIndex = 0;
+}
+
+
+// AA [CMD] [DATA_COUNT] [B1..N] [SUM] into frame, which must have room for 
+// MP3_MAX_FRAME_LENGTH.  Returns the length of the frame, 0 if the data will not fit.
+int jq8400::encodeFrame(uint8_t *frame, int command, const uint8_t *requestBuffer, int requestLength) {
+  if(requestLength < 0 || requestLength > MP3_MAX_REQUEST_LENGTH) {
+    return 0;
+  }
+  
+  int checksum = MP3_CMD_BEGIN + command + requestLength;
+  frame[0] = MP3_CMD_BEGIN;
+  frame[1] = command;
+  frame[2] = requestLength;
   for(int x = 0; x < requestLength; x++) {
-    this->->write(requestBuffer[x]);
+    frame[3 + x] = requestBuffer[x];
+    checksum    += requestBuffer[x];
+  }
+  frame[3 + requestLength] = checksum;
+  
+  return 4 + requestLength;
+}
+
+
+// Every command encoded by the compiler and compared with the bytes worked out
+// by hand (play and volume match the examples in the datasheet), a mistake in
+// the encoding or in a command constant fails the build.  bench/encode.cpp
+// checks the same bytes come out of encodeFrame() at run time.
+static constexpr bool jq8400FrameMatches(const uint8_t *frame, const char *golden, int length) {
+  return length == 0 || (frame[0] == (uint8_t)golden[0] && jq8400FrameMatches(frame + 1, golden + 1, length - 1));
+}
+
+#define MP3_GOLDEN_FRAME(golden, ...) \
+  static_assert(jq8400ConstFrame<__VA_ARGS__>::length == sizeof(golden) - 1 \
+             && jq8400FrameMatches(jq8400ConstFrame<__VA_ARGS__>::bytes, golden, sizeof(golden) - 1), #__VA_ARGS__)
+
+struct jq8400GoldenFrames
+{
+  MP3_GOLDEN_FRAME("\xAA\x02\x00\xAC", jq8400::MP3_CMD_PLAY);
+  MP3_GOLDEN_FRAME("\xAA\x03\x00\xAD", jq8400::MP3_CMD_PAUSE);
+  MP3_GOLDEN_FRAME("\xAA\x23\x02\x00\x05\xD4", jq8400::MP3_CMD_FFWD, 0, 5);
+  MP3_GOLDEN_FRAME("\xAA\x22\x02\x00\x05\xD3", jq8400::MP3_CMD_RWND, 0, 5);
+  MP3_GOLDEN_FRAME("\xAA\x10\x00\xBA", jq8400::MP3_CMD_STOP);
+  MP3_GOLDEN_FRAME("\xAA\x06\x00\xB0", jq8400::MP3_CMD_NEXT);
+  MP3_GOLDEN_FRAME("\xAA\x05\x00\xAF", jq8400::MP3_CMD_PREV);
+  MP3_GOLDEN_FRAME("\xAA\x07\x02\x00\x01\xB4", jq8400::MP3_CMD_PLAY_IDX, 0, 1);
+  MP3_GOLDEN_FRAME("\xAA\x1F\x02\x01\x2C\xF8", jq8400::MP3_CMD_SEEK_IDX, 1, 44);
+  MP3_GOLDEN_FRAME("\xAA\x16\x03\x01\x00\x03\xC7", jq8400::MP3_CMD_INSERT_IDX, 1, 0, 3);
+  MP3_GOLDEN_FRAME("\xAA\x20\x04\x00\x0A\x01\x05\xDE", jq8400::MP3_CMD_AB_PLAY, 0, 10, 1, 5);
+  MP3_GOLDEN_FRAME("\xAA\x21\x00\xCB", jq8400::MP3_CMD_AB_PLAY_STOP);
+  MP3_GOLDEN_FRAME("\xAA\x0F\x00\xB9", jq8400::MP3_CMD_NEXT_FOLDER);
+  MP3_GOLDEN_FRAME("\xAA\x0E\x00\xB8", jq8400::MP3_CMD_PREV_FOLDER);
+  MP3_GOLDEN_FRAME("\xAA\x08\x0A\x01\x2F\x34\x32\x2A\x2F\x2A\x3F\x3F\x3F\x92", jq8400::MP3_CMD_PLAY_FILE_FOLDER, 1, '/', '4', '2', '*', '/', '*', '?', '?', '?');
+  MP3_GOLDEN_FRAME("\xAA\x14\x00\xBE", jq8400::MP3_CMD_VOL_UP);
+  MP3_GOLDEN_FRAME("\xAA\x15\x00\xBF", jq8400::MP3_CMD_VOL_DN);
+  MP3_GOLDEN_FRAME("\xAA\x13\x01\x14\xD2", jq8400::MP3_CMD_VOL_SET, 20);
+  MP3_GOLDEN_FRAME("\xAA\x1A\x01\x02\xC7", jq8400::MP3_CMD_EQ_SET, 2);
+  MP3_GOLDEN_FRAME("\xAA\x18\x01\x02\xC5", jq8400::MP3_CMD_LOOP_SET, 2);
+  MP3_GOLDEN_FRAME("\xAA\x0B\x01\x01\xB7", jq8400::MP3_CMD_SOURCE_SET, 1);
+  MP3_GOLDEN_FRAME("\xAA\x04\x00\xAE", jq8400::MP3_CMD_SLEEP);
+  MP3_GOLDEN_FRAME("\xAA\x04\x00\xAE", jq8400::MP3_CMD_RESET);
+  MP3_GOLDEN_FRAME("\xAA\x01\x00\xAB", jq8400::MP3_CMD_STATUS);
+  MP3_GOLDEN_FRAME("\xAA\x09\x00\xB3", jq8400::MP3_CMD_GET_SOURCES);
+  MP3_GOLDEN_FRAME("\xAA\x0A\x00\xB4", jq8400::MP3_CMD_GET_SOURCE);
+  MP3_GOLDEN_FRAME("\xAA\x0C\x00\xB6", jq8400::MP3_CMD_COUNT_FILES);
+  MP3_GOLDEN_FRAME("\xAA\x12\x00\xBC", jq8400::MP3_CMD_COUNT_IN_FOLDER);
+  MP3_GOLDEN_FRAME("\xAA\x0D\x00\xB7", jq8400::MP3_CMD_CURRENT_FILE_IDX);
+  MP3_GOLDEN_FRAME("\xAA\x11\x00\xBB", jq8400::MP3_CMD_FIRST_FILE_IN_FOLDER_IDX);
+  MP3_GOLDEN_FRAME("\xAA\x24\x00\xCE", jq8400::MP3_CMD_CURRENT_FILE_LEN);
+  MP3_GOLDEN_FRAME("\xAA\x25\x00\xCF", jq8400::MP3_CMD_CURRENT_FILE_POS);
+  MP3_GOLDEN_FRAME("\xAA\x26\x00\xD0", jq8400::MP3_CMD_CURRENT_FILE_POS_STOP);
+  MP3_GOLDEN_FRAME("\xAA\x1E\x00\xC8", jq8400::MP3_CMD_CURRENT_FILE_NAME);
+  MP3_GOLDEN_FRAME("\xAA\x1B\x04\x30\x31\x30\x32\x8C", jq8400::MP3_CMD_PLAYLIST, '0', '1', '0', '2');
+};
+
+
+int  jq8400::sendCommandData(int command, const uint8_t *requestBuffer, int requestLength, uint8_t *responseBuffer, int bufferLength) {
+  uint8_t frame[MP3_MAX_FRAME_LENGTH];
+  int     frameLength = this->encodeFrame(frame, command, requestBuffer, requestLength);
+  if(!frameLength) {
+    lastFrameResult = MP3_FRAME_TIMEOUT;
+    return lastFrameResult;
   }
-  this->->putc(MP3_CHECKSUM);
-            
-  if(responseBuffer && bufferLength) {
-    memset(responseBuffer, 0, bufferLength);
-  } else { // If we don't expect a response (or don't care) don't wait for ones
+  
+  return this->sendFrame(frame, frameLength, responseBuffer, bufferLength);
+}
+
+
+// The blocking form is just the asynchronous engine run until our request is 
+// done.  A query is tried again, as the retry policy allows, until it gets a 
+// good response, and never takes longer than the policy's deadline.
+int  jq8400::sendFrame(const uint8_t *frame, int frameLength, uint8_t *responseBuffer, int bufferLength) {
+  int hasResponse = responseBuffer && bufferLength;
+  int deadline    = hasResponse ? retryPolicy.deadlineMs : 0;
+  int started     = this->millis();
+  int backoff     = retryPolicy.backoffMs;
+  
+  for(int attempt = 1; ; attempt++) {
+    // What is left of the deadline is shared among the tries left, so one lost
+    // command can not use it all up
+    int left = deadline > 0 ? (deadline - (this->millis() - started)) / (retryPolicy.attempts - attempt + 1) : MP3_RESPONSE_TIMEOUT;
+    
+    int handle;
+    responseTimeout = left < MP3_RESPONSE_TIMEOUT ? left : MP3_RESPONSE_TIMEOUT;
+    while(!(handle = this->submitFrame(frame, frameLength, responseBuffer, bufferLength))) {
+      this->poll(); // Queue is full, wait for some room
+      if(deadline > 0 && this->millis() - started >= deadline) {
+        responseTimeout = MP3_RESPONSE_TIMEOUT;
+        lastFrameResult = MP3_FRAME_TIMEOUT;
+        return lastFrameResult;
+      }
+    }
+    responseTimeout = MP3_RESPONSE_TIMEOUT;
+    
+    this->waitFor(handle, hasResponse, deadline > 0 ? deadline - (this->millis() - started) : 0);
+    if(lastFrameResult == MP3_FRAME_OK || !hasResponse || attempt >= retryPolicy.attempts) {
+      break;
+    }
+    
+    // Jittered, so that a burst of noise does not catch every retry alike
+    int pause = backoff + this->jitter(backoff / 2 + 1);
+    if(deadline > 0 && this->millis() - started + pause >= deadline) {
+      break;
+    }
+    for(int from = this->millis(); this->millis() - from < pause; ) {
+      this->poll();
+    }
+    backoff = backoff * 2 < retryPolicy.backoffMaxMs ? backoff * 2 : retryPolicy.backoffMaxMs;
+    MP3_METRIC(metricsData.retries++;)
+  }
+  
+  return lastFrameResult;
+}
+
+
+// Runs the engine until the request completes, or deadlineMs (if not 0) passes
+int  jq8400::waitFor(int handle, int hasResponse, int deadlineMs) {
+  // Fire and forget, poll() will send it
+  if(pipelineMode && !hasResponse) {
+    this->poll();
+    lastFrameResult = MP3_FRAME_OK;
+    return lastFrameResult;
+  }
+  
+  int started = this->millis();
+  while(!this->complete(handle)) {
+    this->poll();
+    if(deadlineMs > 0 && this->millis() - started >= deadlineMs) {
+      this->abandon(handle);
+    }
+  }
+  
+  lastFrameResult = this->result(handle);
+  return lastFrameResult;
+}
+
+
+// Gives up on a request as timed out, whether it has been sent or not.  Any
+// late response is dropped as nobody's.
+void jq8400::abandon(int handle) {
+  jq8400Request *req = this->findRequest(handle);
+  if(!req || req->state == MP3_REQUEST_DONE) {
     return;
   }
-      
-  // Allow some time for the device to process what we did and 
-  // respond, up to 1 second, but typically only a few ms.
-  this->waitUntilAvailable(1000);
-            
-  // The response format is the same as the command format
-  //  AA [CMD] [DATA_COUNT] [B1..N] [SUM]
-  MP3_CHECKSUM = 0;
-      
-  int      i = 0;
-  int      j = 0;
-  int      dataCount = 0;
-  while(this->waitUntilAvailable(150)) {
-    j = this->->read();
-    if(i == 2) {
-      // The number of data ints to read
-      dataCount = j;
+  
+  if(req == active) {
+    this->finishRequest(req, MP3_FRAME_TIMEOUT);
+    return;
+  }
+  
+  MP3_METRIC(metricsData.timeouts++;)
+  req->result = MP3_FRAME_TIMEOUT;
+  req->state  = MP3_REQUEST_DONE;
+  if(req->responseBuffer) {
+    memset(req->responseBuffer, 0, req->bufferLength);
+  }
+}
+
+
+// 0 to range-1, xorshift
+int  jq8400::jitter(int range) {
+  jitterState ^= jitterState << 13;
+  jitterState ^= jitterState >> 17;
+  jitterState ^= jitterState << 5;
+  return range > 0 ? jitterState % range : 0;
+}
+
+
+int jq8400::submit(int command, const uint8_t *requestBuffer, int requestLength, uint8_t *responseBuffer, int bufferLength, jq8400Callback callback, void *context) {
+  if(requestLength > MP3_MAX_REQUEST_LENGTH) {
+    return 0;
+  }
+  
+  if(!callback && !(responseBuffer && bufferLength)) {
+    int handle = this->coalesce(command, requestBuffer, requestLength);
+    if(handle) {
+      return handle;
+    }
+  }
+  
+  jq8400Request *req = this->allocate(responseBuffer, bufferLength, callback, context);
+  if(!req) {
+    return 0;
+  }
+  
+  req->command     = command;
+  req->frameLength = this->encodeFrame(req->frame, command, requestBuffer, requestLength);
+  req->state       = MP3_REQUEST_QUEUED;
+  return req->handle;
+}
+
+
+// As submit(), for a frame which is already encoded (eg a jq8400ConstFrame)
+int jq8400::submitFrame(const uint8_t *frame, int frameLength, uint8_t *responseBuffer, int bufferLength, jq8400Callback callback, void *context) {
+  if(frameLength < 4 || frameLength > MP3_MAX_FRAME_LENGTH) {
+    return 0;
+  }
+  
+  // Several frames back to back are sent as they are, never merged into another
+  if(!callback && !(responseBuffer && bufferLength) && frameLength == 4 + frame[2]) {
+    int handle = this->coalesce(frame[1], &frame[3], frame[2]);
+    if(handle) {
+      return handle;
+    }
+  }
+  
+  jq8400Request *req = this->allocate(responseBuffer, bufferLength, callback, context);
+  if(!req) {
+    return 0;
+  }
+  
+  req->command     = frame[1];
+  req->frameLength = frameLength;
+  memcpy(req->frame, frame, frameLength);
+  req->state       = MP3_REQUEST_QUEUED;
+  return req->handle;
+}
+
+
+// A free slot in the queue, set up for everything but the frame, or 0 if the queue is full
+jq8400Request *jq8400::allocate(uint8_t *responseBuffer, int bufferLength, jq8400Callback callback, void *context) {
+  jq8400Request *req = 0;
+  for(int x = 0; x < MP3_QUEUE_DEPTH; x++) {
+    if(queue[x].state == MP3_REQUEST_FREE) {
+      req = &queue[x];
+      break;
     }
-        
-    // We only record the data ints so ints 0,1 and 2 are discarded
-    //   except for calculating checksum
-    if(i <= 2) {
-      MP3_CHECKSUM += j;
-      i++;
+  }
+  if(!req) {
+    return 0;
+  }
+  
+  req->handle         = nextHandle++;
+  if(nextHandle <= 0) nextHandle = 1;
+  req->responseBuffer = (bufferLength > 0) ? responseBuffer : 0;
+  req->bufferLength   = bufferLength < 0xFFFF ? bufferLength : 0xFFFF;
+  req->result         = MP3_FRAME_INCOMPLETE;
+  req->responseLength = 0;
+  req->timeoutMs      = responseTimeout;
+  req->cpuTimeUs      = 0;
+  req->callback       = callback;
+  req->context        = context;
+  if(req->responseBuffer) {
+    memset(req->responseBuffer, 0, bufferLength);
+  }
+  return req;
+}
+
+
+// Requests which could be submitted now without any being refused
+int jq8400::queueRoom() {
+  int room = 0;
+  for(int x = 0; x < MP3_QUEUE_DEPTH; x++) {
+    if(queue[x].state == MP3_REQUEST_FREE) room++;
+  }
+  return room;
+}
+
+
+// Volume, equalizer and loop mode only matter for their final value, so if one
+// is still waiting to be sent, overwrite it instead of queueing another.
+// Returns the handle of the request merged into, or 0 if there was none.
+int jq8400::coalesce(int command, const uint8_t *requestBuffer, int requestLength) {
+  int isVolume = (command == MP3_CMD_VOL_SET || command == MP3_CMD_VOL_UP || command == MP3_CMD_VOL_DN);
+  if(!isVolume && command != MP3_CMD_EQ_SET && command != MP3_CMD_LOOP_SET) {
+    return 0;
+  }
+  
+  for(int x = 0; x < MP3_QUEUE_DEPTH; x++) {
+    jq8400Request *req = &queue[x];
+    if(req->state != MP3_REQUEST_QUEUED || req->callback || req->responseBuffer || req->frameLength != 4 + req->frame[2]) {
       continue;
+    }
+    
+    int reqIsVolume = (req->command == MP3_CMD_VOL_SET || req->command == MP3_CMD_VOL_UP || req->command == MP3_CMD_VOL_DN);
+    if(isVolume && reqIsVolume) {
+      // Any mix of steps and sets comes down to a set: of the level asked for
+      // if this is one, of where we now think we are after a step
+      uint8_t volume   = (command == MP3_CMD_VOL_SET && requestLength >= 1) ? requestBuffer[0] : currentVolume;
+      req->command     = MP3_CMD_VOL_SET;
+      req->frameLength = this->encodeFrame(req->frame, MP3_CMD_VOL_SET, &volume, 1);
+    } else if(req->command == command && requestLength == req->frame[2]) {
+      req->frameLength = this->encodeFrame(req->frame, command, requestBuffer, requestLength);
     } else {
-      if(dataCount > 0) {
-        // This is a dataint to read
-        if((i-3) <= (bufferLength-1)) {
-          responseBuffer[i-3] = j;
-        }
-        i++;
-        dataCount--;
-        MP3_CHECKSUM += j;
-      } else {
-        // This is the checksum int
-        if((MP3_CHECKSUM & 0xFF) != j) {
-          // Checksum Failed
-          /* #if MP3_DEBUG
-              Serial.print(" ** CHECKSUM FAILED " );
-              HEX_PRINT((MP3_CHECKSUM & 0xFF)); 
-              Serial.print(" != ");
-              HEX_PRINT(j); 
-          #endif */
-          memset(responseBuffer, 0, bufferLength);
-        } else {
-               /* #if MP3_DEBUG
-                Serial.print(" ** CHECKSUM OK " );
-                HEX_PRINT((MP3_CHECKSUM & 0xFF)); 
-                Serial.print(" == ");
-                HEX_PRINT(j); 
-              #endif */
-        }
-      }
+      continue;
     }
-  }      
+    
+    totalCoalesced++;
+    return req->handle;
+  }
+  
+  return 0;
 }
+
+
+int jq8400::complete(int handle) {
+  jq8400Request *req = this->findRequest(handle);
+  return !req || req->state == MP3_REQUEST_DONE;
+}
+
+
+int jq8400::result(int handle) {
+  jq8400Request *req = this->findRequest(handle);
+  if(!req) {
+    return MP3_FRAME_OK; // Released on completion, it had no response to go wrong
+  }
+  if(req->state != MP3_REQUEST_DONE) {
+    return MP3_FRAME_INCOMPLETE;
+  }
+  
+  int r = req->result;
+  req->handle = 0;
+  req->state  = MP3_REQUEST_FREE;
+  return r;
+}
+
+
+jq8400Request *jq8400::findRequest(int handle) {
+  for(int x = 0; x < MP3_QUEUE_DEPTH; x++) {
+    if(queue[x].handle == handle && queue[x].state != MP3_REQUEST_FREE) {
+      return &queue[x];
+    }
+  }
+  return 0;
+}
+
+
+// Runs the engine, call this as often as you can from your main loop, it never 
+// blocks.  Returns the number of commands not yet complete.
+int jq8400::poll() {
+  int worked  = 0;
+  pollStarted = this->micros();
+  
+  // Transmit whatever the UART will take without blocking
+  while(txTail != txHead && this->writeable()) {
+    MP3_TRACED(traceTx.record(txBuffer[txTail], this->micros());)
+    this->putc(txBuffer[txTail]);
+    txTail       = (txTail + 1) & (MP3_TX_BUFFER_SIZE - 1);
+    MP3_METRIC(metricsData.bytesSent++;)
+    lastActivity = this->millis();
+    worked       = 1;
+  }
+  
+  // Everything received goes through the decoder, complete frames are handed 
+  // out by their command byte, so replies and the module's unsolicited position
+  // reports can arrive in any order.  Garbage on the line is just dropped, this
+  // is what used to be the 10ms "drain" before every command.
+  while(rxTail != rxHead) {
+    int c  = rxBuffer[rxTail];
+    rxTail = (rxTail + 1) & (MP3_RX_BUFFER_SIZE - 1);
+    worked = 1;
+    
+    int r = decoder.feed(c);
+    MP3_METRIC(metricsData.bytesReceived++;)
+    MP3_METRIC(if(r == MP3_FRAME_BAD_CHECKSUM) metricsData.checksumFailures++;)
     
+    int ours = active && active->responseBuffer && decoder.command() == active->command;
+    if(ours) {
+      responseStarted = 1;
+      lastActivity    = this->millis();
+    }
+    
+    if(r == MP3_FRAME_OK) {
+      this->dispatchFrame();
+    } else if(r == MP3_FRAME_BAD_CHECKSUM && ours) {
+      this->finishRequest(active, r);
+    }
+  }
+  
+  if(active && txTail == txHead) {
+    if(!active->responseBuffer) {
+      this->finishRequest(active, MP3_FRAME_OK);
+    } else if(this->millis() - lastActivity > (responseStarted ? MP3_BYTE_TIMEOUT : active->timeoutMs)) {
+      this->finishRequest(active, MP3_FRAME_TIMEOUT);
+    }
+  }
+  
+  if(!active && (pipelineMode || this->millis() - lastCompleted >= MP3_COMMAND_GAP)) {
+    jq8400Request *next = 0;
+    for(int x = 0; x < MP3_QUEUE_DEPTH; x++) {
+      if(queue[x].state == MP3_REQUEST_QUEUED && (!next || queue[x].handle - next->handle < 0)) {
+        next = &queue[x];
+      }
+    }
+    if(next) {
+      this->startRequest(next);
+      worked = 1;
+    }
+  }
+  
+  int pending = 0;
+  for(int x = 0; x < MP3_QUEUE_DEPTH; x++) {
+    if(queue[x].state == MP3_REQUEST_QUEUED || queue[x].state == MP3_REQUEST_SENT) {
+      pending++;
+    }
+  }
+  
+  // Idle polls are not counted, only the time spent actually doing something
+  if(worked) {
+    int elapsed  = this->micros() - pollStarted;
+    totalCpuUs  += elapsed;
+    if(active) {
+      active->cpuTimeUs += elapsed;
+    }
+  }
+  
+  return pending;
+}
 
-// Waits until data becomes available, or a timeout occurs
-int jq8400::waitUntilAvailable(int maxWaitTime)
-{
-  int c = 0;
-  Timer startTime;
-  startTime.start();
-  do {
-    c = this->->available();
-    if (c) {
-      break;
-      startTime.stop()
+
+void jq8400::startRequest(jq8400Request *req) {
+  responseStarted = 0;
+  
+  // The frame was encoded when it was submitted, it is copied to the ring in at 
+  // most two pieces, either side of the wrap
+  int first = MP3_TX_BUFFER_SIZE - txHead;
+  if(first > req->frameLength) {
+    first = req->frameLength;
+  }
+  memcpy(&txBuffer[txHead], req->frame, first);
+  memcpy(txBuffer, &req->frame[first], req->frameLength - first);
+  txHead = (txHead + req->frameLength) & (MP3_TX_BUFFER_SIZE - 1);
+  
+  req->state   = MP3_REQUEST_SENT;
+  active       = req;
+  MP3_METRIC(req->sentAtUs = this->micros();)
+  lastActivity = this->millis();
+  totalCommands++;
+}
+
+
+// A good frame has arrived, it is either the reply the active request is waiting
+// for or something the module sent of its own accord
+void jq8400::dispatchFrame() {
+  int command = decoder.command();
+  int length  = decoder.dataLength();
+  if(length > MP3_MAX_RESPONSE_LENGTH) {
+    length = MP3_MAX_RESPONSE_LENGTH;
+  }
+  
+  if(command == MP3_CMD_CURRENT_FILE_POS && length >= 3) {
+    positionMs = ((frameData[0]*60*60) + (frameData[1]*60) + frameData[2]) * 1000;
+    positionAt = lastReceived; // Not now, poll() may not have been called for a while
+  }
+  
+  if(active && active->responseBuffer && command == active->command) {
+    int x = 0;
+    for(; x < length && x < active->bufferLength; x++) {
+      active->responseBuffer[x] = frameData[x];
     }
-  } while(startTime.read() < maxWaitTime);
-  return c;
+    active->responseLength = x;
+    this->finishRequest(active, MP3_FRAME_OK);
+  } else if(active && active->responseBuffer && command != MP3_CMD_CURRENT_FILE_POS) {
+    // Not a report, so an answer to something else (eg a late one to a query
+    // that gave up), the module is not answering what we asked
+    this->finishRequest(active, MP3_FRAME_BAD_COMMAND);
+  }
+}
+
+
+void jq8400::finishRequest(jq8400Request *req, int frameResult) {
+  // A response cut short leaves the decoder part way through a frame, which 
+  // would swallow the start of the next one, so begin again
+  if(frameResult == MP3_FRAME_TIMEOUT && req == active) {
+    decoder.reset(-1, frameData, MP3_MAX_RESPONSE_LENGTH);
+  }
+  
+  req->result = frameResult;
+  req->state  = MP3_REQUEST_DONE;
+  if(req == active) {
+    active = 0;
+  }
+  lastCompleted = this->millis();
+  
+  int now = this->micros();
+  req->cpuTimeUs += now - pollStarted;
+  totalCpuUs     += now - pollStarted;
+  
+  MP3_METRIC(this->recordLatency(req->command, now - req->sentAtUs);)
+  MP3_METRIC(if(frameResult == MP3_FRAME_INCOMPLETE) metricsData.timeouts++;)
+  
+  if(frameResult != MP3_FRAME_OK && req->responseBuffer) {
+    memset(req->responseBuffer, 0, req->bufferLength);
+  }
+  
+  if(req->callback) {
+    req->callback(req, req->context);
+  }
+  pollStarted = this->micros(); // The callback's time is the caller's, not ours
+  
+  // Nobody is going to come asking for the result of these
+  if(req->callback || !req->responseBuffer) {
+    req->handle = 0;
+    req->state  = MP3_REQUEST_FREE;
+  }
+}
+
+
+#if MP3_METRICS
+void jq8400::metrics(jq8400Metrics &snapshot) {
+  metricsData.bytesDiscarded = decoder.discarded;
+  metricsData.rxOverflows    = rxDropped;
+  snapshot = metricsData;
+}
+
+
+// Zeroes everything in the snapshot, including rxOverflows()
+void jq8400::resetMetrics() {
+  memset(&metricsData, 0, sizeof(metricsData));
+  decoder.discarded = 0;
+  rxDropped         = 0;
+}
+
+
+void jq8400::recordLatency(int command, int elapsedUs) {
+  jq8400CommandMetrics *m = &metricsData.commands[command < MP3_METRICS_COMMANDS ? command : MP3_METRICS_COMMANDS - 1];
+  m->count++;
+  m->totalUs += elapsedUs;
+  if((uint32_t)elapsedUs > m->maxUs) {
+    m->maxUs = elapsedUs;
+  }
+  
+  int bucket = 0;
+  while(bucket < MP3_METRICS_BUCKETS - 1 && elapsedUs >= jq8400Metrics::bucketLimitMs(bucket) * 1000) {
+    bucket++;
+  }
+  if(m->latency[bucket] != 0xFFFF) {
+    m->latency[bucket]++;
+  }
+}
+
+
+int jq8400Metrics::bucketLimitMs(int bucket) {
+  static const int limits[MP3_METRICS_BUCKETS - 1] = { 2, 5, 10, 20, 50, 100, 200, 500, 1000 };
+  return (bucket >= 0 && bucket < MP3_METRICS_BUCKETS - 1) ? limits[bucket] : -1;
+}
+#endif
+
+
+#if MP3_TRACE
+void jq8400::resetTrace() {
+  traceTx.count = 0;
+  traceRx.count = 0;
+}
+
+
+// The two rings merged by time.  If either has wrapped only the span both
+// still cover is exported, responses without the commands that prompted them
+// (or the other way round) would replay as nonsense.
+int  jq8400::exportTrace(unsigned char *blob, int blobLength) {
+  const uint32_t mask = MP3_TRACE_LENGTH - 1;
+  uint32_t txCount = traceTx.count;
+  uint32_t rxCount = traceRx.count;
+  uint32_t tx      = txCount > MP3_TRACE_LENGTH ? txCount - MP3_TRACE_LENGTH : 0;
+  uint32_t rx      = rxCount > MP3_TRACE_LENGTH ? rxCount - MP3_TRACE_LENGTH : 0;
+  
+  if(tx || rx) {
+    uint32_t from = tx ? traceTx.stamp[tx & mask] : traceRx.stamp[rx & mask];
+    if(tx && rx && (int32_t)(traceRx.stamp[rx & mask] - from) > 0) {
+      from = traceRx.stamp[rx & mask];
+    }
+    while(tx < txCount && (int32_t)(traceTx.stamp[tx & mask] - from) < 0) tx++;
+    while(rx < rxCount && (int32_t)(traceRx.stamp[rx & mask] - from) < 0) rx++;
+  }
+  
+  uint32_t total = (txCount - tx) + (rxCount - rx);
+  if(blobLength < 5 || (uint32_t)(blobLength - 5) / 5 < total) {
+    return 0;
+  }
+  
+  int i = 0;
+  blob[i++] = MP3_TRACE_VERSION;
+  blob[i++] = (total >> 24) & 0xFF;
+  blob[i++] = (total >> 16) & 0xFF;
+  blob[i++] = (total >> 8) & 0xFF;
+  blob[i++] = total & 0xFF;
+  
+  while(tx < txCount || rx < rxCount) {
+    // Sent first when at the same time, a response can not come before its command
+    int sent = rx >= rxCount || (tx < txCount && (int32_t)(traceTx.stamp[tx & mask] - traceRx.stamp[rx & mask]) <= 0);
+    jq8400TraceRing &ring = sent ? traceTx : traceRx;
+    uint32_t        &n    = sent ? tx : rx;
+    uint32_t stamp = (ring.stamp[n & mask] & ~MP3_TRACE_TX) | (sent ? MP3_TRACE_TX : 0);
+    
+    blob[i++] = (stamp >> 24) & 0xFF;
+    blob[i++] = (stamp >> 16) & 0xFF;
+    blob[i++] = (stamp >> 8) & 0xFF;
+    blob[i++] = stamp & 0xFF;
+    blob[i++] = ring.data[n & mask];
+    n++;
+  }
+  return i;
+}
+#endif
+
+
+// Called from the RX interrupt, only ever moves rxHead
+void jq8400::rxInterrupt() {
+  lastReceived = this->millis();
+  while(this->readable()) {
+    int c    = this->getc();
+    int next = (rxHead + 1) & (MP3_RX_BUFFER_SIZE - 1);
+    MP3_TRACED(traceRx.record(c, this->micros());)
+    if(next == rxTail) {
+      rxDropped++;
+      continue;
+    }
+    rxBuffer[rxHead] = c;
+    rxHead = next;
+  }
+}
+
+
+#define MP3_DECODE_BEGIN    0
+#define MP3_DECODE_COMMAND  1
+#define MP3_DECODE_LENGTH   2
+#define MP3_DECODE_DATA     3
+#define MP3_DECODE_CHECKSUM 4
+
+void jq8400FrameDecoder::reset(int expectedCommand, uint8_t *responseBuffer, int responseLength) {
+  state        = MP3_DECODE_BEGIN;
+  expected     = expectedCommand;
+  frameCommand = -1;
+  frameLength  = 0;
+  dataCount    = 0;
+  checksum     = 0;
+  buffer       = responseBuffer;
+  bufferLength = responseLength;
+}
+
+
+int jq8400FrameDecoder::feed(int c) {
+  c &= 0xFF;
+  
+  switch(state) {
+    case MP3_DECODE_BEGIN:
+      // Anything which is not a frame start is garbage, drop it
+      MP3_METRIC(if(c != 0xAA) discarded++;)
+      if(c == 0xAA) {
+        checksum = c;
+        state    = MP3_DECODE_COMMAND;
+      }
+      return MP3_FRAME_INCOMPLETE;
+      
+    case MP3_DECODE_COMMAND:
+      // No command is 0xAA, so this must be a new start, the previous was stray
+      if(c == 0xAA) {
+        checksum = c;
+        MP3_METRIC(discarded++;)
+        return MP3_FRAME_INCOMPLETE;
+      }
+      frameCommand = c;
+      checksum    += c;
+      state        = MP3_DECODE_LENGTH;
+      return MP3_FRAME_INCOMPLETE;
+      
+    case MP3_DECODE_LENGTH:
+      frameLength = c;
+      dataCount   = 0;
+      checksum   += c;
+      state       = c ? MP3_DECODE_DATA : MP3_DECODE_CHECKSUM;
+      return MP3_FRAME_INCOMPLETE;
+      
+    case MP3_DECODE_DATA:
+      // Only write into the caller's buffer for the frame they are waiting on
+      if((expected < 0 || frameCommand == expected) && buffer && dataCount < bufferLength) {
+        buffer[dataCount] = c;
+      }
+      checksum += c;
+      if(++dataCount >= frameLength) {
+        state = MP3_DECODE_CHECKSUM;
+      }
+      return MP3_FRAME_INCOMPLETE;
+      
+    default:
+      state = MP3_DECODE_BEGIN;
+      if((checksum & 0xFF) != c) {
+        return MP3_FRAME_BAD_CHECKSUM;
+      }
+      if(expected >= 0 && frameCommand != expected) {
+        return MP3_FRAME_BAD_COMMAND;
+      }
+      return MP3_FRAME_OK;
+  }
 }
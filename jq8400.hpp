@@ -29,6 +29,9 @@
 #ifndef jq8400_h
 #define jq8400_h
 
+#include "jq8400_transport.hpp"
+#include <stdint.h>
+
     #define MP3_EQ_NORMAL           0
     #define MP3_EQ_POP              1
     #define MP3_EQ_ROCK             2
@@ -51,13 +54,353 @@
     #define MP3_STATUS_PLAYING      1
     #define MP3_STATUS_PAUSED       2
     #define MP3_STATUS_CHECKS_IN_AGREEMENT 1
+    #define MP3_STATUS_MAX_READS    (3 * MP3_STATUS_CHECKS_IN_AGREEMENT) // Reads getStatus() will make looking for that agreement
+    #define MP3_FRAME_INCOMPLETE    0       // Result of feeding a byte to the frame decoder, INCOMPLETE = need more bytes (or timed out waiting for them)
+    #define MP3_FRAME_OK            1       // OK = checksum matched and the command echo is the one we asked for
+    #define MP3_FRAME_BAD_CHECKSUM  2       // BAD_CHECKSUM = frame complete but corrupt
+    #define MP3_FRAME_BAD_COMMAND   3       // BAD_COMMAND = good frame, but for some other command (eg unsolicited position report)
+    #define MP3_FRAME_TIMEOUT       MP3_FRAME_INCOMPLETE // As the result of a command, it never got (all of) its response
+
+    // The sizes of the driver's storage, all of it is in the jq8400 object (or
+    // static), none from the heap.  Any of these can be set for the build
+    // (eg -DMP3_QUEUE_DEPTH=4), see jq8400_footprint.hpp for what they cost.
+    #ifndef MP3_RX_BUFFER_SIZE
+    #define MP3_RX_BUFFER_SIZE      64      // Bytes, must be a power of two, filled from the RX interrupt
+    #endif
+    #ifndef MP3_TX_BUFFER_SIZE
+    #define MP3_TX_BUFFER_SIZE      64      // Bytes, must be a power of two, emptied by poll()
+    #endif
+    #ifndef MP3_QUEUE_DEPTH
+    #define MP3_QUEUE_DEPTH         8       // Commands which can be outstanding at once
+    #endif
+    #ifndef MP3_MAX_REQUEST_LENGTH
+    #define MP3_MAX_REQUEST_LENGTH  32      // Data bytes in one queued command
+    #endif
+    #ifndef MP3_MAX_RESPONSE_LENGTH
+    #define MP3_MAX_RESPONSE_LENGTH 32      // Data bytes kept from one response frame
+    #endif
+    #define MP3_MAX_FRAME_LENGTH    (MP3_MAX_REQUEST_LENGTH + 4) // Bytes in one encoded command, AA CMD LEN and SUM around the data
+    #define MP3_RESPONSE_TIMEOUT    1000    // ms to wait for the first byte of a response
+    #define MP3_PROBE_TIMEOUT       50      // ms to wait for the answer to a readiness probe, a ready module answers in about 10
+    #define MP3_PROBE_BACKOFF_MIN   10      // ms between the first readiness probes, doubling each time
+    #define MP3_PROBE_BACKOFF_MAX   500     //  up to this
+    #define MP3_READY_TIMEOUT       15000   // ms to keep probing for before giving up on the module
+    #define MP3_RETRY_ATTEMPTS      3       // Default retry policy for queries, tries in all
+    #define MP3_RETRY_DEADLINE      1500    //  ms for the whole call, however many tries
+    #define MP3_RETRY_BACKOFF       5       //  ms before the first retry, doubling, plus up to half again of jitter
+    #define MP3_RETRY_BACKOFF_MAX   100     //  up to this
+    #define MP3_BYTE_TIMEOUT        150     // ms to wait between bytes of a response
+    #define MP3_COMMAND_GAP         10      // ms of quiet between commands, the module drops commands sent too closely
+    #define MP3_PLAYBACK_CACHE_MS   250     // ms a status or current index read is trusted for, tracks end by themselves
+    #define MP3_SOURCES_CACHE_MS    1000    // ms the available sources are trusted for, media can be pulled at any time
+    #define MP3_CATALOG_MAX_FOLDERS 100     // Folders 00 to 99, as playFileNumberInFolderNumber() can address
+    #define MP3_CATALOG_VERSION     1       // First byte of an exportCatalog() blob
+    #ifndef MP3_METADATA_TRACKS
+    #define MP3_METADATA_TRACKS     64      // Tracks whose name, length and folder are remembered, must be a power of two
+    #endif
+    #ifndef MP3_METADATA_ARENA
+    #define MP3_METADATA_ARENA      1024    // Bytes for their names, a name shared by several tracks is kept once
+    #endif
+    #define MP3_METADATA_CRAWL_TRIES 3      // Times crawlMetadata() asks about a track before it moves on without it
+    #define MP3_REQUEST_FREE        0
+    #define MP3_REQUEST_QUEUED      1
+    #define MP3_REQUEST_SENT        2
+    #define MP3_REQUEST_DONE        3
     #define MP3_DEBUG               0
     #define HEX_PRINT(a) if(a < 16) Serial.print(0); Serial.print(a, HEX);
+    
+    #ifndef MP3_METRICS
+    #define MP3_METRICS             0       // 1 to count commands, bytes and errors and keep latency histograms, see jq8400::metrics()
+    #endif
+    #define MP3_METRICS_COMMANDS    0x28    // Commands 0x00 to 0x27 are counted separately, any above that in the last
+    #define MP3_METRICS_BUCKETS     10      // Latency buckets, up to 2, 5, 10, 20, 50, 100, 200, 500, 1000 ms and over
+    #if MP3_METRICS
+    #define MP3_METRIC(a) a
+    #else
+    #define MP3_METRIC(a)
+    #endif
+    
+    #ifndef MP3_TRACE
+    #define MP3_TRACE               0       // 1 to record every byte on the wire with the time, see jq8400::exportTrace()
+    #endif
+    #ifndef MP3_TRACE_LENGTH
+    #define MP3_TRACE_LENGTH        512     // Bytes kept in each direction, the most recent, must be a power of two
+    #endif
+    #define MP3_TRACE_VERSION       1       // First byte of an exportTrace() blob
+    #define MP3_TRACE_TX            0x80000000u // Set in the time of a byte which was sent, as exported
+    #if MP3_TRACE
+    #define MP3_TRACED(a) a
+    #else
+    #define MP3_TRACED(a)
+    #endif
+
+    #ifndef MP3_NO_HEAP
+    #define MP3_NO_HEAP             0       // 1 for nothing ever to come from the heap, a jq8400Task fails instead when the frame pool can not hold it
+    #endif
+
+    static_assert(!(MP3_RX_BUFFER_SIZE & (MP3_RX_BUFFER_SIZE - 1)) && !(MP3_TX_BUFFER_SIZE & (MP3_TX_BUFFER_SIZE - 1)), "MP3_RX_BUFFER_SIZE and MP3_TX_BUFFER_SIZE must be powers of two");
+    static_assert(MP3_TX_BUFFER_SIZE >= MP3_MAX_FRAME_LENGTH, "MP3_TX_BUFFER_SIZE must hold a whole frame");
+    static_assert(MP3_QUEUE_DEPTH >= 2, "MP3_QUEUE_DEPTH must allow a request to be queued behind the one being sent");
+    static_assert(MP3_MAX_REQUEST_LENGTH >= 13 && MP3_MAX_FRAME_LENGTH <= 255, "MP3_MAX_REQUEST_LENGTH must fit a folder and file path (13 bytes), and a frame the length byte");
+    static_assert(MP3_MAX_RESPONSE_LENGTH >= 3, "MP3_MAX_RESPONSE_LENGTH must fit a time (3 bytes)");
+    static_assert(MP3_METADATA_TRACKS >= 4 && !(MP3_METADATA_TRACKS & (MP3_METADATA_TRACKS - 1)) && MP3_METADATA_TRACKS <= 32768, "MP3_METADATA_TRACKS must be a power of two");
+    static_assert(MP3_METADATA_ARENA < 65535, "MP3_METADATA_ARENA offsets are unsigned short");
+    static_assert(!(MP3_TRACE_LENGTH & (MP3_TRACE_LENGTH - 1)), "MP3_TRACE_LENGTH must be a power of two");
+
+    /** Streaming decoder for the response frames of the module
+     *
+     *  The response format is the same as the command format
+     *    AA [CMD] [DATA_COUNT] [B1..N] [SUM]
+     *
+     *  Bytes are fed one at a time, the decoder reports MP3_FRAME_OK as soon as the
+     *  checksum byte arrives so the caller need not wait for the line to go quiet.
+     *  Garbage before the 0xAA is skipped, and a stray 0xAA in the command position
+     *  is treated as the start of a new frame.
+     *
+     *  With an expectedCommand of -1 every frame is MP3_FRAME_OK and has its data
+     *  written to responseBuffer, the caller sorts them out by command().
+     */
+    class jq8400FrameDecoder
+    {
+    public:
+        jq8400FrameDecoder() { MP3_METRIC(discarded = 0;) reset(-1, 0, 0); }
+        
+        void    reset(int expectedCommand, uint8_t *responseBuffer, int bufferLength);
+        int     feed(int c);
+        int     command()    { return frameCommand; } ///< Of the frame being (or last) decoded
+        int     dataLength() { return frameLength;  }
+        MP3_METRIC(unsigned int discarded;)           ///< Bytes dropped looking for the start of a frame, reset() leaves it alone
+        
+    protected:
+        int     state;
+        int     expected;
+        int     frameCommand;
+        int     frameLength;
+        int     dataCount;
+        int     checksum;
+        uint8_t *buffer;
+        int     bufferLength;
+    };
+
+    /** Checksum of the bytes of a frame, the low byte of their sum */
+    constexpr int jq8400Checksum() { return 0; }
+    template<typename... Bytes>
+    constexpr int jq8400Checksum(int b, Bytes... rest) { return (b + jq8400Checksum(rest...)) & 0xFF; }
+
+    /** A command frame whose bytes are all known at compile time, it is built by
+     *  the compiler, checksum included, and sent as it is.
+     *
+     *    jq8400ConstFrame<0x02>::bytes        is  AA 02 00 AC
+     *    jq8400ConstFrame<0x13, 20>::bytes    is  AA 13 01 14 D2
+     */
+    template<int Command, int... Data>
+    struct jq8400ConstFrame
+    {
+        static constexpr int     length = 4 + sizeof...(Data);
+        static constexpr uint8_t bytes[length] = { 0xAA, Command, sizeof...(Data), Data..., jq8400Checksum(0xAA, Command, sizeof...(Data), Data...) };
+    };
+    template<int Command, int... Data> constexpr int     jq8400ConstFrame<Command, Data...>::length;
+    template<int Command, int... Data> constexpr uint8_t jq8400ConstFrame<Command, Data...>::bytes[];
+
+    /** Counters for one MP3_CMD_*, the latency is from starting to send the
+     *  command to its response arriving (or, for commands without a response,
+     *  to it being sent).  Histogram buckets stop counting at 65535.
+     */
+    struct jq8400CommandMetrics
+    {
+        uint32_t    count;
+        uint32_t    totalUs;
+        uint32_t    maxUs;
+        uint16_t    latency[MP3_METRICS_BUCKETS];
+    };
+
+    /** Snapshot of the instrumentation, from jq8400::metrics() */
+    struct jq8400Metrics
+    {
+        jq8400CommandMetrics commands[MP3_METRICS_COMMANDS]; ///< Indexed by MP3_CMD_*
+        uint32_t    bytesSent;
+        uint32_t    bytesReceived;
+        uint32_t    bytesDiscarded;     ///< Received outside any frame, what used to be drained
+        uint32_t    checksumFailures;   ///< Frames received corrupt, ours or not
+        uint32_t    timeouts;           ///< Commands whose response never (fully) arrived
+        uint32_t    retries;            ///< Commands sent again because an earlier try failed
+        uint32_t    rxOverflows;        ///< Bytes lost to a full RX buffer
+        
+        static int  bucketLimitMs(int bucket); ///< Upper limit of a latency bucket, -1 for the last
+    };
+
+    /** The last MP3_TRACE_LENGTH bytes one way, with the micros() each went to
+     *  or came from the UART.  TX and RX have a ring each, so poll() and the
+     *  RX interrupt never write the same one and neither needs a lock.
+     */
+    struct jq8400TraceRing
+    {
+        uint32_t            stamp[MP3_TRACE_LENGTH];
+        uint8_t             data[MP3_TRACE_LENGTH];
+        volatile uint32_t   count;      ///< Recorded ever, only the last MP3_TRACE_LENGTH are kept
+        
+        void    record(int c, int atUs) {
+          uint32_t at = count & (MP3_TRACE_LENGTH - 1);
+          stamp[at]   = atUs;
+          data[at]    = c;
+          count       = count + 1;
+        }
+    };
+
+    /** Name, length and folder of the tracks seen, by index, for the source
+     *  in use.  The table is hashed by index, and the names are interned into
+     *  a fixed arena.  Nothing is ever removed on its own, when the table is
+     *  three quarters full or the arena is, it is all forgotten and refilled.
+     */
+    struct jq8400Metadata
+    {
+        struct Track {
+            unsigned short  index;      ///< 0 for an empty slot
+            unsigned short  name;       ///< Offset into the arena plus one, 0 if not known
+            short           length;     ///< Seconds, -1 if not known
+            short           folder;     ///< Number, -1 if not known
+        };
+        
+        Track           tracks[MP3_METADATA_TRACKS];
+        unsigned short  names[MP3_METADATA_TRACKS]; ///< The interned names, hashed by their text
+        char            arena[MP3_METADATA_ARENA];
+        int             arenaUsed;
+        int             count;          ///< Tracks in the table
+        int             flushes;        ///< Times it has all been forgotten to make room
+        
+        void    clear();
+        Track  *find(int index);
+        Track  *insert(int index);      ///< Found or added, which may forget the others first
+        int     intern(const char *name); ///< As for Track::name, 0 if the arena is full
+        const char *text(const Track *track) { return track && track->name ? &arena[track->name - 1] : ""; }
+    };
+
+    /** How hard the blocking queries try.  Commands without a response can not
+     *  tell whether they were heard, so are only ever sent once.
+     */
+    struct jq8400RetryPolicy
+    {
+        int     attempts;       ///< Tries in all, 1 for no retries (less is taken as 1)
+        int     deadlineMs;     ///< For the whole call, including waiting for the queue, 0 for none
+        int     backoffMs;      ///< Before the first retry, doubling each time, plus up to half again at random
+        int     backoffMaxMs;
+    };
+
+    struct jq8400Request;
+    typedef void (*jq8400Callback)(jq8400Request *request, void *context);
 
-    class jq8400 : public Serial
+    /** One command in the queue of the asynchronous engine.
+     *
+     *  The response (if any) is decoded directly into responseBuffer, one byte
+     *  per byte of response data, which must remain valid until the request is
+     *  complete.
+     */
+    struct jq8400Request
+    {
+        int             handle;         ///< Returned by submit(), 0 when the slot is free
+        uint8_t        *responseBuffer;
+        jq8400Callback  callback;
+        void           *context;
+        int             timeoutMs;      ///< For the response to start
+        int             cpuTimeUs;      ///< CPU time spent encoding, sending and decoding this request
+        MP3_METRIC(int  sentAtUs;)      ///< micros() when sending started
+        uint16_t        bufferLength;
+        volatile uint8_t state;         ///< MP3_REQUEST_*
+        uint8_t         command;
+        uint8_t         result;         ///< MP3_FRAME_*, MP3_FRAME_TIMEOUT if it timed out
+        uint8_t         responseLength; ///< Bytes of response data written to responseBuffer
+        uint8_t         frameLength;
+        uint8_t         frame[MP3_MAX_FRAME_LENGTH]; ///< Encoded when submitted, sent as it is
+    };
+
+    class jq8400 : public JQ8400_TRANSPORT
     {        
+        friend class jq8400Emulator;
+        friend class jq8400StatusMonitor;
+        friend class jq8400Playlist;
+        friend class jq8400Announcer;
+        friend class jq8400Frontend;
+        friend class jq8400Fader;
+        friend class jq8400Async;
+        friend class jq8400HealthMonitor;
+        friend class jq8400Timeline;
+        friend class jq8400Phrase;
+        friend class jq8400MediaWatcher;
+        friend struct jq8400GoldenFrames;  // Compile time checks of the encoding, in jq8400.cpp
+        
     public: 
-        jq8400(PinName _tx, PinName _rx) : Serial(_tx,_rx)
+        /** Takes whatever the transport takes, for the default mbed transport 
+         *  that is jq8400(PinName tx, PinName rx)
+         */
+        template<typename... TransportArgs>
+        jq8400(TransportArgs&&... args) : JQ8400_TRANSPORT(args...) { 
+          begin(); 
+        }
+        
+        /** Queue a command without waiting for it.
+         *
+         *  @return a handle for complete()/result(), or 0 if the queue is full.
+         *    If a callback is given it is called (from poll()) on completion and
+         *    the handle is released straight after, as it is for commands with 
+         *    no response buffer.
+         */
+        int     submit(int command, const uint8_t *requestBuffer, int requestLength, uint8_t *responseBuffer = 0, int bufferLength = 0, jq8400Callback callback = 0, void *context = 0);
+        int     submitFrame(const uint8_t *frame, int frameLength, uint8_t *responseBuffer = 0, int bufferLength = 0, jq8400Callback callback = 0, void *context = 0);
+        int     complete(int handle);
+        int     result(int handle);
+        int     poll();
+        int     cpuTimeUs()      { return totalCpuUs; }
+        int     commandsSent()   { return totalCommands; }
+        int     rxOverflows()    { return rxDropped; }
+        
+        #if MP3_METRICS
+        void    metrics(jq8400Metrics &snapshot);
+        void    resetMetrics();
+        #endif
+        
+        #if MP3_TRACE
+        /** The bytes recorded, both ways in time order, for a jq8400Capture
+         *  (jq8400_replay.hpp) to analyse or replay on a desktop.
+         *
+         *    [VERSION] [COUNT 4 bytes] then for each byte
+         *    [MICROS 4 bytes, MP3_TRACE_TX set if sent] [BYTE]
+         *
+         *  Multi-byte numbers are big endian.  Returns the number of bytes
+         *  written, 0 if it will not fit (5 + 5 per byte is enough).
+         */
+        int     exportTrace(unsigned char *blob, int blobLength);
+        void    resetTrace();
+        #endif
+        
+        /** In pipelined mode commands which expect no response are queued and sent
+         *  back to back without the MP3_COMMAND_GAP, and the blocking methods return
+         *  as soon as they are queued (keep calling poll()).  
+         *
+         *  Independently of this, a volume, equalizer or loop mode change which is
+         *  still waiting in the queue is replaced by a newer one rather than sent
+         *  twice, so a burst of volumeUp() becomes a single MP3_CMD_VOL_SET.
+         */
+        void    setPipelined(int pipelined) { pipelineMode = pipelined; }
+        int     commandsCoalesced()         { return totalCoalesced; }
+        
+        /** The shadow state (source, status, index, file count...) saves asking the
+         *  module things we already know, these count how often that happened.
+         */
+        int     queriesAvoided() { return cacheHits; }
+        int     queriesMade()    { return cacheMisses; }
+        void    invalidateCache();
+        
+        /** Queries return -1 (or an empty name) when they fail, and this says why, 
+         *  MP3_FRAME_OK, MP3_FRAME_TIMEOUT, MP3_FRAME_BAD_CHECKSUM or 
+         *  MP3_FRAME_BAD_COMMAND (something else answered).  Failed queries are
+         *  retried first as the retry policy allows.
+         */
+        int     lastResult()     { return lastFrameResult; }
+        void    setRetryPolicy(const jq8400RetryPolicy &policy) {
+          retryPolicy = policy;
+          if(retryPolicy.attempts < 1) retryPolicy.attempts = 1; // Always the one try, and sendFrame() divides by what is left
+        }
+        const jq8400RetryPolicy &getRetryPolicy() { return retryPolicy; }
 
         void    play();
         void    restart();
@@ -70,9 +413,16 @@
         void    nextFolder();
         void    prevFolder();
         void    playFileByIndexNumber(int fileNumber);        
+        
+        /** These name the source in the frame, so ask for it when it is not
+         *  known.  If it can not be read they send nothing (the module would
+         *  play nothing on source 0xFF) and lastResult() says why, otherwise it
+         *  is the result of the play itself.
+         */
         void    interjectFileByIndexNumber(int fileNumber);        
         void    playFileNumberInFolderNumber(int folderNumber, int fileNumber);
         void    playInFolderNumber(int folderNumber);
+        
         void    seekFileByIndexNumber(int fileNumber);
         void    abLoopPlay(int secondsStart, int secondsEnd);
         void    abLoopClear();
@@ -83,12 +433,15 @@
         void    setLoopMode(int loopMode);
         void    setSource(int source);
         int getSource();
-        int sourceAvailable(int source) {
-          return getAvailableSources() & 1<<source;
+        int     sourceAvailable(int source) {
+          int sources = getAvailableSources();
+          return sources >= 0 && (sources & 1<<source);
         }
         
         void    sleep();
-        void    reset();
+        int     reset();
+        int     waitUntilReady(int timeoutMs = MP3_READY_TIMEOUT);
+        int     readyTimeMs() { return lastReadyMs; } ///< From the last reset() or waitUntilReady(), -1 if it never answered
         int    getStatus();
         int busy() { return getStatus() == MP3_STATUS_PLAYING; }
         int    getVolume();
@@ -97,39 +450,177 @@
         int   countFiles();    
         int   currentFileIndexNumber();
         int   currentFilePositionInSeconds();
+        int   currentFilePositionInMs();
+        void  subscribePosition();
+        void  unsubscribePosition();
         int   currentFileLengthInSeconds();
         void       currentFileName(char *buffer, int bufferLength);    
         void    playSequenceByFileNumber(int playList[], int listLength);
+        
+        /** A catalog maps folder and file numbers to indexes, so that the folder
+         *  play methods send a plain MP3_CMD_PLAY_IDX instead of making the module
+         *  search its filesystem.  It is dropped when the media changes.
+         */
+        int     buildCatalog();
+        int     exportCatalog(unsigned char *blob, int blobLength);
+        int     importCatalog(const unsigned char *blob, int blobLength);
+        int     catalogValid() { return catalogSource >= 0 && catalogSource == this->getSource(); }
         void    playSequenceByFileName(const char *playList[], int listLength);       
         
+        /** What is known of a track without asking the module, filled in as
+         *  currentFileName() and currentFileLengthInSeconds() ask about the
+         *  track playing (so each track is asked about once), and by
+         *  crawlMetadata().  Forgotten when the source or the media changes.
+         *
+         *  These only look, never ask, -1 (or an empty name, returning 0) if
+         *  the track is not known.  The folder is known with a catalog.
+         */
+        int     trackName(int index, char *buffer, int bufferLength);
+        int     trackLengthInSeconds(int index);
+        int     trackFolder(int index);
+        int     tracksKnown()    { return metadata.count; }
+        
+        /** Fills in the next track not yet known, without waiting, when the
+         *  module is known to be stopped and countFiles() has been asked: it
+         *  has to be selected to be asked about, and is put back to the track
+         *  it was on.  Call it from an idle loop (along with poll()), returns
+         *  the tracks still to do or -1 if it can not crawl just now.
+         */
+        int     crawlMetadata();
         
     protected:
-        void        sendCommandData(int command, int *requestBuffer, int requestLength, int *responseBuffer, int bufferLength);
-        inline void sendCommand(int command, int *responseBuffer = 0, int bufferLength = 0) { 
-          sendCommandData(command, NULL,  0, responseBuffer, bufferLength);
+        static int  encodeFrame(uint8_t *frame, int command, const uint8_t *requestBuffer, int requestLength);
+        int         sendCommandData(int command, const uint8_t *requestBuffer, int requestLength, uint8_t *responseBuffer, int bufferLength);
+        int         sendFrame(const uint8_t *frame, int frameLength, uint8_t *responseBuffer, int bufferLength);
+        int         waitFor(int handle, int hasResponse, int deadlineMs);
+        void        abandon(int handle);
+        int         jitter(int range);
+        
+        // Commands without data are the same bytes every time, so they are built
+        // by the compiler rather than on every call
+        template<int Command>
+        inline void sendCommand(uint8_t *responseBuffer = 0, int bufferLength = 0) { 
+          sendFrame(jq8400ConstFrame<Command>::bytes, jq8400ConstFrame<Command>::length, responseBuffer, bufferLength);
         }
 
-        inline void sendCommand(int command, int arg, int *responseBuffer = 0, int bufferLength = 0) { 
-        sendCommandData(command, &arg, 1, responseBuffer, bufferLength); 
+        inline void sendCommand(int command, int arg, uint8_t *responseBuffer = 0, int bufferLength = 0) { 
+          uint8_t buf[] = { (uint8_t)arg };
+          sendCommandData(command, buf, 1, responseBuffer, bufferLength); 
+        }
+        
+        inline void sendCommandWord(int command, int arg, uint8_t *responseBuffer = 0, int bufferLength = 0) { 
+          uint8_t buf[] = { (uint8_t)(arg>>8), (uint8_t)arg }; // Big endian on the wire
+          sendCommandData(command, buf, 2, responseBuffer, bufferLength);
         }
         
-        inline void sendCommand(int command, int arg, int *responseBuffer = 0, int bufferLength = 0) { 
-          #if __int_ORDER__ == __ORDER_BIG_ENDIAN__    
-              sendCommandData(command, ((int *)(&arg)), 2, responseBuffer, bufferLength);
-          #else
-              int buf[] = { *(((int *)(&arg))+1), *((int *)(&arg)) };
-              sendCommandData(command, buf, 2, responseBuffer, bufferLength);
-          #endif
+        template<int Command>
+        int   sendCommandWithUnsignedIntResponse() {
+          uint8_t buffer[2];
+          this->sendCommand<Command>(buffer, sizeof(buffer));
+          return lastFrameResult == MP3_FRAME_OK ? (buffer[0]<<8) | buffer[1] : -1;
+        }
+        
+        template<int Command>
+        int   sendCommandWithintResponse() {
+          uint8_t response = 0;
+          this->sendCommand<Command>(&response, 1);
+          return lastFrameResult == MP3_FRAME_OK ? response : -1;
         }
-            
-        int   sendCommandWithUnsignedIntResponse(int command);        
-        int   sendCommandWithintResponse(int command);
         int   getAvailableSources();
-        int   waitUntilAvailable(int maxWaitTime = 1000);
+        void  playFolderPath(int source, int folderNumber);
+        void  sendPath(const char *path, int length);
+        void  begin();
+        void  rxInterrupt();
+        static void rxHandler(void *self) { ((jq8400 *)self)->rxInterrupt(); }
+        void  startRequest(jq8400Request *req);
+        void  finishRequest(jq8400Request *req, int frameResult);
+        void  dispatchFrame();
+        jq8400Request *findRequest(int handle);
+        MP3_METRIC(void recordLatency(int command, int elapsedUs);)
+        jq8400Request *allocate(uint8_t *responseBuffer, int bufferLength, jq8400Callback callback, void *context);
+        int   coalesce(int command, const uint8_t *requestBuffer, int requestLength);
+        
+        volatile int  rxHead;     ///< Written only by rxInterrupt()
+        volatile int  rxTail;     ///< Written only by poll()
+        volatile int  lastReceived; ///< millis() of the last RX interrupt
+        int           rxDropped;
+        unsigned char rxBuffer[MP3_RX_BUFFER_SIZE];
+        int           txHead;
+        int           txTail;
+        unsigned char txBuffer[MP3_TX_BUFFER_SIZE];
+        
+        jq8400Request      queue[MP3_QUEUE_DEPTH];
+        jq8400Request     *active;        ///< Sent and awaiting its response
+        jq8400FrameDecoder decoder;       ///< Decodes every frame received, into frameData
+        uint8_t            frameData[MP3_MAX_RESPONSE_LENGTH];
+        int                lastActivity;  ///< millis() of the last byte received, or the request being sent
+        int                lastCompleted; ///< millis() at which the last request finished
+        int                responseStarted; ///< Some of the active request's response has arrived
+        int                pollStarted;   ///< micros() from which CPU time is next charged
+        int                nextHandle;
+        int                totalCpuUs;
+        int                totalCommands;
+        int                totalCoalesced;
+        int                pipelineMode;
+        int                responseTimeout; ///< ms, for requests submitted from now on
+        jq8400RetryPolicy  retryPolicy;
+        unsigned int       jitterState;
+        MP3_METRIC(jq8400Metrics metricsData;)
+        MP3_TRACED(jq8400TraceRing traceTx;)
+        MP3_TRACED(jq8400TraceRing traceRx;)
+        int                lastReadyMs;
         int   currentVolume = 20; ///< Record of current volume level (jq8400 has no way to query)
         int   currentEq     = 0;  ///< Record of current equalizer (jq8400 has no way to query)
         int   currentLoop   = 2;  ///< Record of current loop mode (jq8400 has no way to query)
+        
+        void  invalidatePlayback(int expected = -1) { currentStatus = -1; currentIndex = -1; expectedStatus = expected; playbackChanges++; }
+        void  selectIndex(int index, int expected);
+        void  remember(int command, const uint8_t *data, int length, int responseLength);
+        void  sourcesRead(int sources);
+        int   queueRoom();
+        int   fresh(int readAt, int maxAge) { return this->millis() - readAt < maxAge; }
+        
+        int   currentSource    = -1; ///< Record of current source, -1 when not known
+        int   availableSources = -1; ///< Record of the sources bitmask, -1 when not known
+        int   sourcesReadAt    = 0;  ///< millis() when availableSources was read
+        int   currentStatus    = -1; ///< Record of the playback status, -1 when not known
+        int   statusReadAt     = 0;  ///< millis() when currentStatus was read
+        int   currentIndex     = -1; ///< Record of the current file index, -1 when not known
+        int   indexReadAt      = 0;  ///< millis() when currentIndex was read (or set)
+        int   fileCount        = -1; ///< Record of files on the current source, -1 when not known
+        int   expectedStatus   = -1; ///< What the last command which changed playback should have left it as, -1 when not known
+        int   playbackChanges  = 0;  ///< Commands sent which change playback, so a watcher can tell them from faults
+        int   cacheHits        = 0;
+        int   cacheMisses      = 0;
+        int   lastFrameResult  = MP3_FRAME_OK; ///< MP3_FRAME_* of the last blocking command
+        
+        int   positionSubscribed = 0;
+        int   positionMs         = 0;  ///< From the last position report
+        int   positionAt         = -1; ///< millis() when that arrived, -1 never
+        uint8_t frameScratch[3];
+        
+        int             catalogSource    = -1; ///< Source the catalog describes, -1 when there is none
+        int             catalogFileCount = 0;  ///< countFiles() when it was built
+        unsigned short  catalogFirst[MP3_CATALOG_MAX_FOLDERS]; ///< Index of file 001 in each folder, 0 if no such folder
+        unsigned short  catalogCount[MP3_CATALOG_MAX_FOLDERS];
+        
+        jq8400Metadata  metadata;
+        int             metadataSource = -1; ///< Source the metadata describes
+        int             crawlNext      = 1;  ///< Index the crawl looks at next
+        int             crawlIndex     = 0;  ///< Being crawled, 0 for none
+        int             crawlTries     = 0;  ///< Times crawlNext has been asked about without an answer to both
+        uint8_t         crawlName[MP3_MAX_RESPONSE_LENGTH];
+        uint8_t         crawlLength[3];
+        
+        jq8400Metadata::Track *metadataFor(int index);
+        int   catalogFolderOf(int index);
+        void  rememberName(int index, const char *name);
+        void  rememberLength(int index, int seconds);
+        static void crawlNameArrived(jq8400Request *request, void *context);
+        static void crawlLengthArrived(jq8400Request *request, void *context);
 
+    public:
+        // The command bytes, for submit() and jq8400Frontend::send()
         static const int MP3_CMD_BEGIN                    = 0xAA;        
         static const int MP3_CMD_PLAY                     = 0x02;
         static const int MP3_CMD_PAUSE                    = 0x03;
@@ -0,0 +1,307 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#include "jq8400_announcer.hpp"
+
+#define MP3_ANNOUNCER_IDLE      0   // No prompt
+#define MP3_ANNOUNCER_SENDING   1   // The MP3_CMD_INSERT_IDX is in the jq8400's queue
+#define MP3_ANNOUNCER_STARTING  2   // Sent, waiting for the monitor to see it
+#define MP3_ANNOUNCER_PLAYING   3   // Seen, waiting for the end of it
+
+jq8400Announcer::jq8400Announcer(jq8400 &device) : statusMonitor(device) {
+  mp3             = &device;
+  length          = 0;
+  nextId          = 1;
+  nextSequence    = 0;
+  stage           = MP3_ANNOUNCER_IDLE;
+  sendingHandle   = 0;
+  sentAt          = 0;
+  background      = -1;
+  sourceInFlight  = 0;
+  played          = 0;
+  preempted       = 0;
+  expired         = 0;
+  failed          = 0;
+  latencyCount    = 0;
+  doneCallback    = expiredCallback = 0;
+  doneContext     = expiredContext  = 0;
+
+  statusMonitor.onStopped(&jq8400Announcer::stoppedEvent, this);
+  statusMonitor.onTrackChanged(&jq8400Announcer::trackEvent, this);
+}
+
+
+int jq8400Announcer::announce(int fileNumber, int priority, int expiresInMs) {
+  if(length >= MP3_ANNOUNCER_CAPACITY || fileNumber < 1 || fileNumber > 0xFFFF) {
+    return 0;
+  }
+
+  Prompt &prompt     = heap[length];
+  prompt.id          = nextId++;
+  prompt.fileNumber  = fileNumber;
+  prompt.priority    = priority;
+  prompt.sequence    = nextSequence++;
+  prompt.expires     = expiresInMs > 0;
+  prompt.expiresAt   = mp3->millis() + expiresInMs;
+  prompt.announcedAt = mp3->micros();
+  prompt.started     = 0;
+  if(nextId <= 0) nextId = 1;
+
+  this->siftUp(length++);
+  return prompt.id;
+}
+
+
+int jq8400Announcer::cancel(int id) {
+  for(int x = 0; x < length; x++) {
+    if(heap[x].id == id) {
+      this->removeAt(x);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+int jq8400Announcer::playing() {
+  return stage != MP3_ANNOUNCER_IDLE ? current.fileNumber : -1;
+}
+
+
+void jq8400Announcer::service() {
+  statusMonitor.service(); // Which may finish the prompt playing
+
+  int now = mp3->millis();
+  if(stage == MP3_ANNOUNCER_STARTING) {
+    if(statusMonitor.index() == current.fileNumber && statusMonitor.status() == MP3_STATUS_PLAYING) {
+      stage = MP3_ANNOUNCER_PLAYING;
+    } else if(now - sentAt > MP3_ANNOUNCER_START_TIMEOUT) {
+      stage = MP3_ANNOUNCER_IDLE; // The module ignores an index it does not have
+      failed++;
+    }
+  }
+
+  // Stale prompts are dropped wherever they are in the queue, so that
+  // waiting() is only what will still be said
+  for(int x = length - 1; x >= 0; x--) {
+    if(heap[x].expires && now - heap[x].expiresAt >= 0) {
+      int fileNumber = heap[x].fileNumber;
+      this->removeAt(x);
+      expired++;
+      if(expiredCallback) {
+        expiredCallback(*mp3, fileNumber, expiredContext);
+      }
+    }
+  }
+
+  if(!length) {
+    return;
+  }
+
+  if(stage == MP3_ANNOUNCER_IDLE) {
+    background = statusMonitor.status() == MP3_STATUS_PLAYING ? statusMonitor.index() : -1;
+    this->playNext();
+  } else if(stage != MP3_ANNOUNCER_SENDING && heap[0].priority > current.priority) {
+    // The module forgets the interrupted prompt and goes back to the
+    // background after the new one, so the old one is queued to be said again.
+    // Not while its MP3_CMD_INSERT_IDX is still in the jq8400's queue, it can
+    // not be taken back and the old one would be heard twice
+    Prompt interrupted = current;
+    if(this->playNext()) {
+      heap[length] = interrupted;
+      this->siftUp(length++);
+      preempted++;
+    }
+  }
+}
+
+
+// Sends the most urgent prompt, returns 0 if it will have to be next time:
+// the jq8400's queue is full, or the source is not known yet and has been
+// asked for (getSource() would wait for it)
+int jq8400Announcer::playNext() {
+  if(mp3->currentSource < 0) {
+    if(!sourceInFlight && mp3->submitFrame(jq8400ConstFrame<jq8400::MP3_CMD_GET_SOURCE>::bytes, 4, sourceBuffer, 1, &jq8400Announcer::sourceArrived, this)) {
+      sourceInFlight = 1;
+    }
+    return 0;
+  }
+
+  uint8_t buf[3] = { (uint8_t)mp3->currentSource, (uint8_t)(heap[0].fileNumber >> 8), (uint8_t)heap[0].fileNumber };
+
+  int handle = mp3->submit(jq8400::MP3_CMD_INSERT_IDX, buf, 3, 0, 0, &jq8400Announcer::sentEvent, this);
+  if(!handle) {
+    return 0;
+  }
+
+  current       = heap[0];
+  stage         = MP3_ANNOUNCER_SENDING;
+  sendingHandle = handle;
+  sentAt        = mp3->millis();
+  this->removeAt(0);
+  mp3->invalidatePlayback(); // The monitor takes this as its cue to look
+  return 1;
+}
+
+
+void jq8400Announcer::finish() {
+  stage = MP3_ANNOUNCER_IDLE;
+  played++;
+  if(doneCallback) {
+    doneCallback(*mp3, current.fileNumber, doneContext);
+  }
+}
+
+
+void jq8400Announcer::sentEvent(jq8400Request *request, void *context) {
+  jq8400Announcer *self = (jq8400Announcer *)context;
+  if(request->handle != self->sendingHandle || self->stage != MP3_ANNOUNCER_SENDING) {
+    return; // A prompt since interrupted
+  }
+
+  self->stage  = MP3_ANNOUNCER_STARTING;
+  self->sentAt = self->mp3->millis();
+  if(!self->current.started) {
+    self->current.started = 1;
+    self->latency[self->latencyCount++ % MP3_ANNOUNCER_SAMPLES] = self->mp3->micros() - self->current.announcedAt;
+  }
+}
+
+
+void jq8400Announcer::sourceArrived(jq8400Request *request, void *context) {
+  jq8400Announcer *self = (jq8400Announcer *)context;
+  self->sourceInFlight = 0;
+  if(request->result == MP3_FRAME_OK && self->mp3->currentSource < 0) {
+    self->mp3->currentSource = self->sourceBuffer[0];
+  }
+}
+
+
+// The end of a prompt shows as the module going back to whatever it was
+// playing before...
+void jq8400Announcer::trackEvent(jq8400 &, int index, void *context) {
+  jq8400Announcer *self = (jq8400Announcer *)context;
+  if(self->stage == MP3_ANNOUNCER_STARTING && index == self->current.fileNumber) {
+    self->stage = MP3_ANNOUNCER_PLAYING;
+  } else if(self->stage == MP3_ANNOUNCER_PLAYING && index != self->current.fileNumber) {
+    self->finish();
+  }
+}
+
+
+// ...or stopping, if it was not playing anything
+void jq8400Announcer::stoppedEvent(jq8400 &, int, void *context) {
+  jq8400Announcer *self = (jq8400Announcer *)context;
+  if(self->stage != MP3_ANNOUNCER_PLAYING) {
+    return;
+  }
+  self->finish();
+
+  // It was, but lost its place, the best that can be done is to start it again
+  if(self->background >= 0) {
+    uint8_t word[2] = { (uint8_t)(self->background >> 8), (uint8_t)self->background };
+    self->mp3->submit(jq8400::MP3_CMD_PLAY_IDX, word, 2);
+    self->mp3->invalidatePlayback();
+    self->background = -1;
+  }
+}
+
+
+// Nearest rank, over a sorted copy of the samples
+int jq8400Announcer::startLatencyUs(int percent) {
+  int n = latencyCount < MP3_ANNOUNCER_SAMPLES ? latencyCount : MP3_ANNOUNCER_SAMPLES;
+  if(!n) {
+    return -1;
+  }
+
+  int sorted[MP3_ANNOUNCER_SAMPLES];
+  for(int x = 0; x < n; x++) {
+    int y = x;
+    for(; y > 0 && sorted[y - 1] > latency[x]; y--) {
+      sorted[y] = sorted[y - 1];
+    }
+    sorted[y] = latency[x];
+  }
+
+  int rank = (percent * n + 99) / 100;
+  if(rank < 1) rank = 1;
+  if(rank > n) rank = n;
+  return sorted[rank - 1];
+}
+
+
+// The queue is a binary heap, the most urgent prompt at the top
+int jq8400Announcer::urgent(const Prompt &a, const Prompt &b) {
+  if(a.priority != b.priority) {
+    return a.priority > b.priority;
+  }
+  return a.sequence - b.sequence < 0;
+}
+
+
+void jq8400Announcer::removeAt(int position) {
+  heap[position] = heap[--length];
+  if(position < length) {
+    this->siftDown(position);
+    this->siftUp(position);
+  }
+}
+
+
+void jq8400Announcer::siftUp(int position) {
+  while(position > 0) {
+    int parent = (position - 1) / 2;
+    if(!this->urgent(heap[position], heap[parent])) {
+      return;
+    }
+    Prompt t         = heap[parent];
+    heap[parent]     = heap[position];
+    heap[position]   = t;
+    position         = parent;
+  }
+}
+
+
+void jq8400Announcer::siftDown(int position) {
+  while(1) {
+    int child = 2 * position + 1;
+    if(child >= length) {
+      return;
+    }
+    if(child + 1 < length && this->urgent(heap[child + 1], heap[child])) {
+      child++;
+    }
+    if(!this->urgent(heap[child], heap[position])) {
+      return;
+    }
+    Prompt t         = heap[child];
+    heap[child]      = heap[position];
+    heap[position]   = t;
+    position         = child;
+  }
+}
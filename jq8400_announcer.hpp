@@ -0,0 +1,147 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#ifndef jq8400_announcer_h
+#define jq8400_announcer_h
+
+#include "jq8400_monitor.hpp"
+
+    #define MP3_ANNOUNCER_CAPACITY      16      // Prompts waiting to be played
+    #define MP3_ANNOUNCER_START_TIMEOUT 2000    // ms for a prompt to be seen playing before it is given up on
+    #define MP3_ANNOUNCER_SAMPLES       64      // Start latencies kept for the percentiles
+
+    /** Plays voice prompts over background audio, most urgent first.
+     *
+     *  Each prompt is an MP3_CMD_INSERT_IDX, so the module pauses whatever is
+     *  playing, plays the prompt, and goes back to where it was by itself.
+     *  What this adds is the queueing:
+     *
+     *   - A higher priority prompt interrupts a lower one, which is played
+     *     again from the start afterwards (so long as it has not expired).
+     *   - Prompts of the same priority are played in the order announced.
+     *   - A prompt not started by its deadline is dropped.
+     *
+     *  The end of each prompt is seen through a jq8400StatusMonitor, the next
+     *  is sent as soon as it is, nothing here waits.  The insert names the
+     *  source, so if the jq8400 does not know it the prompts are held while
+     *  it is asked for.
+     *
+     *      jq8400Announcer announcer(mp3);
+     *      announcer.announce(DOOR_OPEN, 1, 5000);     // Say it within 5s or not at all
+     *      announcer.announce(FIRE_ALARM, 9);          // Now, whatever else is going on
+     *      while(1) { announcer.service(); ... }
+     *
+     *  Call service() instead of jq8400StatusMonitor::service() or
+     *  jq8400::poll().  The stopped and track changed callbacks of monitor()
+     *  are the announcer's, the others are free.  Don't use it together with
+     *  a jq8400Playlist, they would both be watching the same module.
+     */
+    class jq8400Announcer
+    {
+    public:
+        jq8400Announcer(jq8400 &device);
+
+        /** Queues fileNumber to be played.
+         *
+         *  @param priority   Higher is more urgent, only a higher one interrupts
+         *  @param expiresInMs Dropped if not started by then, 0 for never
+         *  @return An id for cancel(), 0 if the queue is full
+         */
+        int     announce(int fileNumber, int priority = 0, int expiresInMs = 0);
+        int     cancel(int id);                             ///< Returns 0 if it is not waiting (eg already playing)
+        void    service();
+
+        void    onDone(jq8400EventCallback callback, void *context)     { doneCallback    = callback; doneContext    = context; }
+        void    onExpired(jq8400EventCallback callback, void *context)  { expiredCallback = callback; expiredContext = context; }
+
+        int     waiting()           { return length; }
+        int     playing();                                  ///< File number of the prompt, -1 if none
+
+        int     promptsPlayed()     { return played; }
+        int     promptsPreempted()  { return preempted; }
+        int     promptsExpired()    { return expired; }
+        int     promptsFailed()     { return failed; }      ///< Never seen playing (eg no such file)
+
+        /** Time from announce() until the module was sent the prompt, in
+         *  microseconds, over the last MP3_ANNOUNCER_SAMPLES prompts.
+         *
+         *  @param percent 50 for the median, 100 for the worst
+         *  @return -1 until a prompt has started
+         */
+        int     startLatencyUs(int percent);
+        jq8400StatusMonitor &monitor() { return statusMonitor; }
+
+    protected:
+        struct Prompt {
+          int   id;
+          int   fileNumber;
+          int   priority;
+          int   sequence;           ///< Order announced, first come first served within a priority
+          int   expiresAt;          ///< millis()
+          int   expires;
+          int   announcedAt;        ///< micros()
+          int   started;            ///< Latency already recorded, it has been preempted
+        };
+
+        static void sentEvent(jq8400Request *request, void *context);
+        static void sourceArrived(jq8400Request *request, void *context);
+        static void stoppedEvent(jq8400 &device, int index, void *context);
+        static void trackEvent(jq8400 &device, int index, void *context);
+
+        int     playNext();
+        void    finish();
+        int     urgent(const Prompt &a, const Prompt &b);
+        void    removeAt(int position);
+        void    siftUp(int position);
+        void    siftDown(int position);
+
+        jq8400             *mp3;
+        jq8400StatusMonitor statusMonitor;
+
+        Prompt      heap[MP3_ANNOUNCER_CAPACITY];
+        int         length;
+        int         nextId;
+        int         nextSequence;
+
+        Prompt      current;
+        int         stage;              ///< MP3_ANNOUNCER_IDLE etc, in the .cpp
+        int         sendingHandle;      ///< Of the MP3_CMD_INSERT_IDX in the queue
+        int         sentAt;             ///< millis()
+        int         background;         ///< Index playing before the prompts began, -1 if none
+        uint8_t     sourceBuffer[1];
+        int         sourceInFlight;     ///< An MP3_CMD_GET_SOURCE is in the queue
+
+        int         played, preempted, expired, failed;
+        int         latency[MP3_ANNOUNCER_SAMPLES];
+        int         latencyCount;
+
+        jq8400EventCallback doneCallback, expiredCallback;
+        void               *doneContext, *expiredContext;
+    };
+
+#endif //jq8400_announcer_h
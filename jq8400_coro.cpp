@@ -0,0 +1,377 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#include "jq8400_coro.hpp"
+
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+
+#include <new>
+
+union jq8400FrameBlock {
+  jq8400FrameBlock *next;
+  alignas(std::max_align_t) unsigned char bytes[MP3_CORO_FRAME_SIZE];
+};
+
+static jq8400FrameBlock  frameBlocks[MP3_CORO_FRAMES];
+static jq8400FrameBlock *freeBlocks      = 0;
+static int               blocksCarved    = 0;   // The pool is threaded onto the free list as it is first needed
+static int               blocksInUse     = 0;
+static int               blocksHighWater = 0;
+static int               heapFrames      = 0;
+static int               frameRequests   = 0;
+
+
+void *jq8400FramePool::allocate(std::size_t size) {
+  frameRequests++;
+  if(size <= sizeof(jq8400FrameBlock)) {
+    jq8400FrameBlock *block = freeBlocks;
+    if(block) {
+      freeBlocks = block->next;
+    } else if(blocksCarved < MP3_CORO_FRAMES) {
+      block = &frameBlocks[blocksCarved++];
+    }
+
+    if(block) {
+      if(++blocksInUse > blocksHighWater) {
+        blocksHighWater = blocksInUse;
+      }
+      return block;
+    }
+  }
+
+  heapFrames++;
+#if MP3_NO_HEAP
+  return nullptr;
+#else
+  return ::operator new(size);
+#endif
+}
+
+
+void jq8400FramePool::release(void *frame, std::size_t size) {
+  jq8400FrameBlock *block = (jq8400FrameBlock *)frame;
+  if(block >= frameBlocks && block < frameBlocks + MP3_CORO_FRAMES) {
+    block->next = freeBlocks;
+    freeBlocks  = block;
+    blocksInUse--;
+    return;
+  }
+  ::operator delete(frame, size);
+}
+
+
+int jq8400FramePool::inUse()       { return blocksInUse; }
+int jq8400FramePool::highWater()   { return blocksHighWater; }
+int jq8400FramePool::fromHeap()    { return heapFrames; }
+int jq8400FramePool::allocations() { return frameRequests; }
+
+
+jq8400Executor::jq8400Executor() {
+  scriptCount  = 0;
+  totalResumes = 0;
+  readyHead    = readyTail    = 0;
+  blockedHead  = blockedTail  = 0;
+  sleepingHead = sleepingTail = 0;
+  devices      = 0;
+}
+
+
+int jq8400Executor::spawn(jq8400Task<> &&script) {
+  if(scriptCount >= MP3_CORO_SCRIPTS || !script.coroutine) {
+    return 0;
+  }
+
+  scripts[scriptCount++] = script.coroutine;
+  script.coroutine = nullptr;
+  return 1;
+}
+
+
+void jq8400Executor::append(jq8400Wait *&head, jq8400Wait *&tail, jq8400Wait *wait) {
+  wait->next = 0;
+  if(tail) {
+    tail->next = wait;
+  } else {
+    head = wait;
+  }
+  tail = wait;
+}
+
+
+void jq8400Executor::ready(jq8400Wait *wait) {
+  this->append(readyHead, readyTail, wait);
+}
+
+
+int jq8400Executor::run() {
+  // Commands which found their module's queue full try again, in order
+  jq8400Wait *wait = blockedHead;
+  blockedHead = blockedTail = 0;
+  while(wait) {
+    jq8400Wait *next = wait->next;
+    jq8400Async::Exchange *exchange = static_cast<jq8400Async::Exchange *>(wait); // Only exchanges block
+    if(!exchange->submit()) {
+      this->blocked(exchange);
+    }
+    wait = next;
+  }
+
+  // Responses arriving make their scripts ready, through Exchange::completed()
+  for(jq8400Async *device = devices; device; device = device->nextDevice) {
+    device->mp3->poll();
+  }
+
+  jq8400Wait **link = &sleepingHead;
+  sleepingTail = 0;
+  while((wait = *link)) {
+    jq8400Async::Sleep *sleep = static_cast<jq8400Async::Sleep *>(wait);
+    if(sleep->await_ready()) {
+      *link = wait->next;
+      this->ready(wait);
+    } else {
+      sleepingTail = wait;
+      link = &wait->next;
+    }
+  }
+
+  // New scripts run to their first wait, they were never suspended on anything
+  for(int x = 0; x < scriptCount; x++) {
+    if(!scripts[x].promise().continuation) {
+      scripts[x].promise().continuation = std::noop_coroutine();
+      totalResumes++;
+      scripts[x].resume();
+    }
+  }
+
+  while(readyHead) {
+    wait      = readyHead;
+    readyHead = wait->next;
+    if(!readyHead) {
+      readyTail = 0;
+    }
+    totalResumes++;
+    wait->script.resume();
+  }
+
+  for(int x = 0; x < scriptCount; ) {
+    if(scripts[x].done()) {
+      scripts[x].destroy();
+      scripts[x] = scripts[--scriptCount];
+    } else {
+      x++;
+    }
+  }
+  return scriptCount;
+}
+
+
+jq8400Async::jq8400Async(jq8400 &device, jq8400Executor &runner) {
+  mp3        = &device;
+  executor   = &runner;
+  nextDevice = runner.devices;
+  runner.devices = this;
+}
+
+
+// Remembered now, as the jq8400's own methods would, not when it is sent.  One
+// which does not fit in an Exchange is never sent, cut short it would be a
+// different command, it co_awaits to -1 straight away.
+jq8400Async::Exchange jq8400Async::command(int command, const uint8_t *data, int length, int responseLength) {
+  Exchange exchange;
+  exchange.device         = this;
+  exchange.command        = command;
+  exchange.length         = length;
+  exchange.responseLength = responseLength;
+  exchange.result         = MP3_FRAME_INCOMPLETE;
+  if(length < 0 || length > MP3_CORO_DATA_LENGTH || responseLength < 0 || responseLength > MP3_CORO_DATA_LENGTH) {
+    exchange.length         = -1; // Refused, see await_ready()
+    exchange.responseLength = 0;
+    exchange.result         = MP3_FRAME_TIMEOUT; // As sendCommandData() says of data which will not fit
+    return exchange;
+  }
+  if(exchange.length) {
+    memcpy(exchange.data, data, exchange.length);
+  }
+
+  mp3->remember(command, exchange.data, exchange.length, exchange.responseLength);
+  return exchange;
+}
+
+
+void jq8400Async::Exchange::await_suspend(std::coroutine_handle<> awaiting) {
+  script = awaiting;
+  if(!this->submit()) {
+    device->executor->blocked(this);
+  }
+}
+
+
+int jq8400Async::Exchange::submit() {
+  return device->mp3->submit(command, data, length, responseLength ? response : 0, responseLength, &Exchange::completed, this);
+}
+
+
+void jq8400Async::Exchange::completed(jq8400Request *request, void *context) {
+  Exchange *self       = (Exchange *)context;
+  self->result         = request->result;
+  self->responseLength = request->result == MP3_FRAME_OK ? request->responseLength : 0;
+  self->device->executor->ready(self);
+}
+
+
+int jq8400Async::Exchange::await_resume() {
+  device->mp3->lastFrameResult = result;
+  if(result != MP3_FRAME_OK) {
+    return -1;
+  }
+
+  int value = 0;
+  for(int x = 0; x < responseLength; x++) {
+    value = (value << 8) | response[x];
+  }
+  return value;
+}
+
+
+jq8400Async::Exchange jq8400Async::playFileByIndexNumber(int fileNumber) {
+  uint8_t word[2] = { (uint8_t)(fileNumber >> 8), (uint8_t)fileNumber };
+  return this->command(jq8400::MP3_CMD_PLAY_IDX, word, 2);
+}
+
+
+jq8400Async::Exchange jq8400Async::seekFileByIndexNumber(int fileNumber) {
+  uint8_t word[2] = { (uint8_t)(fileNumber >> 8), (uint8_t)fileNumber };
+  return this->command(jq8400::MP3_CMD_SEEK_IDX, word, 2);
+}
+
+
+jq8400Async::Exchange jq8400Async::setVolume(int volumeFrom0To30) {
+  uint8_t b = volumeFrom0To30;
+  return this->command(jq8400::MP3_CMD_VOL_SET, &b, 1);
+}
+
+
+jq8400Async::Exchange jq8400Async::setEqualizer(int equalizerMode) {
+  uint8_t b = equalizerMode;
+  return this->command(jq8400::MP3_CMD_EQ_SET, &b, 1);
+}
+
+
+jq8400Async::Exchange jq8400Async::setLoopMode(int loopMode) {
+  uint8_t b = loopMode;
+  return this->command(jq8400::MP3_CMD_LOOP_SET, &b, 1);
+}
+
+
+jq8400Async::Exchange jq8400Async::setSource(int source) {
+  uint8_t b = source;
+  return this->command(jq8400::MP3_CMD_SOURCE_SET, &b, 1);
+}
+
+
+// As jq8400::getStatus()
+jq8400Task<int> jq8400Async::getStatus() {
+  if(mp3->currentStatus >= 0 && mp3->fresh(mp3->statusReadAt, MP3_PLAYBACK_CACHE_MS)) {
+    mp3->cacheHits++;
+    co_return mp3->currentStatus;
+  }
+
+  mp3->cacheMisses++;
+
+  int stat   = -1;
+  int agreed = 0;
+  for(int reads = 0; reads < MP3_STATUS_MAX_READS && agreed < MP3_STATUS_CHECKS_IN_AGREEMENT; reads++) {
+    int reading = co_await this->command(jq8400::MP3_CMD_STATUS, 0, 0, 1);
+    if(mp3->lastFrameResult != MP3_FRAME_OK) {
+      co_return -1;
+    }
+    if(reading == MP3_STATUS_STOPPED) {
+      stat = reading;
+      break;
+    }
+    agreed = (reading == stat) ? agreed + 1 : 1;
+    stat   = reading;
+  }
+
+  mp3->currentStatus = stat;
+  mp3->statusReadAt  = mp3->millis();
+  co_return stat;
+}
+
+
+jq8400Task<int> jq8400Async::countFiles() {
+  if(mp3->fileCount >= 0) {
+    mp3->cacheHits++;
+    co_return mp3->fileCount;
+  }
+
+  mp3->cacheMisses++;
+  int count = co_await this->command(jq8400::MP3_CMD_COUNT_FILES, 0, 0, 2);
+  if(mp3->lastFrameResult == MP3_FRAME_OK) {
+    mp3->fileCount = count;
+  }
+  co_return count;
+}
+
+
+jq8400Task<int> jq8400Async::currentFileIndexNumber() {
+  if(mp3->currentIndex >= 0 && mp3->fresh(mp3->indexReadAt, MP3_PLAYBACK_CACHE_MS)) {
+    mp3->cacheHits++;
+    co_return mp3->currentIndex;
+  }
+
+  mp3->cacheMisses++;
+  int index = co_await this->command(jq8400::MP3_CMD_CURRENT_FILE_IDX, 0, 0, 2);
+  if(mp3->lastFrameResult == MP3_FRAME_OK) {
+    mp3->currentIndex = index;
+    mp3->indexReadAt  = mp3->millis();
+  }
+  co_return index;
+}
+
+
+jq8400Task<int> jq8400Async::currentFileLengthInSeconds() {
+  int hms = co_await this->command(jq8400::MP3_CMD_CURRENT_FILE_LEN, 0, 0, 3);
+  co_return hms < 0 ? -1 : ((hms >> 16) * 60 * 60) + (((hms >> 8) & 0xFF) * 60) + (hms & 0xFF);
+}
+
+
+jq8400Task<int> jq8400Async::untilStopped(int timeoutMs) {
+  int started = mp3->millis();
+  while(1) {
+    if(co_await this->getStatus() == MP3_STATUS_STOPPED) {
+      co_return 1;
+    }
+    if(timeoutMs && mp3->millis() - started >= timeoutMs) {
+      co_return 0;
+    }
+    co_await this->sleep(MP3_CORO_STATUS_POLL_MS);
+  }
+}
+
+#endif // C++20 coroutines
@@ -0,0 +1,278 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#ifndef jq8400_coro_h
+#define jq8400_coro_h
+
+#include "jq8400.hpp"
+
+// Only for compilers with C++20 coroutines, to everything else this is empty
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+
+#include <coroutine>
+#include <cstddef>
+
+    #define MP3_CORO_SCRIPTS        8       // Scripts an executor runs at once
+    #define MP3_CORO_FRAMES         (3 * MP3_CORO_SCRIPTS) // Coroutine frames in the pool, a script and two methods deep, eg getStatus() in untilStopped()
+    #define MP3_CORO_FRAME_SIZE     320     // Bytes in each, bigger frames come from the heap (or fail, with MP3_NO_HEAP)
+    #define MP3_CORO_DATA_LENGTH    4       // Data bytes each way in an Exchange, every number fits, a file name does not
+    #define MP3_CORO_STATUS_POLL_MS MP3_PLAYBACK_CACHE_MS // How often untilStopped() asks
+
+    class jq8400Executor;
+    class jq8400Async;
+
+    /** Where the frames of jq8400Task coroutines come from, shared by every
+     *  executor (they are all on the one thread).
+     */
+    struct jq8400FramePool
+    {
+        static void *allocate(std::size_t size);
+        static void  release(void *frame, std::size_t size);
+
+        static int   inUse();
+        static int   highWater();
+        static int   allocations(); ///< Frames asked for, from the pool or not
+        static int   fromHeap();    ///< Frames too big for the pool, or when it ran out (refused with MP3_NO_HEAP)
+    };
+
+    struct jq8400PromiseBase
+    {
+#if MP3_NO_HEAP
+        static void *operator new(std::size_t size) noexcept      { return jq8400FramePool::allocate(size); }
+#else
+        static void *operator new(std::size_t size)               { return jq8400FramePool::allocate(size); }
+#endif
+        static void  operator delete(void *frame, std::size_t size) { jq8400FramePool::release(frame, size); }
+
+        // Started when first awaited (or by the executor), and on finishing
+        // carries straight on with whoever awaited it
+        struct Finish {
+            bool    await_ready() noexcept  { return false; }
+            template<typename Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> self) noexcept {
+              std::coroutine_handle<> next = self.promise().continuation;
+              return next ? next : std::noop_coroutine();
+            }
+            void    await_resume() noexcept { }
+        };
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        Finish  final_suspend() noexcept    { return {}; }
+        void    unhandled_exception()       { }     // Built without exceptions on the targets
+
+        std::coroutine_handle<> continuation;
+    };
+
+    /** A coroutine which can co_await the jq8400Async methods and co_return a
+     *  T (or nothing), and is itself awaited, or given to a jq8400Executor.
+     *
+     *  With MP3_NO_HEAP a task whose frame could not be had from the pool
+     *  never runs, awaited it is -1 (as a failed query) and spawn() refuses it.
+     */
+    template<typename T = void>
+    class jq8400Task
+    {
+    public:
+        struct promise_type : jq8400PromiseBase {
+            T       value{};
+            jq8400Task get_return_object()  { return jq8400Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+            void    return_value(T v)       { value = v; }
+#if MP3_NO_HEAP
+            static jq8400Task get_return_object_on_allocation_failure() { return jq8400Task(nullptr); }
+#endif
+        };
+
+        jq8400Task(jq8400Task &&other) : coroutine(other.coroutine) { other.coroutine = nullptr; }
+        ~jq8400Task()                       { if(coroutine) coroutine.destroy(); }
+
+        bool    await_ready()               { return !coroutine; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) {
+          coroutine.promise().continuation = awaiting;
+          return coroutine;
+        }
+        T       await_resume()              { return coroutine ? coroutine.promise().value : T(-1); }
+
+    protected:
+        friend class jq8400Executor;
+        explicit jq8400Task(std::coroutine_handle<promise_type> h) : coroutine(h) { }
+
+        std::coroutine_handle<promise_type> coroutine;
+    };
+
+    template<>
+    struct jq8400Task<void>::promise_type : jq8400PromiseBase {
+        jq8400Task get_return_object()      { return jq8400Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        void    return_void()               { }
+#if MP3_NO_HEAP
+        static jq8400Task get_return_object_on_allocation_failure() { return jq8400Task(nullptr); }
+#endif
+    };
+
+    template<>
+    inline void jq8400Task<void>::await_resume() { }
+
+    /** Something a script is suspended on until the executor resumes it, kept
+     *  in the script's own frame and linked into the executor's lists.
+     */
+    struct jq8400Wait
+    {
+        std::coroutine_handle<> script;
+        jq8400Wait *next = nullptr;
+    };
+
+    /** Runs scripts on one thread, many at once and on any number of modules.
+     *
+     *  A script runs until it waits for the module (or a sleep) and then the
+     *  next one gets a turn, run() polls every module and resumes the scripts
+     *  whose wait is over.
+     *
+     *      jq8400Executor executor;
+     *      jq8400Async    mp3(module, executor);
+     *
+     *      jq8400Task<> announce(jq8400Async &mp3) {
+     *        co_await mp3.setSource(MP3_SRC_SDCARD);
+     *        if(co_await mp3.countFiles() < 3) co_return;
+     *        co_await mp3.setVolume(25);
+     *        co_await mp3.playFileByIndexNumber(3);
+     *        co_await mp3.untilStopped();
+     *      }
+     *
+     *      executor.spawn(announce(mp3));
+     *      while(1) { executor.run(); ... }
+     *
+     *  The frames of scripts, and of the methods they wait in, come from a
+     *  pool of MP3_CORO_FRAMES (see jq8400FramePool), not the heap.
+     */
+    class jq8400Executor
+    {
+    public:
+        jq8400Executor();
+
+        int     spawn(jq8400Task<> &&script);   ///< 0 if MP3_CORO_SCRIPTS are already running
+        int     run();                          ///< Returns the scripts still running
+        int     running()           { return scriptCount; }
+        int     resumes()           { return totalResumes; }
+
+    protected:
+        friend class jq8400Async;
+
+        void    ready(jq8400Wait *wait);
+        void    blocked(jq8400Wait *wait)   { this->append(blockedHead, blockedTail, wait); }
+        void    sleeping(jq8400Wait *wait)  { this->append(sleepingHead, sleepingTail, wait); }
+        void    append(jq8400Wait *&head, jq8400Wait *&tail, jq8400Wait *wait);
+
+        std::coroutine_handle<jq8400Task<>::promise_type> scripts[MP3_CORO_SCRIPTS];
+        int         scriptCount;
+        int         totalResumes;
+
+        jq8400Wait *readyHead,    *readyTail;
+        jq8400Wait *blockedHead,  *blockedTail;     ///< Waiting for room in their module's queue
+        jq8400Wait *sleepingHead, *sleepingTail;
+        jq8400Async *devices;
+    };
+
+    /** A jq8400 whose methods are awaited rather than waited for.
+     *
+     *  Commands complete once sent and queries once answered, a query
+     *  co_awaits to what the jq8400 method of the same name would return
+     *  (-1 on failure, lastResult() says why).  What the jq8400 remembers of
+     *  volume, status, index and so on is kept the same as its own methods
+     *  keep it, the cached answers are used in the same way, so scripts and
+     *  blocking calls can be mixed.
+     */
+    class jq8400Async
+    {
+    public:
+        jq8400Async(jq8400 &device, jq8400Executor &executor);
+
+        /** One command, or query with a response of responseLength bytes,
+         *  co_awaits to the response as a big endian number (0 if none, -1
+         *  on failure).  It is kept small, a script's frame has room for each
+         *  one it awaits, so more than MP3_CORO_DATA_LENGTH bytes either way
+         *  fails without being sent.
+         */
+        struct Exchange : jq8400Wait {
+            jq8400Async *device;
+            int         command;
+            uint8_t     data[MP3_CORO_DATA_LENGTH];
+            int         length;         ///< -1 if command() refused it
+            uint8_t     response[MP3_CORO_DATA_LENGTH];
+            int         responseLength;
+            int         result;
+
+            bool    await_ready()       { return length < 0; } ///< Refused by command(), it fails without being sent
+            void    await_suspend(std::coroutine_handle<> awaiting);
+            int     await_resume();
+            int     submit();
+            static void completed(jq8400Request *request, void *context);
+        };
+
+        struct Sleep : jq8400Wait {
+            jq8400Async *device;
+            int         until;          ///< millis()
+
+            bool    await_ready()       { return device->mp3->millis() - until >= 0; }
+            void    await_suspend(std::coroutine_handle<> awaiting) { script = awaiting; device->executor->sleeping(this); }
+            void    await_resume()      { }
+        };
+
+        Exchange command(int command, const uint8_t *data = 0, int length = 0, int responseLength = 0);
+        Sleep    sleep(int ms)          { return Sleep{{}, this, mp3->millis() + ms}; }
+
+        Exchange play()                 { return this->command(jq8400::MP3_CMD_PLAY); }
+        Exchange pause()                { return this->command(jq8400::MP3_CMD_PAUSE); }
+        Exchange stop()                 { return this->command(jq8400::MP3_CMD_STOP); }
+        Exchange next()                 { return this->command(jq8400::MP3_CMD_NEXT); }
+        Exchange prev()                 { return this->command(jq8400::MP3_CMD_PREV); }
+        Exchange playFileByIndexNumber(int fileNumber);
+        Exchange seekFileByIndexNumber(int fileNumber);
+        Exchange setVolume(int volumeFrom0To30);
+        Exchange setEqualizer(int equalizerMode);
+        Exchange setLoopMode(int loopMode);
+        Exchange setSource(int source);
+
+        jq8400Task<int> getStatus();
+        jq8400Task<int> countFiles();
+        jq8400Task<int> currentFileIndexNumber();
+        jq8400Task<int> currentFileLengthInSeconds();
+
+        /** Until the module is stopped, 0 if timeoutMs (if not 0) passes first */
+        jq8400Task<int> untilStopped(int timeoutMs = 0);
+
+        jq8400 &module()                { return *mp3; }
+
+    protected:
+        friend class jq8400Executor;
+
+        jq8400         *mp3;
+        jq8400Executor *executor;
+        jq8400Async    *nextDevice;
+    };
+
+#endif // C++20 coroutines
+#endif //jq8400_coro_h
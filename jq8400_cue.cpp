@@ -0,0 +1,504 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+
+#include "jq8400_cue.hpp"
+
+static const int lateLimits[MP3_CUE_LATE_BUCKETS - 1] = { 0, 1, 2, 5, 10, 20, 50 };
+
+
+jq8400Timeline::jq8400Timeline(jq8400 &device) : volumeFader(device) {
+  mp3      = &device;
+  origin   = device.millis();
+  tick     = 0;
+  sequence = 0;
+  for(int x = 0; x < MP3_CUE_CAPACITY; x++) {
+    cues[x].generation = 0;
+    cues[x].where      = MP3_CUE_FREE;
+  }
+  this->clear();
+  this->openStream(origin);
+  this->resetLateness();
+}
+
+
+void jq8400Timeline::clear() {
+  for(int x = 0; x < MP3_CUE_WHEEL_LEVELS * MP3_CUE_SLOTS; x++) {
+    slots[x] = MP3_CUE_NONE;
+  }
+  dueHead  = MP3_CUE_NONE;
+  freeHead = MP3_CUE_NONE;
+  for(int x = MP3_CUE_CAPACITY - 1; x >= 0; x--) {
+    if(cues[x].where != MP3_CUE_FREE) {
+      cues[x].generation++; // Handles to what was waiting are no longer any good
+    }
+    cues[x].where = MP3_CUE_FREE;
+    cues[x].next  = freeHead;
+    freeHead      = x;
+  }
+  count = 0;
+}
+
+
+void jq8400Timeline::resetLateness() {
+  fired   = 0;
+  sends   = 0;
+  lateMax = 0;
+  lateSum = 0;
+  memset(late, 0, sizeof(late));
+}
+
+
+int jq8400Timeline::bucketLimitMs(int bucket) {
+  return bucket >= 0 && bucket < MP3_CUE_LATE_BUCKETS - 1 ? lateLimits[bucket] : -1;
+}
+
+
+int jq8400Timeline::at(int whenMs, int action, int a, int b, int c) {
+  if(freeHead == MP3_CUE_NONE || argumentLength(action) < 0) {
+    return 0;
+  }
+
+  int x    = freeHead;
+  freeHead = cues[x].next;
+
+  int now = mp3->millis();
+  Cue &cue     = cues[x];
+  cue.dueMs    = (uint32_t)((whenMs - now < 0 ? now : whenMs) - origin);
+  cue.sequence = sequence++;
+  cue.action   = action;
+  cue.a        = a;
+  cue.b        = action == MP3_CUE_FADE ? (b / 10 > 0xFFFF ? 0xFFFF : b / 10) : b;
+  cue.c        = c;
+  this->place(x);
+  count++;
+
+  return ((cue.generation & 0x7FFF) << 16) | (x + 1);
+}
+
+
+int jq8400Timeline::cancel(int handle) {
+  int x = (handle & 0xFFFF) - 1;
+  if(handle <= 0 || x >= MP3_CUE_CAPACITY) {
+    return 0;
+  }
+
+  Cue &cue = cues[x];
+  if(cue.where == MP3_CUE_FREE || (cue.generation & 0x7FFF) != (handle >> 16)) {
+    return 0;
+  }
+
+  this->unlink(x);
+  this->release(x);
+  return 1;
+}
+
+
+// Into the level whose slots are as long as it is to go, level 0 slots are a
+// tick each, level 1 slots 64 ticks...
+void jq8400Timeline::place(int x) {
+  uint32_t due  = cues[x].dueMs / MP3_CUE_TICK_MS;
+  int      away = (int)(due - tick);
+  if(away < 0) {
+    due  = tick; // Missed, in the next to be done
+    away = 0;
+  }
+
+  int level = 0;
+  while(level < MP3_CUE_WHEEL_LEVELS - 1 && away >= (1 << (MP3_CUE_WHEEL_BITS * (level + 1)))) {
+    level++;
+  }
+  if(away >= (1 << (MP3_CUE_WHEEL_BITS * MP3_CUE_WHEEL_LEVELS))) {
+    due = tick + (1 << (MP3_CUE_WHEEL_BITS * MP3_CUE_WHEEL_LEVELS)) - 1; // Waits at the top, placed again as it comes down
+  }
+
+  int slot = level * MP3_CUE_SLOTS + ((due >> (MP3_CUE_WHEEL_BITS * level)) & (MP3_CUE_SLOTS - 1));
+  this->link(slots[slot], x, slot);
+}
+
+
+void jq8400Timeline::link(uint16_t &head, int x, int where) {
+  cues[x].where = where;
+  cues[x].prev  = MP3_CUE_NONE;
+  cues[x].next  = head;
+  if(head != MP3_CUE_NONE) {
+    cues[head].prev = x;
+  }
+  head = x;
+}
+
+
+void jq8400Timeline::unlink(int x) {
+  Cue &cue = cues[x];
+  uint16_t &head = cue.where == MP3_CUE_DUE ? dueHead : slots[cue.where];
+  if(cue.prev != MP3_CUE_NONE) {
+    cues[cue.prev].next = cue.next;
+  } else {
+    head = cue.next;
+  }
+  if(cue.next != MP3_CUE_NONE) {
+    cues[cue.next].prev = cue.prev;
+  }
+}
+
+
+void jq8400Timeline::release(int x) {
+  cues[x].generation++;
+  cues[x].where = MP3_CUE_FREE;
+  cues[x].next  = freeHead;
+  freeHead      = x;
+  count--;
+}
+
+
+// The slot of a higher level whose time has come, its cues go down a level (or more)
+void jq8400Timeline::cascade(int level, int slot) {
+  uint16_t &head = slots[level * MP3_CUE_SLOTS + slot];
+  int x = head;
+  head  = MP3_CUE_NONE;
+  while(x != MP3_CUE_NONE) {
+    int next = cues[x].next;
+    this->place(x);
+    x = next;
+  }
+}
+
+
+// The cues of a level 0 slot are due, into the due list by time then the order
+// they were added, which a slot does not keep
+void jq8400Timeline::fire(int slot) {
+  int x = slots[slot];
+  slots[slot] = MP3_CUE_NONE;
+  while(x != MP3_CUE_NONE) {
+    int next = cues[x].next;
+    Cue &cue = cues[x];
+
+    int before = MP3_CUE_NONE;
+    int after  = dueHead;
+    while(after != MP3_CUE_NONE && ((int)(cues[after].dueMs - cue.dueMs) < 0
+          || (cues[after].dueMs == cue.dueMs && (int16_t)(cues[after].sequence - cue.sequence) < 0))) {
+      before = after;
+      after  = cues[after].next;
+    }
+    if(before == MP3_CUE_NONE) {
+      this->link(dueHead, x, MP3_CUE_DUE);
+    } else {
+      cue.where = MP3_CUE_DUE;
+      cue.prev  = before;
+      cue.next  = after;
+      cues[before].next = x;
+      if(after != MP3_CUE_NONE) {
+        cues[after].prev = x;
+      }
+    }
+    x = next;
+  }
+}
+
+
+void jq8400Timeline::service() {
+  mp3->poll();
+
+  uint32_t now = (uint32_t)(mp3->millis() - origin) / MP3_CUE_TICK_MS;
+  if(count == 0) {
+    tick = now + 1; // Nothing to go through
+  }
+  while((int)(tick - now) <= 0) {
+    int slot = tick & (MP3_CUE_SLOTS - 1);
+    if(!slot) {
+      // As each level wraps the next one up has a slot come due
+      for(int level = 1; level < MP3_CUE_WHEEL_LEVELS; level++) {
+        int above = (tick >> (MP3_CUE_WHEEL_BITS * level)) & (MP3_CUE_SLOTS - 1);
+        this->cascade(level, above);
+        if(above) break;
+      }
+    }
+    this->fire(slot);
+    tick++;
+  }
+
+  this->dispatch();
+  volumeFader.service();
+}
+
+
+// The due cues to the jq8400's queue, as long as there is room
+void jq8400Timeline::dispatch() {
+  while(dueHead != MP3_CUE_NONE) {
+    uint8_t burst[MP3_MAX_FRAME_LENGTH];
+    int     length = 0;
+    int     taken  = 0;
+
+    // In pipelined mode as many frames as fit in one request, otherwise one
+    int x = dueHead;
+    while(x != MP3_CUE_NONE) {
+      uint8_t frame[MP3_MAX_FRAME_LENGTH];
+      int     command;
+      int     frameLength = this->encodeAction(cues[x], frame, &command);
+      if(taken && (!mp3->pipelineMode || length + frameLength > MP3_MAX_FRAME_LENGTH)) {
+        break;
+      }
+      memcpy(&burst[length], frame, frameLength);
+      length += frameLength;
+      taken++;
+      x = cues[x].next;
+    }
+
+    if(length && !mp3->queueRoom()) {
+      return; // Queue full, again next time
+    }
+
+    // Recorded before submitting, a volume step is merged using the result
+    x = dueHead;
+    for(int n = 0; n < taken; n++, x = cues[x].next) {
+      Cue &cue = cues[x];
+      if(cue.action == MP3_CUE_FADE) {
+        volumeFader.fadeTo(cue.a, cue.b * 10, cue.c);
+      } else {
+        if(cue.action == MP3_CUE_VOLUME) {
+          volumeFader.cancel();
+        }
+        uint8_t frame[MP3_MAX_FRAME_LENGTH];
+        int     command;
+        this->encodeAction(cue, frame, &command);
+        mp3->remember(command, &frame[3], frame[2], 0);
+      }
+    }
+
+    if(length) {
+      mp3->submitFrame(burst, length); // There is room
+      sends++;
+    }
+
+    int now = mp3->millis() - origin;
+    while(taken--) {
+      x = dueHead;
+      Cue &cue = cues[x];
+
+      int lateMs = (int)(now - cue.dueMs);
+      if(lateMs < 0) lateMs = 0;
+      int bucket = 0;
+      while(bucket < MP3_CUE_LATE_BUCKETS - 1 && lateMs > lateLimits[bucket]) {
+        bucket++;
+      }
+      late[bucket]++;
+      lateSum += lateMs;
+      if(lateMs > lateMax) lateMax = lateMs;
+      fired++;
+
+      this->unlink(x);
+      this->release(x);
+    }
+  }
+}
+
+
+// The frame a cue sends, and its length, 0 for a cue which sends none
+int jq8400Timeline::encodeAction(const Cue &cue, uint8_t *frame, int *command) {
+  uint8_t data[4];
+  int     length = 0;
+
+  switch(cue.action) {
+    case MP3_CUE_PLAY:      *command = jq8400::MP3_CMD_PLAY_IDX;     break;
+    case MP3_CUE_SEEK:      *command = jq8400::MP3_CMD_SEEK_IDX;     break;
+    case MP3_CUE_STOP:      *command = jq8400::MP3_CMD_STOP;         break;
+    case MP3_CUE_PAUSE:     *command = jq8400::MP3_CMD_PAUSE;        break;
+    case MP3_CUE_RESUME:    *command = jq8400::MP3_CMD_PLAY;         break;
+    case MP3_CUE_VOLUME:    *command = jq8400::MP3_CMD_VOL_SET;      break;
+    case MP3_CUE_AB_LOOP:   *command = jq8400::MP3_CMD_AB_PLAY;      break;
+    case MP3_CUE_AB_CLEAR:  *command = jq8400::MP3_CMD_AB_PLAY_STOP; break;
+    case MP3_CUE_EQUALIZER: *command = jq8400::MP3_CMD_EQ_SET;       break;
+    case MP3_CUE_LOOP_MODE: *command = jq8400::MP3_CMD_LOOP_SET;     break;
+    case MP3_CUE_SOURCE:    *command = jq8400::MP3_CMD_SOURCE_SET;   break;
+    default:
+      return 0;
+  }
+
+  switch(cue.action) {
+    case MP3_CUE_PLAY:
+    case MP3_CUE_SEEK:
+      data[length++] = cue.a >> 8; // Big endian on the wire
+      data[length++] = cue.a;
+      break;
+
+    case MP3_CUE_VOLUME:
+    case MP3_CUE_EQUALIZER:
+    case MP3_CUE_LOOP_MODE:
+    case MP3_CUE_SOURCE:
+      data[length++] = cue.a;
+      break;
+
+    case MP3_CUE_AB_LOOP:
+      data[length++] = cue.a / 60;
+      data[length++] = cue.a % 60;
+      data[length++] = cue.b / 60;
+      data[length++] = cue.b % 60;
+      break;
+  }
+
+  return jq8400::encodeFrame(frame, *command, data, length);
+}
+
+
+// Bytes of arguments in the stream, -1 for an action not known
+int jq8400Timeline::argumentLength(int action) {
+  switch(action) {
+    case MP3_CUE_PLAY:
+    case MP3_CUE_SEEK:
+      return 2;
+
+    case MP3_CUE_VOLUME:
+    case MP3_CUE_EQUALIZER:
+    case MP3_CUE_LOOP_MODE:
+    case MP3_CUE_SOURCE:
+      return 1;
+
+    case MP3_CUE_FADE:
+    case MP3_CUE_AB_LOOP:
+      return 4;
+
+    case MP3_CUE_STOP:
+    case MP3_CUE_PAUSE:
+    case MP3_CUE_RESUME:
+    case MP3_CUE_AB_CLEAR:
+      return 0;
+  }
+  return -1;
+}
+
+
+void jq8400Timeline::openStream(int startMs) {
+  streamOpen = 0;
+  streamAt   = startMs;
+}
+
+
+int jq8400Timeline::stream(const unsigned char *bytes, int length) {
+  int used = 0;
+  if(!streamOpen) {
+    if(length < 1) {
+      return 0;
+    }
+    if(bytes[0] != MP3_CUE_VERSION) {
+      return -1;
+    }
+    streamOpen = 1;
+    used       = 1;
+  }
+
+  while(used < length && count < MP3_CUE_CAPACITY) {
+    int i     = used;
+    int delay = 0;
+    int shift = 0;
+    while(i < length && shift < 28) {
+      delay |= (bytes[i] & 0x7F) << shift;
+      shift += 7;
+      if(!(bytes[i++] & 0x80)) break;
+    }
+    if(shift >= 28 && (bytes[i - 1] & 0x80)) {
+      return -1; // No delay is that long, it is not a cue list
+    }
+    if(i >= length || (bytes[i - 1] & 0x80)) {
+      break; // The rest of it is still to come
+    }
+
+    int action    = bytes[i++];
+    int arguments = argumentLength(action);
+    if(arguments < 0) {
+      return -1;
+    }
+    if(i + arguments > length) {
+      break;
+    }
+
+    const unsigned char *arg = &bytes[i];
+    int a = 0, b = 0, c = 0;
+    if(arguments == 1) {
+      a = arg[0];
+    } else if(arguments == 2) {
+      a = (arg[0] << 8) | arg[1];
+    } else if(action == MP3_CUE_FADE) {
+      a = arg[0];
+      b = ((arg[1] << 8) | arg[2]) * 10;
+      c = arg[3];
+    } else if(arguments == 4) {
+      a = (arg[0] << 8) | arg[1];
+      b = (arg[2] << 8) | arg[3];
+    }
+
+    streamAt += delay;
+    this->at(streamAt, action, a, b, c);
+    used = i + arguments;
+  }
+  return used;
+}
+
+
+int jq8400Timeline::encode(unsigned char *out, int outLength, int delayMs, int action, int a, int b, int c) {
+  int arguments = argumentLength(action);
+  if(arguments < 0 || delayMs < 0) {
+    return 0;
+  }
+
+  unsigned char buffer[9];
+  int n = 0;
+  do {
+    buffer[n] = delayMs & 0x7F;
+    delayMs >>= 7;
+    if(delayMs) buffer[n] |= 0x80;
+    n++;
+  } while(delayMs && n < 4);
+  if(delayMs) {
+    return 0; // More than 28 bits
+  }
+
+  buffer[n++] = action;
+  if(arguments == 1) {
+    buffer[n++] = a;
+  } else if(arguments == 2) {
+    buffer[n++] = a >> 8;
+    buffer[n++] = a;
+  } else if(action == MP3_CUE_FADE) {
+    b /= 10;
+    buffer[n++] = a;
+    buffer[n++] = b >> 8;
+    buffer[n++] = b;
+    buffer[n++] = c;
+  } else if(arguments == 4) {
+    buffer[n++] = a >> 8;
+    buffer[n++] = a;
+    buffer[n++] = b >> 8;
+    buffer[n++] = b;
+  }
+
+  if(n > outLength) {
+    return 0;
+  }
+  memcpy(out, buffer, n);
+  return n;
+}
@@ -0,0 +1,173 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+
+#ifndef jq8400_cue_h
+#define jq8400_cue_h
+
+#include "jq8400_fade.hpp"
+
+    #define MP3_CUE_CAPACITY        128     // Cues waiting at once, a longer list is streamed in as they fire
+    #define MP3_CUE_TICK_MS         10      // Resolution of the wheel, cues in the same tick go out together
+    #define MP3_CUE_WHEEL_BITS      6       // 64 slots a level,
+    #define MP3_CUE_WHEEL_LEVELS    4       //  four levels of them cover 64^4 ticks (46 hours), later cues wait at the top
+    #define MP3_CUE_SLOTS           (1 << MP3_CUE_WHEEL_BITS)
+    #define MP3_CUE_VERSION         1       // First byte of a cue stream
+    #define MP3_CUE_LATE_BUCKETS    8       // Lateness buckets, up to 0, 1, 2, 5, 10, 20, 50 ms and over
+
+    #define MP3_CUE_PLAY            1       // Index a
+    #define MP3_CUE_SEEK            2       // Index a, without playing
+    #define MP3_CUE_STOP            3
+    #define MP3_CUE_PAUSE           4
+    #define MP3_CUE_RESUME          5
+    #define MP3_CUE_VOLUME          6       // To a, any fade is cancelled
+    #define MP3_CUE_FADE            7       // To volume a over b ms (to 655350) on curve c, see jq8400Fader
+    #define MP3_CUE_AB_LOOP         8       // Between a and b seconds into the track, as abLoopPlay()
+    #define MP3_CUE_AB_CLEAR        9
+    #define MP3_CUE_EQUALIZER       10      // a
+    #define MP3_CUE_LOOP_MODE       11      // a
+    #define MP3_CUE_SOURCE          12      // a
+
+    /** Plays a list of timed actions (cues) without blocking, hundreds of them.
+     *
+     *      jq8400Timeline show(mp3);
+     *      int t = mp3.millis();
+     *      show.at(t,         MP3_CUE_PLAY, 3);
+     *      show.at(t + 5000,  MP3_CUE_FADE, 10, 2000, MP3_FADE_SCURVE);
+     *      show.at(t + 8000,  MP3_CUE_AB_LOOP, 20, 35);
+     *      show.at(t + 60000, MP3_CUE_STOP);
+     *      while(1) { show.service(); ... }
+     *
+     *  Cues wait in a hierarchical timer wheel, so adding or cancelling one
+     *  takes the same time however many there are, and service() only looks
+     *  at the slots whose time has come.  Cues which come due in the same
+     *  MP3_CUE_TICK_MS go to the jq8400's queue together, in the order they
+     *  were added.  In pipelined mode (jq8400::setPipelined()) they are one
+     *  request, their frames back to back in a single write.
+     *
+     *  How late each cue was given to the jq8400 is kept, see lateness().
+     *  Volume fades are run by the timeline's own jq8400Fader.
+     *
+     *  A list can be loaded from a stream of bytes, which need not all be at
+     *  hand at once (see stream()), each cue as
+     *
+     *    [DELAY] [ACTION] [ARGUMENTS]
+     *
+     *  The delay is in ms after the cue before (or the start) in 7 bit
+     *  groups, least significant first, the top bit set on all but the
+     *  last.  The arguments are big endian, their length by action: 2 bytes
+     *  for PLAY and SEEK (a), 1 for VOLUME, EQUALIZER, LOOP_MODE and SOURCE
+     *  (a), 4 for FADE (a, b / 10 in 2 bytes, c) and AB_LOOP (a and b in 2
+     *  bytes each), none for the rest.
+     */
+    class jq8400Timeline
+    {
+    public:
+        jq8400Timeline(jq8400 &device);
+
+        /** A cue at millis() whenMs (now if that has passed), returns a handle
+         *  for cancel() or 0 if MP3_CUE_CAPACITY are already waiting.
+         */
+        int     at(int whenMs, int action, int a = 0, int b = 0, int c = 0);
+        int     after(int delayMs, int action, int a = 0, int b = 0, int c = 0) { return this->at(mp3->millis() + delayMs, action, a, b, c); }
+        int     cancel(int handle);             ///< 1 if it was waiting, 0 if it had fired (or never was)
+        void    clear();
+        void    service();
+
+        int     waiting()           { return count; }
+        int     room()              { return MP3_CUE_CAPACITY - count; }
+        jq8400Fader &fader()        { return volumeFader; }
+
+        /** Loading a list, from startMs.  Give stream() the bytes as they come,
+         *  it returns how many it used (whole cues only, and no more than
+         *  there is room for), the rest are to be given again later.  -1 if
+         *  the version or an action is not known, or a delay runs past 28 bits.
+         */
+        void    openStream(int startMs);
+        int     stream(const unsigned char *bytes, int length);
+
+        /** One cue in the stream format, returns its length, 0 if it will not
+         *  fit (it is at most 9 bytes).
+         */
+        static int encode(unsigned char *out, int outLength, int delayMs, int action, int a = 0, int b = 0, int c = 0);
+
+        int     dispatched()        { return fired; }
+        int     bursts()            { return sends; }   ///< Requests they went in, fewer than cues when merged
+        int     lateness(int bucket) { return bucket >= 0 && bucket < MP3_CUE_LATE_BUCKETS ? late[bucket] : 0; }
+        int     latenessMaxMs()     { return lateMax; }
+        int     latenessMeanUs()    { return fired ? (int)(lateSum * 1000 / fired) : 0; }
+        void    resetLateness();
+        static int bucketLimitMs(int bucket);   ///< Upper limit of a lateness bucket, -1 for the last
+
+    protected:
+        static const int MP3_CUE_NONE = 0xFFFF;
+        static const int MP3_CUE_DUE  = MP3_CUE_SLOTS * MP3_CUE_WHEEL_LEVELS; ///< Where a fired cue waits to be sent
+        static const int MP3_CUE_FREE = MP3_CUE_DUE + 1;
+
+        struct Cue {
+            uint32_t    dueMs;          ///< From origin
+            uint16_t    next, prev;     ///< In its slot (or the due or free list)
+            uint16_t    where;          ///< Slot, MP3_CUE_DUE or MP3_CUE_FREE
+            uint16_t    generation;     ///< So that a stale handle cancels nothing
+            uint16_t    sequence;       ///< Order added, for cues due together
+            uint8_t     action;
+            uint8_t     c;
+            uint16_t    a, b;
+        };
+
+        void    place(int cue);
+        void    link(uint16_t &head, int cue, int where);
+        void    unlink(int cue);
+        void    release(int cue);
+        void    cascade(int level, int slot);
+        void    fire(int slot);
+        void    dispatch();
+        int     encodeAction(const Cue &cue, uint8_t *frame, int *command);
+        static int argumentLength(int action);
+
+        jq8400     *mp3;
+        jq8400Fader volumeFader;
+        Cue         cues[MP3_CUE_CAPACITY];
+        uint16_t    slots[MP3_CUE_WHEEL_LEVELS * MP3_CUE_SLOTS]; ///< Heads of the lists
+        uint16_t    dueHead;            ///< Fired and waiting to go to the queue, in order
+        uint16_t    freeHead;
+        int         count;
+        uint16_t    sequence;
+        int         origin;             ///< millis() of tick 0
+        uint32_t    tick;               ///< The next to be done
+
+        int         streamOpen;         ///< The version byte has been seen
+        int         streamAt;           ///< millis() of the last cue streamed
+
+        int         fired, sends;
+        int         late[MP3_CUE_LATE_BUCKETS];
+        int         lateMax;
+        long long   lateSum;            ///< ms
+    };
+
+#endif //jq8400_cue_h
@@ -0,0 +1,640 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#include "jq8400.hpp"
+#include "jq8400_emulator.hpp"
+
+#define MP3_EMU_BEGIN       0
+#define MP3_EMU_COMMAND     1
+#define MP3_EMU_LENGTH      2
+#define MP3_EMU_DATA        3
+#define MP3_EMU_CHECKSUM    4
+
+jq8400Emulator::jq8400Emulator() {
+  memset(files, 0, sizeof(files));
+  fileCount        = 0;
+  sourcesPresent   = 0;
+
+  currentSource    = MP3_SRC_SDCARD;
+  currentFile      = -1;
+  playStatus       = MP3_STATUS_STOPPED;
+  positionUs       = 0;
+  currentVolume    = 20;
+  currentEq        = MP3_EQ_NORMAL;
+  currentLoop      = MP3_LOOP_NONE;
+  reportPosition   = 0;
+  reportedSecond   = -1;
+  abStart          = -1;
+  abEnd            = -1;
+  memset(&interrupted, 0, sizeof(interrupted));
+  playlistLength   = 0;
+  playlistPosition = 0;
+
+  clock            = 0;
+  readyAt          = 0;
+  byteTime         = 10000000 / 9600;
+  latency          = 2000;
+  dropRate         = 0;
+  corruptRate      = 0;
+  random           = 1;
+
+  toModuleHead     = toModuleTail = 0;
+  toHostHead       = toHostTail   = 0;
+  hostLineFree     = 0;
+  moduleLineFree   = 0;
+
+  rxState          = MP3_EMU_BEGIN;
+  rxLastAt         = 0;
+  goodFrames       = 0;
+  badFrames        = 0;
+  droppedBytes     = 0;
+}
+
+
+int jq8400Emulator::addFile(int source, int folder, const char *name, int lengthInSeconds) {
+  if(fileCount >= MP3_EMU_MAX_FILES) {
+    return 0;
+  }
+
+  // Keep each source's files together so that index order is array order
+  int at = fileCount;
+  while(at > 0 && files[at-1].source > source) {
+    at--;
+  }
+  memmove(&files[at+1], &files[at], (fileCount - at) * sizeof(File));
+  if(currentFile >= at) currentFile++;
+
+  files[at].source          = source;
+  files[at].folder          = folder;
+  files[at].lengthInSeconds = lengthInSeconds;
+  strncpy(files[at].name, name, MP3_EMU_NAME_LENGTH - 1);
+  files[at].name[MP3_EMU_NAME_LENGTH - 1] = 0;
+  fileCount++;
+
+  sourcesPresent |= 1 << source;
+  return indexOf(at);
+}
+
+
+void jq8400Emulator::setSourcePresent(int source, int present) {
+  if(present) {
+    sourcesPresent |= 1 << source;
+    return;
+  }
+
+  sourcesPresent &= ~(1 << source);
+  if(currentFile >= 0 && files[currentFile].source == source) {
+    select(-1, 0);
+  }
+}
+
+
+// Back to the power on defaults, the files and sources are left as they are
+void jq8400Emulator::powerOn(int bootMs) {
+  currentFile        = -1;
+  playStatus         = MP3_STATUS_STOPPED;
+  positionUs         = 0;
+  currentVolume      = 20;
+  currentEq          = MP3_EQ_NORMAL;
+  currentLoop        = MP3_LOOP_NONE;
+  reportPosition     = 0;
+  abStart            = -1;
+  interrupted.active = 0;
+  playlistLength     = 0;
+  rxState            = MP3_EMU_BEGIN;
+  readyAt            = clock + bootMs * 1000LL;
+}
+
+
+void jq8400Emulator::advance(long long microseconds) {
+  long long target = clock + microseconds;
+
+  // Millisecond steps so that playback events land in the right order
+  // relative to the bytes arriving on the line
+  while(clock < target) {
+    long long step = target - clock;
+    if(step > 1000) step = 1000;
+
+    clock += step;
+    tick(step);
+
+    while(toModuleTail != toModuleHead && toModuleTime[toModuleTail] <= clock) {
+      int c = toModule[toModuleTail];
+      toModuleTail = (toModuleTail + 1) & (MP3_EMU_LINE_BUFFER - 1);
+      if(clock >= readyAt) {
+        receive(c);
+      }
+    }
+  }
+}
+
+
+void jq8400Emulator::hostWrite(int c) {
+  long long start = clock > hostLineFree ? clock : hostLineFree;
+  hostLineFree    = start + byteTime;
+
+  int next = (toModuleHead + 1) & (MP3_EMU_LINE_BUFFER - 1);
+  if(next == toModuleTail || chance(dropRate)) {
+    droppedBytes++;
+    return;
+  }
+  toModule[toModuleHead]     = c & 0xFF;
+  toModuleTime[toModuleHead] = hostLineFree;
+  toModuleHead = next;
+}
+
+
+int jq8400Emulator::hostReadable() {
+  return toHostTail != toHostHead && toHostTime[toHostTail] <= clock;
+}
+
+
+int jq8400Emulator::hostRead() {
+  if(!hostReadable()) {
+    return -1;
+  }
+  int c = toHost[toHostTail];
+  toHostTail = (toHostTail + 1) & (MP3_EMU_LINE_BUFFER - 1);
+  return c;
+}
+
+
+void jq8400Emulator::receive(int c) {
+  // Like the module, a frame which stops part way is given up on once the line
+  // goes quiet, otherwise one lost length byte would eat the commands after it
+  if(clock - rxLastAt > MP3_EMU_FRAME_GAP * 1000LL) {
+    rxState = MP3_EMU_BEGIN;
+  }
+  rxLastAt = clock;
+
+  switch(rxState) {
+    case MP3_EMU_BEGIN:
+      if(c == jq8400::MP3_CMD_BEGIN) {
+        rxSum   = c;
+        rxState = MP3_EMU_COMMAND;
+      }
+      return;
+
+    case MP3_EMU_COMMAND:
+      rxCommand = c;
+      rxSum    += c;
+      rxState   = MP3_EMU_LENGTH;
+      return;
+
+    case MP3_EMU_LENGTH:
+      rxLength  = c;
+      rxCount   = 0;
+      rxSum    += c;
+      rxState   = c ? MP3_EMU_DATA : MP3_EMU_CHECKSUM;
+      return;
+
+    case MP3_EMU_DATA:
+      rxData[rxCount++] = c;
+      rxSum += c;
+      if(rxCount >= rxLength) rxState = MP3_EMU_CHECKSUM;
+      return;
+
+    default:
+      rxState = MP3_EMU_BEGIN;
+      if((rxSum & 0xFF) != c) {
+        badFrames++; // The module silently ignores these
+        return;
+      }
+      goodFrames++;
+      execute(rxCommand, rxData, rxLength);
+  }
+}
+
+
+void jq8400Emulator::respond(int command, const int *data, int length) {
+  int       frame[260];
+  int       n   = 0;
+  int       sum = jq8400::MP3_CMD_BEGIN + command + length;
+
+  frame[n++] = jq8400::MP3_CMD_BEGIN;
+  frame[n++] = command;
+  frame[n++] = length;
+  for(int x = 0; x < length; x++) {
+    frame[n++] = data[x] & 0xFF;
+    sum += data[x];
+  }
+  frame[n++] = chance(corruptRate) ? ((sum ^ 0x5A) & 0xFF) : (sum & 0xFF);
+
+  long long t = clock + latency;
+  if(t < moduleLineFree) t = moduleLineFree;
+  for(int x = 0; x < n; x++) {
+    t += byteTime;
+
+    int next = (toHostHead + 1) & (MP3_EMU_LINE_BUFFER - 1);
+    if(next == toHostTail || chance(dropRate)) {
+      droppedBytes++;
+      continue;
+    }
+    toHost[toHostHead]     = frame[x];
+    toHostTime[toHostHead] = t;
+    toHostHead = next;
+  }
+  moduleLineFree = t;
+}
+
+
+void jq8400Emulator::respondWord(int command, int value) {
+  int buf[2] = { (value >> 8) & 0xFF, value & 0xFF };
+  respond(command, buf, 2);
+}
+
+
+void jq8400Emulator::respondTime(int command, int seconds) {
+  int buf[3] = { seconds / 3600, (seconds / 60) % 60, seconds % 60 };
+  respond(command, buf, 3);
+}
+
+
+void jq8400Emulator::execute(int command, int *data, int length) {
+  int word = length >= 2 ? ((data[0] << 8) | data[1]) : 0;
+  int f;
+
+  switch(command) {
+    case jq8400::MP3_CMD_STATUS:
+      respond(command, &playStatus, 1);
+      break;
+
+    case jq8400::MP3_CMD_PLAY:
+      if(currentFile < 0) {
+        select(fileByIndex(currentSource, 1), 1);
+      } else {
+        playStatus = MP3_STATUS_PLAYING;
+      }
+      break;
+
+    case jq8400::MP3_CMD_PAUSE:
+      if(playStatus == MP3_STATUS_PLAYING) playStatus = MP3_STATUS_PAUSED;
+      break;
+
+    case jq8400::MP3_CMD_STOP:
+    case jq8400::MP3_CMD_SLEEP:
+      playStatus          = MP3_STATUS_STOPPED;
+      positionUs          = 0;
+      abStart             = -1;
+      playlistLength      = 0;
+      interrupted.active  = 0;
+      break;
+
+    case jq8400::MP3_CMD_FFWD:
+    case jq8400::MP3_CMD_RWND:
+      if(currentFile >= 0) {
+        positionUs += (command == jq8400::MP3_CMD_FFWD ? word : -word) * 1000000LL;
+        if(positionUs < 0) positionUs = 0;
+        if(positionUs >= files[currentFile].lengthInSeconds * 1000000LL) endOfTrack();
+      }
+      break;
+
+    case jq8400::MP3_CMD_NEXT:
+    case jq8400::MP3_CMD_PREV:
+      f = currentFile < 0 ? fileByIndex(currentSource, 1) : stepFile(currentFile, command == jq8400::MP3_CMD_NEXT ? 1 : -1, 0);
+      select(f, 1);
+      break;
+
+    case jq8400::MP3_CMD_PLAY_IDX:
+    case jq8400::MP3_CMD_SEEK_IDX:
+      f = fileByIndex(currentSource, word);
+      if(f >= 0) select(f, command == jq8400::MP3_CMD_PLAY_IDX);
+      break;
+
+    case jq8400::MP3_CMD_INSERT_IDX:
+      if(length < 3) break;
+      f = fileByIndex(data[0], (data[1] << 8) | data[2]);
+      if(f < 0) break;
+      if(!interrupted.active) {
+        interrupted.active     = 1;
+        interrupted.file       = currentFile;
+        interrupted.status     = playStatus;
+        interrupted.positionUs = positionUs;
+      }
+      currentFile = f;
+      positionUs  = 0;
+      playStatus  = MP3_STATUS_PLAYING;
+      break;
+
+    case jq8400::MP3_CMD_AB_PLAY:
+      if(length < 4) break;
+      abStart    = data[0] * 60 + data[1];
+      abEnd      = data[2] * 60 + data[3];
+      positionUs = abStart * 1000000LL;
+      break;
+
+    case jq8400::MP3_CMD_AB_PLAY_STOP:
+      abStart = -1;
+      break;
+
+    case jq8400::MP3_CMD_NEXT_FOLDER:
+    case jq8400::MP3_CMD_PREV_FOLDER:
+      if(currentFile < 0) {
+        select(fileByIndex(currentSource, 1), 1);
+        break;
+      }
+      f = currentFile;
+      do {
+        f = stepFile(f, command == jq8400::MP3_CMD_NEXT_FOLDER ? 1 : -1, 0);
+      } while(f != currentFile && files[f].folder == files[currentFile].folder);
+      // Going backwards lands on the last file of that folder, we want the first
+      while(command == jq8400::MP3_CMD_PREV_FOLDER && f > 0 && files[f-1].source == files[f].source && files[f-1].folder == files[f].folder) {
+        f--;
+      }
+      select(f, 1);
+      break;
+
+    case jq8400::MP3_CMD_PLAY_FILE_FOLDER:
+    {
+      // [source] /FF*/NNN*??? or [source] /FF*/*???
+      if(length < 2) break;
+      int x      = 1;
+      int folder = 0;
+      char prefix[MP3_EMU_NAME_LENGTH];
+      int  prefixLength = 0;
+
+      while(x < length && data[x] == '/') x++;
+      while(x < length && data[x] >= '0' && data[x] <= '9') folder = folder * 10 + (data[x++] - '0');
+      while(x < length && data[x] != '/') x++;
+      x++;
+      while(x < length && data[x] >= '0' && data[x] <= '9' && prefixLength < MP3_EMU_NAME_LENGTH - 1) prefix[prefixLength++] = data[x++];
+
+      for(f = 0; f < fileCount; f++) {
+        if(files[f].source == data[0] && files[f].folder == folder && strncmp(files[f].name, prefix, prefixLength) == 0) {
+          select(f, 1);
+          break;
+        }
+      }
+      break;
+    }
+
+    case jq8400::MP3_CMD_VOL_UP:
+      if(currentVolume < 30) currentVolume++;
+      break;
+
+    case jq8400::MP3_CMD_VOL_DN:
+      if(currentVolume > 0) currentVolume--;
+      break;
+
+    case jq8400::MP3_CMD_VOL_SET:
+      if(length >= 1 && data[0] <= 30) currentVolume = data[0];
+      break;
+
+    case jq8400::MP3_CMD_EQ_SET:
+      if(length >= 1) currentEq = data[0];
+      break;
+
+    case jq8400::MP3_CMD_LOOP_SET:
+      if(length >= 1) currentLoop = data[0];
+      break;
+
+    case jq8400::MP3_CMD_SOURCE_SET:
+      if(length >= 1 && (sourcesPresent & (1 << data[0]))) {
+        currentSource = data[0];
+        select(-1, 0);
+      }
+      break;
+
+    case jq8400::MP3_CMD_GET_SOURCES:
+      respond(command, &sourcesPresent, 1);
+      break;
+
+    case jq8400::MP3_CMD_GET_SOURCE:
+      respond(command, &currentSource, 1);
+      break;
+
+    case jq8400::MP3_CMD_COUNT_FILES:
+      respondWord(command, filesOn(currentSource));
+      break;
+
+    case jq8400::MP3_CMD_COUNT_IN_FOLDER:
+    {
+      int n = 0;
+      for(f = 0; currentFile >= 0 && f < fileCount; f++) {
+        if(files[f].source == files[currentFile].source && files[f].folder == files[currentFile].folder) n++;
+      }
+      respondWord(command, n);
+      break;
+    }
+
+    case jq8400::MP3_CMD_CURRENT_FILE_IDX:
+      respondWord(command, currentIndex());
+      break;
+
+    case jq8400::MP3_CMD_FIRST_FILE_IN_FOLDER_IDX:
+      for(f = 0; currentFile >= 0 && f < fileCount; f++) {
+        if(files[f].source == files[currentFile].source && files[f].folder == files[currentFile].folder) break;
+      }
+      respondWord(command, currentFile >= 0 ? indexOf(f) : 0);
+      break;
+
+    case jq8400::MP3_CMD_CURRENT_FILE_LEN:
+      respondTime(command, currentFile >= 0 ? files[currentFile].lengthInSeconds : 0);
+      break;
+
+    case jq8400::MP3_CMD_CURRENT_FILE_POS:
+      reportPosition = 1;
+      reportedSecond = positionInSeconds();
+      respondTime(command, reportedSecond);
+      break;
+
+    case jq8400::MP3_CMD_CURRENT_FILE_POS_STOP:
+      reportPosition = 0;
+      break;
+
+    case jq8400::MP3_CMD_CURRENT_FILE_NAME:
+    {
+      int name[MP3_EMU_NAME_LENGTH];
+      int n = 0;
+      while(currentFile >= 0 && files[currentFile].name[n]) {
+        name[n] = files[currentFile].name[n];
+        n++;
+      }
+      respond(command, name, n);
+      break;
+    }
+
+    case jq8400::MP3_CMD_PLAYLIST:
+      playlistLength   = 0;
+      playlistPosition = 0;
+      for(int x = 0; x + 1 < length && playlistLength < MP3_EMU_MAX_PLAYLIST; x += 2) {
+        for(f = 0; f < fileCount; f++) {
+          if(files[f].source == currentSource && files[f].name[0] == data[x] && files[f].name[1] == data[x+1]) {
+            playlist[playlistLength++] = f;
+            break;
+          }
+        }
+      }
+      if(playlistLength) select(playlist[0], 1);
+      break;
+
+    default:
+      break; // Unknown commands are ignored, as the module does
+  }
+}
+
+
+void jq8400Emulator::tick(long long microseconds) {
+  if(playStatus != MP3_STATUS_PLAYING || currentFile < 0) {
+    return;
+  }
+
+  positionUs += microseconds;
+  if(abStart >= 0 && positionUs >= abEnd * 1000000LL) {
+    positionUs = abStart * 1000000LL;
+  }
+  if(positionUs >= files[currentFile].lengthInSeconds * 1000000LL) {
+    endOfTrack();
+  }
+
+  // Reported as the seconds tick over
+  if(reportPosition && positionInSeconds() != reportedSecond) {
+    reportedSecond = positionInSeconds();
+    respondTime(jq8400::MP3_CMD_CURRENT_FILE_POS, reportedSecond);
+  }
+}
+
+
+void jq8400Emulator::endOfTrack() {
+  if(interrupted.active) {
+    interrupted.active = 0;
+    currentFile = interrupted.file;
+    playStatus  = currentFile >= 0 ? interrupted.status : MP3_STATUS_STOPPED;
+    positionUs  = interrupted.positionUs;
+    return;
+  }
+
+  if(playlistLength) {
+    if(++playlistPosition < playlistLength) {
+      select(playlist[playlistPosition], 1);
+    } else {
+      playlistLength = 0;
+      playStatus     = MP3_STATUS_STOPPED;
+      positionUs     = 0;
+    }
+    return;
+  }
+
+  int next;
+  switch(currentLoop) {
+    case MP3_LOOP_ONE:
+      positionUs = 0;
+      break;
+
+    case MP3_LOOP_ALL:
+    case MP3_LOOP_FOLDER:
+      select(stepFile(currentFile, 1, currentLoop == MP3_LOOP_FOLDER), 1);
+      break;
+
+    case MP3_LOOP_ALL_STOP:
+    case MP3_LOOP_FOLDER_STOP:
+      next = stepFile(currentFile, 1, currentLoop == MP3_LOOP_FOLDER_STOP);
+      if(next <= currentFile) {
+        playStatus = MP3_STATUS_STOPPED;
+        positionUs = 0;
+      } else {
+        select(next, 1);
+      }
+      break;
+
+    case MP3_LOOP_ALL_RANDOM:
+    case MP3_LOOP_FOLDER_RANDOM:
+      next = currentFile;
+      for(int skip = (int)(random % 64) + 1; skip > 0; skip--) {
+        next = stepFile(next, 1, currentLoop == MP3_LOOP_FOLDER_RANDOM);
+      }
+      chance(1); // Move the generator on for next time
+      select(next, 1);
+      break;
+
+    default: // MP3_LOOP_ONE_STOP
+      playStatus = MP3_STATUS_STOPPED;
+      positionUs = 0;
+      break;
+  }
+}
+
+
+void jq8400Emulator::select(int file, int startPlaying) {
+  interrupted.active = 0; // Choosing another track abandons an insert
+  currentFile = file;
+  positionUs  = 0;
+  abStart     = -1;
+  playStatus  = (file >= 0 && startPlaying) ? MP3_STATUS_PLAYING : MP3_STATUS_STOPPED;
+}
+
+
+int jq8400Emulator::fileByIndex(int source, int index) {
+  for(int f = 0; f < fileCount; f++) {
+    if(files[f].source == source && --index == 0) {
+      return f;
+    }
+  }
+  return -1;
+}
+
+
+int jq8400Emulator::indexOf(int file) {
+  int index = 0;
+  for(int f = 0; f <= file; f++) {
+    if(files[f].source == files[file].source) index++;
+  }
+  return index;
+}
+
+
+int jq8400Emulator::filesOn(int source) {
+  int n = 0;
+  for(int f = 0; f < fileCount; f++) {
+    if(files[f].source == source) n++;
+  }
+  return n;
+}
+
+
+// The next (or previous) file on the same source, and optionally in the same
+// folder, wrapping around at the ends
+int jq8400Emulator::stepFile(int from, int direction, int sameFolder) {
+  int f = from;
+  for(int x = 0; x < fileCount; x++) {
+    f = (f + direction + fileCount) % fileCount;
+    if(files[f].source != files[from].source) continue;
+    if(sameFolder && files[f].folder != files[from].folder) continue;
+    return f;
+  }
+  return from;
+}
+
+
+int jq8400Emulator::chance(int perThousand) {
+  // xorshift32, deterministic for a given seed
+  random ^= random << 13;
+  random ^= random >> 17;
+  random ^= random << 5;
+  return perThousand > 0 && (int)(random % 1000) < perThousand;
+}
@@ -0,0 +1,212 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#ifndef jq8400_emulator_h
+#define jq8400_emulator_h
+
+    #define MP3_EMU_MAX_FILES       256     // Across all sources
+    #define MP3_EMU_NAME_LENGTH     12      // Including the null
+    #define MP3_EMU_MAX_PLAYLIST    64      // Entries in an MP3_CMD_PLAYLIST
+    #define MP3_EMU_LINE_BUFFER     1024    // Bytes in flight in each direction, must be a power of two
+    #define MP3_EMU_FRAME_GAP       10      // ms of silence after which a part frame is forgotten
+
+    /** In-process model of a JQ8400 module for running the driver on a desktop.
+     *
+     *  Everything runs off a virtual microsecond clock which only moves when
+     *  advance() is called (the emulated transport does this as the driver reads
+     *  the time), so a given sequence of driver calls always produces the same
+     *  bytes at the same times.
+     *
+     *  Files are numbered per source in the order they are added, as the module
+     *  numbers them in the order they were copied to the medium.
+     */
+    class jq8400Emulator
+    {
+    public:
+        jq8400Emulator();
+
+        // The media
+        int     addFile(int source, int folder, const char *name, int lengthInSeconds);
+        void    setSourcePresent(int source, int present);
+        void    powerOn(int bootMs);                        ///< From cold, deaf to commands for bootMs
+
+        // Line conditions
+        void    setBaud(int baud)                   { byteTime = 10000000 / baud; }
+        void    setLatency(int microseconds)        { latency  = microseconds; }
+        void    setDropRate(int perThousand)        { dropRate = perThousand; }     ///< Bytes lost, in either direction
+        void    setCorruptRate(int perThousand)     { corruptRate = perThousand; }  ///< Response frames with a bad checksum
+        void    setSeed(unsigned int seed)          { random = seed ? seed : 1; }
+
+        // The clock
+        long long now()                             { return clock; }
+        void    advance(long long microseconds);
+
+        // The wire as seen from the driver
+        void    hostWrite(int c);
+        int     hostWriteable()     { return hostLineFree <= clock + byteTime; } ///< Like a UART with a one byte FIFO
+        int     hostReadable();
+        int     hostRead();
+
+        // Inspection of the module's state
+        int     status()            { return playStatus; }
+        int     source()            { return currentSource; }
+        int     currentIndex()      { return currentFile >= 0 ? indexOf(currentFile) : 0; }
+        int     positionInSeconds() { return (int)(positionUs / 1000000); }
+        int     volume()            { return currentVolume; }
+        int     equalizer()         { return currentEq; }
+        int     loopMode()          { return currentLoop; }
+        int     framesReceived()    { return goodFrames; }
+        int     framesRejected()    { return badFrames; }
+        int     bytesDropped()      { return droppedBytes; }
+
+    protected:
+        struct File {
+          int   source;
+          int   folder;
+          int   lengthInSeconds;
+          char  name[MP3_EMU_NAME_LENGTH];
+        };
+
+        struct Saved {
+          int       active;
+          int       file;
+          int       status;
+          long long positionUs;
+        };
+
+        void    receive(int c);
+        void    execute(int command, int *data, int length);
+        void    respond(int command, const int *data, int length);
+        void    respondWord(int command, int value);
+        void    respondTime(int command, int seconds);
+        void    tick(long long microseconds);
+        void    endOfTrack();
+        void    select(int file, int startPlaying);
+        int     fileByIndex(int source, int index);
+        int     indexOf(int file);
+        int     filesOn(int source);
+        int     stepFile(int from, int direction, int sameFolder);
+        int     chance(int perThousand);
+
+        File        files[MP3_EMU_MAX_FILES];
+        int         fileCount;
+        int         sourcesPresent;
+
+        int         currentSource;
+        int         currentFile;        ///< Into files[], -1 if none
+        int         playStatus;
+        long long   positionUs;
+        int         currentVolume;
+        int         currentEq;
+        int         currentLoop;
+        int         reportPosition;
+        int         reportedSecond;
+        int         abStart;            ///< Seconds, -1 when no A-B loop
+        int         abEnd;
+        Saved       interrupted;        ///< What to go back to after an insert
+        int         playlist[MP3_EMU_MAX_PLAYLIST];
+        int         playlistLength;
+        int         playlistPosition;
+
+        long long   clock;
+        long long   readyAt;            ///< Bytes arriving before this are lost, the module is booting
+        int         byteTime;
+        int         latency;
+        int         dropRate;
+        int         corruptRate;
+        unsigned    random;
+
+        // Bytes on the wire, with the time each reaches the other end
+        long long   toModuleTime[MP3_EMU_LINE_BUFFER];
+        int         toModule[MP3_EMU_LINE_BUFFER];
+        int         toModuleHead, toModuleTail;
+        long long   hostLineFree;
+        long long   toHostTime[MP3_EMU_LINE_BUFFER];
+        int         toHost[MP3_EMU_LINE_BUFFER];
+        int         toHostHead, toHostTail;
+        long long   moduleLineFree;
+
+        int         rxState, rxCommand, rxLength, rxCount, rxSum;
+        long long   rxLastAt;           ///< When the last byte arrived
+        int         rxData[256];
+        int         goodFrames, badFrames, droppedBytes;
+    };
+
+    /** Transport for the jq8400 class which talks to a jq8400Emulator
+     *
+     *  Each reading of the clock costs a few microseconds of virtual time so that
+     *  the driver's polling loops make progress, and the RX handler is called
+     *  from there whenever emulated bytes have arrived, much like an interrupt.
+     */
+    class jq8400EmulatedTransport
+    {
+    public:
+        jq8400EmulatedTransport(jq8400Emulator &device) : emulator(&device), handler(0), handlerContext(0), inHandler(0), costPerCall(5) { }
+
+        int     putc(int c)         { emulator->hostWrite(c); return c; }
+        int     getc()              { return emulator->hostRead(); }
+        int     readable()          { return emulator->hostReadable(); }
+        int     writeable()         { return emulator->hostWriteable(); }
+
+        void    attachRx(void (*rxHandler)(void *), void *context) {
+          handler        = rxHandler;
+          handlerContext = context;
+        }
+
+        int     millis()            { elapse(costPerCall); return (int)(emulator->now() / 1000); }
+        int     micros()            { elapse(costPerCall); return (int)(emulator->now()); }
+        void    delay(int ms)       { elapse(ms * 1000LL); }
+
+        jq8400Emulator &device()    { return *emulator; }
+        void    setCostPerCall(int microseconds) { costPerCall = microseconds; }
+
+    protected:
+        // In steps of at most a millisecond, so that the RX handler sees bytes
+        // at about the time they arrive, even through a long delay()
+        void    elapse(long long microseconds) {
+          while(microseconds > 0) {
+            long long step = microseconds < 1000 ? microseconds : 1000;
+            emulator->advance(step);
+            microseconds -= step;
+            
+            if(handler && !inHandler && emulator->hostReadable()) {
+              inHandler = 1;
+              handler(handlerContext);
+              inHandler = 0;
+            }
+          }
+        }
+
+        jq8400Emulator *emulator;
+        void          (*handler)(void *);
+        void           *handlerContext;
+        int             inHandler;
+        int             costPerCall;
+    };
+
+#endif //jq8400_emulator_h
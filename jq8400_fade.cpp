@@ -0,0 +1,126 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#include "jq8400_fade.hpp"
+
+static const uint16_t *const fadeCurves[MP3_FADE_CURVES] = {
+  jq8400FadeCurve<MP3_FADE_LINEAR>::at,
+  jq8400FadeCurve<MP3_FADE_LOG>::at,
+  jq8400FadeCurve<MP3_FADE_SCURVE>::at
+};
+
+static_assert(jq8400FadeCurve<MP3_FADE_LINEAR>::at[MP3_FADE_POINTS / 2] == 512 && jq8400FadeCurve<MP3_FADE_SCURVE>::at[MP3_FADE_POINTS / 2] == 512, "Curves are symmetric about half way");
+static_assert(jq8400FadeCurve<MP3_FADE_LOG>::at[MP3_FADE_POINTS] == 1024 && jq8400FadeCurve<MP3_FADE_LOG>::at[MP3_FADE_POINTS / 2] < 256, "The log curve is half done in less than a quarter of the time");
+
+
+jq8400Fader::jq8400Fader(jq8400 &device) {
+  mp3        = &device;
+  running    = 0;
+  from       = to = device.currentVolume;
+  curve      = MP3_FADE_LINEAR;
+  startedAt  = 0;
+  duration   = 0;
+  step       = 1;
+  lastSentAt = device.millis() - MP3_FADE_MIN_GAP;
+  lastHandle = 0;
+  sent       = 0;
+}
+
+
+// From wherever the volume is now, which mid fade is the last level sent
+void jq8400Fader::fadeTo(int target, int durationMs, int fadeCurve) {
+  if(target < 0)  target = 0;
+  if(target > 30) target = 30;
+
+  from      = mp3->currentVolume;
+  to        = target;
+  curve     = fadeCurve >= 0 && fadeCurve < MP3_FADE_CURVES ? fadeCurve : MP3_FADE_LINEAR;
+  duration  = durationMs > 0 ? durationMs : 0;
+  startedAt = mp3->millis();
+  step      = 1;
+  running   = from != to;
+}
+
+
+// When the volume should be rounded to the step'th level of the way, that is
+// when the curve gets half way from the level before to it
+int jq8400Fader::dueAt(int n) {
+  int levels   = from < to ? to - from : from - to;
+  int position = (2 * n - 1) * MP3_FADE_POINTS * 256 / (2 * levels);  // In 256ths of a table entry
+  int entry    = position >> 8;
+
+  const uint16_t *at = fadeCurves[curve];
+  int progress = entry >= MP3_FADE_POINTS ? at[MP3_FADE_POINTS]
+                                          : at[entry] + (((at[entry + 1] - at[entry]) * (position & 0xFF)) >> 8);
+  return startedAt + (int)((long long)duration * progress / 1024);
+}
+
+
+void jq8400Fader::service() {
+  if(!running) {
+    return;
+  }
+
+  // One volume command in the jq8400's queue at a time, anything else the
+  // application has submitted goes between them
+  if(lastHandle && !mp3->complete(lastHandle)) {
+    return;
+  }
+  lastHandle = 0;
+
+  int now = mp3->millis();
+  if(now - lastSentAt < MP3_FADE_MIN_GAP) {
+    return;
+  }
+
+  // The latest level due, skipping any that came too quickly to send
+  int levels = from < to ? to - from : from - to;
+  int reached = step - 1;
+  while(reached < levels && now - this->dueAt(reached + 1) >= 0) {
+    reached++;
+  }
+  if(reached < step) {
+    return;
+  }
+
+  int level = from < to ? from + reached : from - reached;
+  uint8_t data[1] = { (uint8_t)level };
+  int was = mp3->currentVolume;
+  mp3->remember(jq8400::MP3_CMD_VOL_SET, data, 1, 0); // Before, a step merged into this must see the new level
+  int handle = mp3->submit(jq8400::MP3_CMD_VOL_SET, data, 1);
+  if(!handle) {
+    mp3->currentVolume = was;
+    return; // Queue full, try again next time
+  }
+
+  lastHandle = handle;
+  lastSentAt = now;
+  step       = reached + 1;
+  sent++;
+  running    = reached < levels;
+}
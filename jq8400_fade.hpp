@@ -0,0 +1,122 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#ifndef jq8400_fade_h
+#define jq8400_fade_h
+
+#include "jq8400.hpp"
+
+    #define MP3_FADE_LINEAR         0       // Even steps
+    #define MP3_FADE_LOG            1       // Quick at first, slowing towards the target
+    #define MP3_FADE_SCURVE         2       // Slow at both ends
+    #define MP3_FADE_CURVES         3
+    #define MP3_FADE_LEVELS         30      // Volume 0 to 30
+    #define MP3_FADE_POINTS         (2 * MP3_FADE_LEVELS) // The curves are tabulated at each half level, where the rounding changes
+    #define MP3_FADE_MIN_GAP        25      // ms between volume commands at the most, so others get a turn
+
+    /** The curves, progress p to fraction done, both 0 to 1. */
+    constexpr double jq8400FadeLn(double z, double zz, int k, int terms) {
+      // 2 atanh(z) as a series, z = (x-1)/(x+1) is at most 0.82 over the range used
+      return k > terms ? 0 : 2 * z / k + jq8400FadeLn(z * zz, zz, k + 2, terms);
+    }
+    constexpr double jq8400FadeShape(int curve, double p) {
+      return curve == MP3_FADE_LOG    ? jq8400FadeLn((9 * p) / (2 + 9 * p), ((9 * p) / (2 + 9 * p)) * ((9 * p) / (2 + 9 * p)), 1, 99)
+                                          / jq8400FadeLn(9.0 / 11, (9.0 / 11) * (9.0 / 11), 1, 99)  // log10(1 + 9p)
+           : curve == MP3_FADE_SCURVE ? p * p * (3 - 2 * p)                                         // smoothstep
+           :                            p;
+    }
+
+    /** Progress at which the curve reaches fraction q, by bisection. */
+    constexpr double jq8400FadeInverse(int curve, double q, double lo = 0, double hi = 1, int depth = 24) {
+      return depth == 0 ? (lo + hi) / 2
+           : jq8400FadeShape(curve, (lo + hi) / 2) < q ? jq8400FadeInverse(curve, q, (lo + hi) / 2, hi, depth - 1)
+           :                                             jq8400FadeInverse(curve, q, lo, (lo + hi) / 2, depth - 1);
+    }
+
+    template<int... K> struct jq8400Indexes { };
+    template<int N, int... K> struct jq8400MakeIndexes : jq8400MakeIndexes<N - 1, N - 1, K...> { };
+    template<int... K> struct jq8400MakeIndexes<0, K...> { typedef jq8400Indexes<K...> type; };
+
+    /** When a fade reaches each 1/MP3_FADE_POINTS of the way, as 0 to 1024 of
+     *  its duration, built by the compiler.  The steps of a fade are looked up
+     *  here rather than the curve being worked out as it goes, exactly for a
+     *  fade over the whole range and interpolated for shorter ones.
+     */
+    template<int Curve, typename Indexes = typename jq8400MakeIndexes<MP3_FADE_POINTS + 1>::type>
+    struct jq8400FadeCurve;
+
+    template<int Curve, int... K>
+    struct jq8400FadeCurve<Curve, jq8400Indexes<K...> >
+    {
+        static constexpr uint16_t at[MP3_FADE_POINTS + 1] = { (uint16_t)(jq8400FadeInverse(Curve, (double)K / MP3_FADE_POINTS) * 1024 + 0.5)... };
+    };
+    template<int Curve, int... K> constexpr uint16_t jq8400FadeCurve<Curve, jq8400Indexes<K...> >::at[];
+
+    /** Fades the volume without blocking, in as few commands as it takes.
+     *
+     *  A fade from 30 to 0 is thirty MP3_CMD_VOL_SETs whatever its duration,
+     *  each sent when the curve says that level is due, and never closer than
+     *  MP3_FADE_MIN_GAP so that other commands and queries get in between (a
+     *  quick fade skips levels instead).  The jq8400's getVolume() follows it.
+     *
+     *      jq8400Fader fader(mp3);
+     *      fader.fadeTo(0, 3000, MP3_FADE_SCURVE);
+     *      while(1) { fader.service(); mp3.poll(); ... }
+     *
+     *  Calling fadeTo() during a fade retargets it from wherever it has got
+     *  to, cancel() leaves the volume there.
+     */
+    class jq8400Fader
+    {
+    public:
+        jq8400Fader(jq8400 &device);
+
+        void    fadeTo(int target, int durationMs, int curve = MP3_FADE_LINEAR);
+        void    cancel()            { running = 0; }
+        void    service();
+
+        int     fading()            { return running; }
+        int     target()            { return to; }
+        int     commandsSent()      { return sent; }
+
+    protected:
+        int     dueAt(int step);
+
+        jq8400 *mp3;
+        int     running;
+        int     from, to;
+        int     curve;
+        int     startedAt;          ///< millis()
+        int     duration;
+        int     step;               ///< Of the next level, 1 to |to - from|
+        int     lastSentAt;         ///< millis()
+        int     lastHandle;         ///< Of the last command, so only one is queued at a time
+        int     sent;
+    };
+
+#endif //jq8400_fade_h
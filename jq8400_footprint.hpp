@@ -0,0 +1,89 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+
+#ifndef jq8400_footprint_h
+#define jq8400_footprint_h
+
+#include "jq8400_announcer.hpp"
+#include "jq8400_playlist.hpp"
+#include "jq8400_frontend.hpp"
+#include "jq8400_health.hpp"
+#include "jq8400_cue.hpp"
+#include "jq8400_phrase.hpp"
+#include "jq8400_media.hpp"
+#include "jq8400_coro.hpp"
+
+    /** One line of the size report, bytes of RAM for one object of a class
+     *  (or part of one), or for static storage.
+     */
+    struct jq8400FootprintEntry
+    {
+        const char *name;
+        int         bytes;
+    };
+
+    /** The RAM the driver takes with the sizes it is built with, the MP3_*
+     *  settings in jq8400.hpp which can be set for the build.  Nothing is
+     *  allocated at run time, so this is all of it besides the stack.
+     *
+     *      for(const jq8400FootprintEntry &e : jq8400Footprint) printf("%-28s %6d\n", e.name, e.bytes);
+     *
+     *  Lines starting with a space are parts of the line above.  Build with
+     *  MP3_RAM_BUDGET set to fail the build when a jq8400 is bigger than that.
+     */
+    static constexpr jq8400FootprintEntry jq8400Footprint[] = {
+      { "jq8400",                       (int)sizeof(jq8400) },
+      { " request queue",               (int)(MP3_QUEUE_DEPTH * sizeof(jq8400Request)) },
+      { " rx and tx buffers",           MP3_RX_BUFFER_SIZE + MP3_TX_BUFFER_SIZE },
+      { " response frame",              MP3_MAX_RESPONSE_LENGTH },
+      { " catalog",                     (int)(2 * MP3_CATALOG_MAX_FOLDERS * sizeof(unsigned short)) },
+      { " metadata cache",              (int)sizeof(jq8400Metadata) },
+      { " trace rings",                 MP3_TRACE ? (int)(2 * sizeof(jq8400TraceRing)) : 0 },
+      { " metrics",                     MP3_METRICS ? (int)sizeof(jq8400Metrics) : 0 },
+      { "jq8400StatusMonitor",          (int)sizeof(jq8400StatusMonitor) },
+      { "jq8400Playlist",               (int)sizeof(jq8400Playlist) },
+      { "jq8400Announcer",              (int)sizeof(jq8400Announcer) },
+      { "jq8400Frontend",               (int)sizeof(jq8400Frontend) },
+      { "jq8400Fader",                  (int)sizeof(jq8400Fader) },
+      { "jq8400HealthMonitor",          (int)sizeof(jq8400HealthMonitor) },
+      { "jq8400Timeline",               (int)sizeof(jq8400Timeline) },
+      { "jq8400Phrase",                 (int)sizeof(jq8400Phrase) },
+      { "jq8400MediaWatcher",           (int)sizeof(jq8400MediaWatcher) },
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+      { "jq8400Executor",               (int)sizeof(jq8400Executor) },
+      { "jq8400Async",                  (int)sizeof(jq8400Async) },
+      { "coroutine frame pool (static)", MP3_CORO_FRAMES * MP3_CORO_FRAME_SIZE },
+#endif
+    };
+
+    #ifdef MP3_RAM_BUDGET
+    static_assert(sizeof(jq8400) <= MP3_RAM_BUDGET, "A jq8400 is bigger than MP3_RAM_BUDGET, see jq8400Footprint");
+    #endif
+
+#endif //jq8400_footprint_h
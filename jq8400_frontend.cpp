@@ -0,0 +1,144 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#include "jq8400_frontend.hpp"
+
+int jq8400Future::value() {
+  if(this->result() != MP3_FRAME_OK || !responseLength) {
+    return -1;
+  }
+
+  int v = 0;
+  for(int x = 0; x < responseLength; x++) {
+    v = (v << 8) | response[x];
+  }
+  return v;
+}
+
+
+jq8400Frontend::jq8400Frontend(jq8400 &device) : enqueueAt(0), refused(0) {
+  mp3       = &device;
+  dequeueAt = 0;
+  holding   = 0;
+
+  for(unsigned x = 0; x < MP3_FRONTEND_SLOTS; x++) {
+    slots[x].sequence.store(x, std::memory_order_relaxed);
+  }
+}
+
+
+int jq8400Frontend::send(int command, const uint8_t *data, int length, jq8400Future *future, int responseLength) {
+  if(length < 0 || length > MP3_MAX_REQUEST_LENGTH || responseLength < 0) {
+    return 0;
+  }
+
+  // The future is claimed first, so two tasks can not send with the same one
+  if(future) {
+    int expected = future->state.load(std::memory_order_relaxed);
+    if(expected == MP3_FUTURE_PENDING || !future->state.compare_exchange_strong(expected, MP3_FUTURE_PENDING, std::memory_order_relaxed)) {
+      return 0;
+    }
+  }
+
+  // A slot is ours when its sequence is the position we claim, if it is
+  // behind the owner has not emptied it yet and the queue is full
+  unsigned position = enqueueAt.load(std::memory_order_relaxed);
+  Slot    *slot;
+  while(1) {
+    slot      = &slots[position & (MP3_FRONTEND_SLOTS - 1)];
+    int ahead = (int)(slot->sequence.load(std::memory_order_acquire) - position);
+    if(ahead == 0) {
+      if(enqueueAt.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if(ahead < 0) {
+      refused.fetch_add(1, std::memory_order_relaxed);
+      if(future) {
+        future->state.store(MP3_FUTURE_FREE, std::memory_order_relaxed);
+      }
+      return 0;
+    } else {
+      position = enqueueAt.load(std::memory_order_relaxed);
+    }
+  }
+
+  slot->command.command        = command;
+  slot->command.length         = length;
+  slot->command.responseLength = responseLength < MP3_MAX_RESPONSE_LENGTH ? responseLength : MP3_MAX_RESPONSE_LENGTH;
+  slot->command.future         = future;
+  if(length) {
+    memcpy(slot->command.data, data, length);
+  }
+  slot->sequence.store(position + 1, std::memory_order_release);
+  return 1;
+}
+
+
+// The next command sent, if there is one, and the slot back to the producers
+int jq8400Frontend::take(Command &command) {
+  Slot *slot = &slots[dequeueAt & (MP3_FRONTEND_SLOTS - 1)];
+  if((int)(slot->sequence.load(std::memory_order_acquire) - (dequeueAt + 1)) < 0) {
+    return 0;
+  }
+
+  command = slot->command;
+  slot->sequence.store(dequeueAt + MP3_FRONTEND_SLOTS, std::memory_order_release);
+  dequeueAt++;
+  return 1;
+}
+
+
+int jq8400Frontend::service() {
+  while(holding || this->take(held)) {
+    // Recorded before submitting, a volume step is merged using the result
+    if(!holding) {
+      mp3->remember(held.command, held.data, held.length, held.responseLength);
+      holding = 1;
+    }
+
+    jq8400Future *future = held.future;
+    int handle = mp3->submit(held.command, held.data, held.length,
+                             future ? future->response : 0, future ? held.responseLength : 0,
+                             future ? &jq8400Frontend::completed : 0, future);
+    if(!handle) {
+      break; // The jq8400's queue is full, this one goes first next time
+    }
+    holding = 0;
+  }
+
+  int pending = mp3->poll();
+  return pending + holding + (int)(enqueueAt.load(std::memory_order_relaxed) - dequeueAt);
+}
+
+
+void jq8400Frontend::completed(jq8400Request *request, void *context) {
+  jq8400Future *future   = (jq8400Future *)context;
+  future->frameResult    = request->result;
+  future->responseLength = request->result == MP3_FRAME_OK ? request->responseLength : 0;
+  future->state.store(MP3_FUTURE_DONE, std::memory_order_release);
+}
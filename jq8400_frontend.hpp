@@ -0,0 +1,130 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#ifndef jq8400_frontend_h
+#define jq8400_frontend_h
+
+#include "jq8400.hpp"
+#include <atomic>
+
+    #define MP3_FRONTEND_SLOTS      16      // Commands waiting for the owner, must be a power of two
+    #define MP3_FUTURE_FREE         0
+    #define MP3_FUTURE_PENDING      1
+    #define MP3_FUTURE_DONE         2
+
+    /** The outcome of one command sent through a jq8400Frontend, owned by
+     *  whoever sent it and valid until ready().  Reusable once ready.
+     */
+    class jq8400Future
+    {
+        friend class jq8400Frontend;
+
+    public:
+        jq8400Future() : state(MP3_FUTURE_FREE), frameResult(MP3_FRAME_INCOMPLETE), responseLength(0) { }
+
+        int     ready()             { return state.load(std::memory_order_acquire) == MP3_FUTURE_DONE; }
+        int     result()            { return ready() ? frameResult : MP3_FRAME_INCOMPLETE; }    ///< MP3_FRAME_*
+        const uint8_t *data()       { return response; }
+        int     length()            { return responseLength; }
+        int     value();            ///< The response as a big endian number, -1 if there is none (yet)
+
+    protected:
+        std::atomic<int>    state;          ///< MP3_FUTURE_*
+        int                 frameResult;
+        uint8_t             response[MP3_MAX_RESPONSE_LENGTH];
+        int                 responseLength;
+    };
+
+    /** Lets any number of tasks (or interrupts) command one jq8400.
+     *
+     *  send() copies the command into a lock-free queue and returns, it never
+     *  waits for the UART or for another task.  One task, the owner, calls
+     *  service() which moves the commands into the jq8400's own queue and runs
+     *  it, completing each command's jq8400Future as its response arrives.
+     *
+     *      jq8400Frontend frontend(mp3);
+     *
+     *      // Any task
+     *      jq8400Future status;
+     *      frontend.send(jq8400::MP3_CMD_STATUS, 0, 0, &status, 1);
+     *      ...
+     *      if(status.ready() && status.result() == MP3_FRAME_OK) ... status.value()
+     *
+     *      // The owner, and only the owner, touches the jq8400 itself
+     *      while(1) { frontend.service(); ... }
+     *
+     *  Volume, equalizer and loop mode commands keep the jq8400's record of
+     *  them up to date, and any command without a response is taken to have
+     *  changed what is playing, as with the jq8400's own methods.
+     */
+    class jq8400Frontend
+    {
+    public:
+        jq8400Frontend(jq8400 &device);
+
+        /** From any task, never blocks.
+         *
+         *  @param future  Completed when done, 0 for fire and forget
+         *  @param responseLength Data bytes expected in the response, 0 for none
+         *  @return 0 if the queue is full (or the future is still in use)
+         */
+        int     send(int command, const uint8_t *data = 0, int length = 0, jq8400Future *future = 0, int responseLength = 0);
+
+        int     service();          ///< From the owner only, returns the commands not yet done
+        int     rejected()          { return refused.load(std::memory_order_relaxed); } ///< send()s refused as the queue was full
+
+    protected:
+        struct Command {
+          int           command;
+          int           length;
+          uint8_t       data[MP3_MAX_REQUEST_LENGTH];
+          int           responseLength;
+          jq8400Future *future;
+        };
+
+        // Bounded queue after Vyukov, each slot's sequence says whose turn it is
+        struct Slot {
+          std::atomic<unsigned> sequence;
+          Command               command;
+        };
+
+        static void completed(jq8400Request *request, void *context);
+
+        int     take(Command &command);
+
+        jq8400             *mp3;
+        Slot                slots[MP3_FRONTEND_SLOTS];
+        std::atomic<unsigned> enqueueAt;    ///< Claimed by producers
+        unsigned            dequeueAt;      ///< The owner's alone
+        std::atomic<int>    refused;
+
+        Command             held;           ///< Taken from the queue, waiting for room in the jq8400's
+        int                 holding;
+    };
+
+#endif //jq8400_frontend_h
@@ -0,0 +1,519 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+
+#include "jq8400_health.hpp"
+
+jq8400HealthMonitor::jq8400HealthMonitor(jq8400 &device) {
+  mp3              = &device;
+  state            = MP3_HEALTH_WATCHING;
+  nextProbeAt      = device.millis();
+  inFlight         = 0;
+  failed           = 0;
+  failures         = 0;
+  probes           = 0;
+  seenChanges      = noticedChanges = probeChanges = device.playbackChanges;
+  changedAt        = nextProbeAt;
+  expectStatus     = expectIndex = -1;
+  source           = device.currentSource;
+  baseStatus       = baseIndex = -1;
+  playedMs         = -1;
+  sampleAt         = nextProbeAt;
+  reasons          = 0;
+  targetIndex      = targetStatus = targetPosition = 0;
+  moduleStatus     = moduleIndex = -1;
+  detectedAt       = restoredAt = 0;
+  attempts         = 0;
+  resetTried       = 0;
+  volume           = equalizer = loop = 0;
+  totalDivergences = totalResyncs = totalAvoided = totalResets = 0;
+  recoveries       = 0;
+  lastRecovery     = worstRecovery = -1;
+  sumRecovery      = 0;
+  sourcesAsked     = lengthAsked = 0;
+
+  divergedCallback = recoveredCallback = 0;
+  divergedContext  = recoveredContext  = 0;
+}
+
+
+void jq8400HealthMonitor::service() {
+  mp3->poll();
+
+  int now = mp3->millis();
+  if(mp3->playbackChanges != noticedChanges) {
+    noticedChanges = mp3->playbackChanges;
+    changedAt      = now; // Near enough when it was sent, so long as we are called often
+  }
+  if(mp3->currentSource >= 0) {
+    source = mp3->currentSource;
+  }
+
+  if(inFlight) {
+    return;
+  }
+
+  // Sent from here rather than the callbacks, which run inside poll()
+  if(state == MP3_HEALTH_RESYNCING) {
+    this->resync();
+    return;
+  }
+  if(state == MP3_HEALTH_RESETTING) {
+    this->resetModule();
+    return;
+  }
+
+  if(now - nextProbeAt >= 0) {
+    this->probe();
+  }
+}
+
+
+void jq8400HealthMonitor::probe() {
+  sourcesAsked = state == MP3_HEALTH_SOURCE_LOST || mp3->availableSources < 0 || !mp3->fresh(mp3->sourcesReadAt, MP3_SOURCES_CACHE_MS);
+  lengthAsked  = baseStatus > MP3_STATUS_STOPPED && baseIndex > 0 && mp3->trackLengthInSeconds(baseIndex) < 0;
+
+  // All or nothing, answers to half a probe can not be compared with anything
+  if(mp3->queueRoom() < 2 + sourcesAsked + lengthAsked) {
+    return;
+  }
+
+  probeChanges = mp3->playbackChanges;
+  expectStatus = mp3->expectedStatus;
+  expectIndex  = mp3->currentIndex;
+  failed       = 0;
+
+  mp3->submitFrame(jq8400ConstFrame<jq8400::MP3_CMD_STATUS>::bytes, 4, statusBuffer, 1, &jq8400HealthMonitor::arrived, this);
+  mp3->submitFrame(jq8400ConstFrame<jq8400::MP3_CMD_CURRENT_FILE_IDX>::bytes, 4, indexBuffer, 2, &jq8400HealthMonitor::arrived, this);
+  inFlight = 2;
+  if(sourcesAsked) {
+    mp3->submitFrame(jq8400ConstFrame<jq8400::MP3_CMD_GET_SOURCES>::bytes, 4, sourcesBuffer, 1, &jq8400HealthMonitor::arrived, this);
+    inFlight++;
+  }
+  if(lengthAsked) {
+    mp3->submitFrame(jq8400ConstFrame<jq8400::MP3_CMD_CURRENT_FILE_LEN>::bytes, 4, lengthBuffer, 3, &jq8400HealthMonitor::arrived, this);
+    inFlight++;
+  }
+  probes++;
+  nextProbeAt = mp3->millis() + MP3_HEALTH_PROBE_MS;
+}
+
+
+void jq8400HealthMonitor::arrived(jq8400Request *request, void *context) {
+  jq8400HealthMonitor *self = (jq8400HealthMonitor *)context;
+  if(request->result != MP3_FRAME_OK) {
+    self->failed++;
+  }
+  if(--self->inFlight == 0) {
+    self->evaluate();
+  }
+}
+
+
+void jq8400HealthMonitor::evaluate() {
+  int now = mp3->millis();
+
+  if(failed) {
+    failures++;
+    if(state == MP3_HEALTH_VERIFYING) {
+      moduleStatus = moduleIndex = -1;
+      this->escalate();
+    } else if(state == MP3_HEALTH_LINK_DOWN) {
+      nextProbeAt = now; // Until it answers, as often as the timeouts allow
+      if(now - detectedAt >= MP3_HEALTH_LINK_RESET_MS && !resetTried) {
+        moduleStatus = moduleIndex = -1;
+        targetIndex  = baseIndex;
+        targetStatus = baseStatus;
+        targetPosition = this->positionMs();
+        restoredAt   = now;
+        attempts     = MP3_HEALTH_RESYNC_ATTEMPTS;
+        this->escalate();
+      }
+    } else if(failures >= MP3_HEALTH_LINK_FAILURES && state == MP3_HEALTH_WATCHING) {
+      totalDivergences++;
+      detectedAt  = now;
+      attempts    = resetTried = 0;
+      reasons     = MP3_HEALTH_LINK;
+      state       = MP3_HEALTH_LINK_DOWN;
+      nextProbeAt = now;
+      if(divergedCallback) divergedCallback(*mp3, reasons, divergedContext);
+    }
+    return;
+  }
+  failures = 0;
+
+  int status = statusBuffer[0];
+  int index  = (indexBuffer[0] << 8) | indexBuffer[1];
+  if(lengthAsked && status != MP3_STATUS_STOPPED && index > 0) {
+    mp3->rememberLength(index, (lengthBuffer[0]*60*60) + (lengthBuffer[1]*60) + lengthBuffer[2]);
+  }
+
+  if(sourcesAsked) {
+    int sources = sourcesBuffer[0];
+    mp3->sourcesRead(sources);
+
+    if(source >= 0 && !(sources & (1 << source))) {
+      if(state == MP3_HEALTH_WATCHING) {
+        reasons    = MP3_HEALTH_SOURCE;
+        detectedAt = now;
+        attempts   = resetTried = 0;
+        totalDivergences++;
+        if(divergedCallback) divergedCallback(*mp3, reasons, divergedContext);
+      } else {
+        reasons   |= MP3_HEALTH_SOURCE; // What else was wrong was this
+      }
+      state = MP3_HEALTH_SOURCE_LOST;
+      return;
+    }
+
+    // Back again, the module went to some other source meanwhile so it all
+    // has to be put back, where the track would have got to
+    if(state == MP3_HEALTH_SOURCE_LOST) {
+      state        = MP3_HEALTH_RESYNCING;
+      moduleStatus = status;
+      moduleIndex  = index;
+      seenChanges  = probeChanges;
+      this->diverged(MP3_HEALTH_SOURCE, baseIndex, baseStatus, this->positionMs());
+      return;
+    }
+  }
+  if(state == MP3_HEALTH_SOURCE_LOST) {
+    return;
+  }
+
+  moduleStatus = status;
+  moduleIndex  = index;
+
+  if(state == MP3_HEALTH_VERIFYING) {
+    if(probeChanges != seenChanges) {
+      state = MP3_HEALTH_WATCHING; // The application has moved on, from whatever we were putting back
+    } else if(status == targetStatus && index == targetIndex) {
+      this->recovered();
+      this->baseline(status, index, targetPosition + (status == MP3_STATUS_PLAYING ? now - restoredAt : 0));
+      return;
+    } else if(status == MP3_STATUS_PLAYING && targetStatus == MP3_STATUS_PLAYING && index == targetIndex + 1
+              && (this->lengthMs(targetIndex) < 0 || targetPosition + now - restoredAt >= this->lengthMs(targetIndex) - MP3_HEALTH_END_SLACK_MS)) {
+      // Put back so near the end (or, not knowing the length, past it) that
+      // it has gone on to the next track by itself, as it would have anyway
+      this->recovered();
+      this->baseline(status, index, -1);
+      return;
+    } else {
+      this->escalate();
+      return;
+    }
+  }
+
+  // Answering again, which is all it takes if it carried on as it was
+  int found;
+  if(probeChanges != seenChanges) {
+    seenChanges = probeChanges;
+    found = this->expected(status, index);
+  } else {
+    found = this->routine(status, index);
+  }
+  if(state == MP3_HEALTH_LINK_DOWN && !found) {
+    this->recovered();
+  }
+}
+
+
+// The first look after commands were sent, they say what it should be doing
+int jq8400HealthMonitor::expected(int status, int index) {
+  int now        = mp3->millis();
+  int wantStatus = expectStatus;
+  if(wantStatus == MP3_STATUS_PAUSED && baseStatus == MP3_STATUS_STOPPED) {
+    wantStatus = MP3_STATUS_STOPPED; // Nothing to pause
+  }
+  int wantIndex  = expectIndex > 0 ? expectIndex : (expectStatus >= 0 ? baseIndex : -1);
+
+  // Into the track, if it started from the beginning when the command was sent
+  // or carried on from where it was (a pause or a resume)
+  int position;
+  if(expectIndex > 0) {
+    position = wantStatus == MP3_STATUS_PLAYING ? now - changedAt : 0;
+  } else if(index == baseIndex && status != MP3_STATUS_STOPPED && wantStatus != MP3_STATUS_STOPPED && playedMs >= 0) {
+    position = playedMs + (baseStatus == MP3_STATUS_PLAYING ? changedAt - sampleAt : 0)
+                        + ((wantStatus >= 0 ? wantStatus : status) == MP3_STATUS_PLAYING ? now - changedAt : 0);
+  } else {
+    position = status == MP3_STATUS_PLAYING ? now - changedAt : 0;
+  }
+
+  int found = 0;
+  if(status > MP3_STATUS_PAUSED || index < 1 || (mp3->fileCount > 0 && index > mp3->fileCount)) {
+    found = MP3_HEALTH_REBOOT;
+  } else if(wantIndex > 0 && index != wantIndex) {
+    // Unless no track was asked for, and the one playing could have ended and
+    // gone on to the next by itself
+    if(!(expectIndex <= 0 && baseStatus == MP3_STATUS_PLAYING && status == MP3_STATUS_PLAYING && this->ending())) {
+      found = MP3_HEALTH_INDEX;
+    }
+  } else if(wantStatus >= 0 && status != wantStatus) {
+    // Unless it was a short track, which has been and gone
+    int length = this->lengthMs(index);
+    if(!(wantStatus == MP3_STATUS_PLAYING && status == MP3_STATUS_STOPPED && length >= 0 && now - changedAt >= length - MP3_HEALTH_END_SLACK_MS)) {
+      found = MP3_HEALTH_STATUS;
+    }
+  }
+
+  if(found) {
+    this->diverged(found, wantIndex > 0 ? wantIndex : baseIndex, wantStatus >= 0 ? wantStatus : baseStatus, position);
+  } else {
+    this->baseline(status, index, position);
+  }
+  return found;
+}
+
+
+// Nothing was sent since the last look, so only the end of a track changes anything
+int jq8400HealthMonitor::routine(int status, int index) {
+  int now   = mp3->millis();
+  int found = 0;
+
+  if(status > MP3_STATUS_PAUSED || index < 1 || (mp3->fileCount > 0 && index > mp3->fileCount)) {
+    found = MP3_HEALTH_REBOOT;
+  } else if(baseStatus < 0 || baseIndex < 1) {
+    this->baseline(status, index, status == MP3_STATUS_STOPPED ? 0 : -1);
+  } else if(status == baseStatus && index == baseIndex) {
+    if(status == MP3_STATUS_PLAYING && playedMs >= 0) {
+      int length = this->lengthMs(index);
+      playedMs += now - sampleAt;
+      if(length > 0 && playedMs >= length && mp3->currentLoop == MP3_LOOP_ONE) {
+        playedMs %= length; // Round again
+      }
+    }
+    sampleAt = now;
+  } else if(baseStatus == MP3_STATUS_PLAYING && this->ending()) {
+    // It went on to the next track, or stopped, some time since the last look
+    this->baseline(status, index, status == MP3_STATUS_PLAYING ? now - sampleAt : 0);
+  } else if(status == MP3_STATUS_STOPPED) {
+    found = MP3_HEALTH_REBOOT;
+  } else {
+    found = index != baseIndex ? MP3_HEALTH_INDEX : MP3_HEALTH_STATUS;
+  }
+
+  if(found) {
+    this->diverged(found, baseIndex, baseStatus, this->positionMs());
+  }
+  return found;
+}
+
+
+// The track playing could have ended since the last look, as far as we know
+int jq8400HealthMonitor::ending() {
+  int length   = this->lengthMs(baseIndex);
+  int position = this->positionMs();
+  return length < 0 || position < 0 || position >= length - MP3_HEALTH_END_SLACK_MS;
+}
+
+
+void jq8400HealthMonitor::baseline(int status, int index, int position) {
+  baseStatus = status;
+  baseIndex  = index;
+  playedMs   = position;
+  sampleAt   = mp3->millis();
+}
+
+
+void jq8400HealthMonitor::diverged(int found, int index, int status, int position) {
+  int now = mp3->millis();
+  if(state == MP3_HEALTH_WATCHING) {
+    totalDivergences++;
+    detectedAt = now;
+    attempts   = 0;
+    resetTried = 0;
+    reasons    = found;
+    if(divergedCallback) divergedCallback(*mp3, reasons, divergedContext);
+  } else {
+    reasons   |= found;
+  }
+
+  targetIndex    = index;
+  targetStatus   = status;
+  targetPosition = position > 0 ? position : 0;
+  restoredAt     = now; // targetPosition is as of now
+  state          = MP3_HEALTH_RESYNCING;
+}
+
+
+// A command sent to put things back, remembered as if the application had sent it
+void jq8400HealthMonitor::restore(int command, int value, int length) {
+  uint8_t data[2];
+  if(length == 1) {
+    data[0] = value;
+  } else if(length == 2) {
+    data[0] = value >> 8; // Big endian on the wire
+    data[1] = value;
+  }
+  mp3->remember(command, data, length, 0);
+  mp3->submit(command, data, length);
+}
+
+
+// Only what it takes: a lost play, pause or stop on the right track is sent
+// again alone, the wrong track is replaced by the right one at the position it
+// should have got to, and after a reboot the settings go first
+int jq8400HealthMonitor::resync() {
+  int now      = mp3->millis();
+  int full     = reasons & (MP3_HEALTH_REBOOT | MP3_HEALTH_SOURCE);
+  int playback = targetIndex > 0 && targetStatus >= 0;
+  int sameTrack = !full && playback && moduleIndex == targetIndex && moduleStatus > MP3_STATUS_STOPPED;
+
+  int position = targetPosition + (targetStatus == MP3_STATUS_PLAYING ? now - restoredAt : 0);
+  int length   = this->lengthMs(targetIndex);
+  int seconds  = position / 1000;
+  if(length >= 0 && seconds >= length / 1000) {
+    seconds = length / 1000 - 1;
+  }
+
+  int needed = full ? 3 + (source >= 0) : 0;
+  if(sameTrack) {
+    needed += moduleStatus != targetStatus;
+  } else if(playback) {
+    needed += targetStatus == MP3_STATUS_STOPPED ? 1 : 1 + (seconds > 0) + (targetStatus == MP3_STATUS_PAUSED);
+  }
+  if(mp3->queueRoom() < needed) {
+    return 0; // Try again next time
+  }
+
+  if(full) {
+    if(source >= 0) this->restore(jq8400::MP3_CMD_SOURCE_SET, source, 1);
+    this->restore(jq8400::MP3_CMD_VOL_SET,  mp3->currentVolume, 1);
+    this->restore(jq8400::MP3_CMD_EQ_SET,   mp3->currentEq,     1);
+    this->restore(jq8400::MP3_CMD_LOOP_SET, mp3->currentLoop,   1);
+  }
+
+  if(sameTrack) {
+    if(moduleStatus != targetStatus) {
+      this->restore(targetStatus == MP3_STATUS_PLAYING ? jq8400::MP3_CMD_PLAY
+                    : targetStatus == MP3_STATUS_PAUSED  ? jq8400::MP3_CMD_PAUSE
+                    :                                      jq8400::MP3_CMD_STOP, 0, 0);
+    }
+  } else if(playback) {
+    if(targetStatus == MP3_STATUS_STOPPED) {
+      this->restore(jq8400::MP3_CMD_SEEK_IDX, targetIndex, 2);
+      position = 0;
+    } else {
+      this->restore(jq8400::MP3_CMD_PLAY_IDX, targetIndex, 2);
+      if(seconds > 0) this->restore(jq8400::MP3_CMD_FFWD, seconds, 2);
+      if(targetStatus == MP3_STATUS_PAUSED) this->restore(jq8400::MP3_CMD_PAUSE, 0, 0);
+      position = seconds * 1000;
+    }
+  }
+
+  // Our own commands are not the application's
+  seenChanges = noticedChanges = mp3->playbackChanges;
+
+  if(!playback) {
+    // Nothing known to put back, all that can be done was
+    targetIndex  = moduleIndex;
+    targetStatus = moduleStatus;
+  }
+  targetPosition = position;
+  restoredAt     = now;
+  attempts++;
+  totalResyncs++;
+  state          = MP3_HEALTH_VERIFYING;
+  nextProbeAt    = now + MP3_HEALTH_VERIFY_MS;
+  return 1;
+}
+
+
+// The resync did not take, again with everything, then with a reset()
+void jq8400HealthMonitor::escalate() {
+  reasons |= MP3_HEALTH_REBOOT;
+
+  if(attempts < MP3_HEALTH_RESYNC_ATTEMPTS) {
+    state = MP3_HEALTH_RESYNCING;
+    return;
+  }
+
+  if(resetTried) {
+    // Nothing more to be done, watch it as it is and start again on the next divergence
+    state = MP3_HEALTH_WATCHING;
+    this->baseline(-1, -1, -1);
+    return;
+  }
+
+  // This runs inside poll(), reset() waits for the module to boot so it is
+  // done from service()
+  resetTried = 1;
+  state      = MP3_HEALTH_RESETTING;
+}
+
+
+void jq8400HealthMonitor::resetModule() {
+  // reset() puts the module and our record of it back to its defaults, what
+  // the application had set is what goes back
+  volume     = mp3->currentVolume;
+  equalizer  = mp3->currentEq;
+  loop       = mp3->currentLoop;
+  totalResets++;
+  mp3->reset();
+  mp3->currentVolume = volume;
+  mp3->currentEq     = equalizer;
+  mp3->currentLoop   = loop;
+
+  attempts = MP3_HEALTH_RESYNC_ATTEMPTS - 1; // One more go
+  state    = MP3_HEALTH_RESYNCING;
+}
+
+
+void jq8400HealthMonitor::recovered() {
+  int took = mp3->millis() - detectedAt;
+  lastRecovery = took;
+  if(took > worstRecovery) worstRecovery = took;
+  sumRecovery += took;
+  recoveries++;
+  if(!resetTried) totalAvoided++;
+
+  state    = MP3_HEALTH_WATCHING;
+  failures = 0;
+  if(recoveredCallback) recoveredCallback(*mp3, reasons, recoveredContext);
+  reasons  = 0;
+}
+
+
+// Into the base track, -1 if not known
+int jq8400HealthMonitor::positionMs() {
+  int now = mp3->millis();
+  if(mp3->positionSubscribed && mp3->positionAt >= 0) {
+    int since = now - mp3->positionAt;
+    return mp3->positionMs + (since < 1000 ? since : 1000);
+  }
+  if(playedMs < 0) {
+    return -1;
+  }
+  return playedMs + (baseStatus == MP3_STATUS_PLAYING ? now - sampleAt : 0);
+}
+
+
+int jq8400HealthMonitor::lengthMs(int index) {
+  int seconds = index > 0 ? mp3->trackLengthInSeconds(index) : -1;
+  return seconds < 0 ? -1 : seconds * 1000;
+}
@@ -0,0 +1,168 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#ifndef jq8400_health_h
+#define jq8400_health_h
+
+#include "jq8400.hpp"
+
+    #define MP3_HEALTH_PROBE_MS         1000    // Between checks of the status and index
+    #define MP3_HEALTH_VERIFY_MS        50      // After a resync, before checking that it took
+    #define MP3_HEALTH_END_SLACK_MS     1500    // A track this near its end (as far as we know) may have ended by itself
+    #define MP3_HEALTH_LINK_FAILURES    3       // Probes in a row failing (timeout or checksum) before the module is suspect
+    #define MP3_HEALTH_RESYNC_ATTEMPTS  2       // Resyncs which fail to take before falling back to reset()
+    #define MP3_HEALTH_LINK_RESET_MS    5000    // After the probes start failing, how long before falling back to reset()
+
+    #define MP3_HEALTH_STATUS           0x01    // Playing, paused or stopped when it should not be
+    #define MP3_HEALTH_INDEX            0x02    // On some other track than it should be
+    #define MP3_HEALTH_LINK             0x04    // MP3_HEALTH_LINK_FAILURES probes in a row went unanswered or corrupt
+    #define MP3_HEALTH_SOURCE           0x08    // The source in use went from the available sources (and came back)
+    #define MP3_HEALTH_REBOOT           0x10    // Stopped or on no track by itself, as after a brown out, it forgot everything
+
+    typedef void (*jq8400HealthCallback)(jq8400 &device, int reasons, void *context);
+
+    /** Notices the module going its own way, and puts it back without a reset()
+     *
+     *  Every MP3_HEALTH_PROBE_MS the status and index are asked for (and the
+     *  sources, when the jq8400's reading of them is stale), and compared with
+     *  what the commands sent through the jq8400 should have left, or with
+     *  what the module was doing before if none were.  A track may end by
+     *  itself near its end, anything else is a divergence: a lost command, a
+     *  track change or stop nobody asked for, a module which rebooted.
+     *
+     *  On a divergence only what it takes is sent again: the play, pause or
+     *  stop that was lost, or the track at the position it should have got to
+     *  by now, and after a reboot the source, volume, equalizer and loop mode
+     *  as well.  If that has not taken after MP3_HEALTH_RESYNC_ATTEMPTS, the
+     *  module is reset() (which blocks) and the same sent again.
+     *
+     *  Probes which go unanswered (or corrupt) say nothing about the module
+     *  until it answers again, when it is checked as usual and only resynced
+     *  if it has diverged.  If it has not answered in MP3_HEALTH_LINK_RESET_MS
+     *  it is reset().
+     *
+     *      jq8400HealthMonitor health(mp3);
+     *      health.onDiverged(logIt, 0);
+     *      while(1) { health.service(); ... }
+     *
+     *  Call service() from your main loop, along with or instead of
+     *  jq8400::poll(), it only blocks to reset().
+     */
+    class jq8400HealthMonitor
+    {
+    public:
+        jq8400HealthMonitor(jq8400 &device);
+
+        void    onDiverged(jq8400HealthCallback callback, void *context)    { divergedCallback  = callback; divergedContext  = context; }
+        void    onRecovered(jq8400HealthCallback callback, void *context)   { recoveredCallback = callback; recoveredContext = context; }
+
+        void    service();
+
+        int     healthy()           { return state == MP3_HEALTH_WATCHING; }
+        int     divergences()       { return totalDivergences; }
+        int     resyncs()           { return totalResyncs; }    ///< Resyncs sent, the first and any repeats
+        int     resetsAvoided()     { return totalAvoided; }    ///< Recoveries without a reset()
+        int     resets()            { return totalResets; }
+        int     lastRecoveryMs()    { return lastRecovery; }    ///< From noticing to seeing it put right, -1 if never
+        int     worstRecoveryMs()   { return worstRecovery; }
+        int     meanRecoveryMs()    { return recoveries ? (int)(sumRecovery / recoveries) : -1; }
+        int     probesSent()        { return probes; }
+
+    protected:
+        static const int MP3_HEALTH_WATCHING    = 0;
+        static const int MP3_HEALTH_RESYNCING   = 1;    ///< A resync is to be sent, when there is room
+        static const int MP3_HEALTH_VERIFYING   = 2;
+        static const int MP3_HEALTH_SOURCE_LOST = 3;
+        static const int MP3_HEALTH_LINK_DOWN   = 4;    ///< Probed continually until it answers, then checked as usual
+        static const int MP3_HEALTH_RESETTING   = 5;    ///< A reset() is to be done, it blocks so not from a callback
+
+        static void arrived(jq8400Request *request, void *context);
+
+        void    probe();
+        void    resetModule();
+        void    evaluate();
+        int     expected(int status, int index);
+        int     routine(int status, int index);
+        int     ending();
+        void    baseline(int status, int index, int position);
+        void    diverged(int reasons, int index, int status, int position);
+        int     resync();
+        void    restore(int command, int value, int length);
+        void    escalate();
+        void    recovered();
+        int     positionMs();
+        int     lengthMs(int index);
+
+        jq8400     *mp3;
+        int         state;
+        int         nextProbeAt;        ///< millis()
+        int         inFlight;           ///< Probe queries not yet answered
+        int         failed;             ///< Of them, how many were
+        int         failures;           ///< Probes in a row which failed
+        int         probes;
+
+        int         seenChanges;        ///< jq8400::playbackChanges as last checked
+        int         noticedChanges;
+        int         changedAt;          ///< millis() the latest change was noticed
+        int         probeChanges;       ///< As they were when the probe in flight was sent
+        int         expectStatus;       ///<  and what those changes should have left
+        int         expectIndex;
+
+        int         source;             ///< In use, -1 if not known
+        int         baseStatus;         ///< Last seen, or set by a command, -1 if not known
+        int         baseIndex;
+        int         playedMs;           ///< Into the base track, -1 if not known
+        int         sampleAt;           ///< millis() playedMs was true at
+
+        int         reasons;            ///< Of the divergence being recovered from
+        int         targetIndex;        ///<  what is to be put back
+        int         targetStatus;
+        int         targetPosition;     ///< ms
+        int         moduleStatus;       ///<  and what the module was doing instead
+        int         moduleIndex;
+        int         detectedAt;         ///< millis()
+        int         restoredAt;
+        int         attempts;
+        int         resetTried;
+        int         volume, equalizer, loop;
+
+        int         totalDivergences, totalResyncs, totalAvoided, totalResets;
+        int         recoveries, lastRecovery, worstRecovery;
+        long        sumRecovery;
+
+        uint8_t     statusBuffer[1];
+        uint8_t     indexBuffer[2];
+        uint8_t     sourcesBuffer[1];
+        uint8_t     lengthBuffer[3];
+        int         sourcesAsked, lengthAsked;
+
+        jq8400HealthCallback divergedCallback, recoveredCallback;
+        void                *divergedContext,  *recoveredContext;
+    };
+
+#endif //jq8400_health_h
@@ -0,0 +1,293 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+
+#include "jq8400_media.hpp"
+
+jq8400MediaWatcher::jq8400MediaWatcher(jq8400 &device) {
+  mp3            = &device;
+  present        = -1;
+  readAt         = -1;
+  inUse          = -1;
+  countFor       = -1;
+  inFlight       = 0;
+  nextPollAt     = device.millis();
+  fallbackSource = -1;
+  fallbackIndex  = 0;
+  failoverAt     = -1;
+  failoverDue    = 0;
+  inserted       = removed = failed = 0;
+  lastFailover   = worstFailover = -1;
+  queries        = 0;
+
+  for(int x = 0; x < MP3_MEDIA_SOURCES; x++) {
+    counts[x]  = -1;
+    indexes[x] = -1;
+  }
+
+  insertedCallback = removedCallback = failoverCallback = 0;
+  insertedContext  = removedContext  = failoverContext  = 0;
+}
+
+
+int jq8400MediaWatcher::scan() {
+  int sources = mp3->getAvailableSources();
+  if(sources < 0) {
+    return -1;
+  }
+  readAt = mp3->sourcesReadAt;
+  this->changed(sources);
+
+  int was     = mp3->getSource();
+  int counted = 0;
+  for(int x = 0; x < MP3_MEDIA_SOURCES; x++) {
+    if(sources & (1 << x)) {
+      mp3->setSource(x);
+      counts[x] = mp3->countFiles();
+      counted++;
+    }
+  }
+
+  if(was >= 0 && was < MP3_MEDIA_SOURCES && (sources & (1 << was))) {
+    mp3->setSource(was);
+    mp3->fileCount = counts[was];
+    inUse = was;
+  }
+  return counted;
+}
+
+
+// What the jq8400 knows of the source in use, and what we know that it forgot
+void jq8400MediaWatcher::learn() {
+  if(mp3->currentSource >= 0) {
+    inUse = mp3->currentSource;
+  }
+  if(inUse < 0 || inUse >= MP3_MEDIA_SOURCES || mp3->currentSource != inUse) {
+    return;
+  }
+
+  if(mp3->fileCount >= 0) {
+    counts[inUse] = mp3->fileCount;
+  } else if(counts[inUse] >= 0) {
+    mp3->fileCount = counts[inUse]; // setSource() forgot it
+  }
+  if(mp3->currentIndex > 0) {
+    indexes[inUse] = mp3->currentIndex;
+  }
+}
+
+
+void jq8400MediaWatcher::service() {
+  mp3->poll();
+  this->learn();
+
+  if(failoverDue) {
+    this->failover();
+  }
+
+  // A reading the jq8400 took itself is as good as ours
+  if(!inFlight && mp3->availableSources >= 0 && mp3->sourcesReadAt != readAt) {
+    readAt = mp3->sourcesReadAt;
+    this->changed(mp3->availableSources);
+  }
+
+  if(inFlight || mp3->millis() - nextPollAt < 0) {
+    return;
+  }
+
+  if(mp3->submitFrame(jq8400ConstFrame<jq8400::MP3_CMD_GET_SOURCES>::bytes, 4, sourcesBuffer, 1, &jq8400MediaWatcher::sourcesArrived, this)) {
+    inFlight++;
+    queries++;
+  }
+
+  // A source switched to which has not been counted, by the by
+  if(inUse >= 0 && inUse < MP3_MEDIA_SOURCES && mp3->currentSource == inUse && mp3->fileCount < 0 && counts[inUse] < 0) {
+    if(mp3->submitFrame(jq8400ConstFrame<jq8400::MP3_CMD_COUNT_FILES>::bytes, 4, countBuffer, 2, &jq8400MediaWatcher::countArrived, this)) {
+      inFlight++;
+      queries++;
+      countFor = inUse;
+    }
+  }
+}
+
+
+void jq8400MediaWatcher::sourcesArrived(jq8400Request *request, void *context) {
+  jq8400MediaWatcher *self = (jq8400MediaWatcher *)context;
+  self->inFlight--;
+  self->nextPollAt = self->mp3->millis() + MP3_MEDIA_WATCH_MS;
+  if(request->result == MP3_FRAME_OK) {
+    self->mp3->sourcesRead(self->sourcesBuffer[0]);
+    self->readAt = self->mp3->sourcesReadAt;
+    self->changed(self->sourcesBuffer[0]);
+  }
+}
+
+
+void jq8400MediaWatcher::countArrived(jq8400Request *request, void *context) {
+  jq8400MediaWatcher *self = (jq8400MediaWatcher *)context;
+  self->inFlight--;
+  if(request->result == MP3_FRAME_OK && self->countFor >= 0 && self->countFor == self->mp3->currentSource) {
+    self->counts[self->countFor] = (self->countBuffer[0] << 8) | self->countBuffer[1];
+    self->mp3->fileCount = self->counts[self->countFor];
+  }
+  self->countFor = -1;
+}
+
+
+void jq8400MediaWatcher::changed(int sources) {
+  if(present < 0) {
+    present = sources; // The first reading, nothing to compare it with
+    return;
+  }
+  if(sources == present) {
+    return;
+  }
+
+  int gone = present & ~sources;
+  int come = sources & ~present;
+  present  = sources;
+
+  // The jq8400 forgot the source in use along with everything else, it is
+  // still in use and what is on it is the same unless it was that which went
+  int lost = inUse >= 0 && (gone & (1 << inUse));
+  if(inUse >= 0 && !lost) {
+    mp3->currentSource = inUse;
+    if(inUse < MP3_MEDIA_SOURCES && counts[inUse] >= 0) {
+      mp3->fileCount = counts[inUse];
+    }
+  }
+
+  for(int x = 0; x < MP3_MEDIA_SOURCES; x++) {
+    if(gone & (1 << x)) {
+      counts[x] = -1;
+    }
+  }
+
+  // Nowhere to fail over to any more
+  if(failoverDue && (gone & (1 << fallbackSource))) {
+    failoverDue = 0;
+    failoverAt  = -1;
+  }
+
+  // Failing over first, the events can wait
+  if(lost) {
+    int from = inUse;
+    inUse = -1;
+    if(fallbackSource >= 0 && fallbackSource != from) {
+      failoverAt  = mp3->millis();
+      failoverDue = 1;
+      this->failover();
+    }
+  }
+
+  for(int x = 0; x < MP3_MEDIA_SOURCES; x++) {
+    if(gone & (1 << x)) {
+      removed++;
+      this->publish(removedCallback, removedContext, x);
+    }
+    if(come & (1 << x)) {
+      inserted++;
+      this->publish(insertedCallback, insertedContext, x);
+    }
+  }
+}
+
+
+// To the fallback, or if the queue is full again from service() until it
+// goes (or the fallback itself is removed)
+void jq8400MediaWatcher::failover() {
+  if(this->send(fallbackSource, fallbackIndex)) {
+    failoverDue = 0;
+    failed++;
+  }
+}
+
+
+// Asked for, it overtakes a failover which has not been sent yet
+int jq8400MediaWatcher::switchTo(int source, int index) {
+  if(!this->send(source, index)) {
+    return 0;
+  }
+  if(failoverDue) {
+    failoverDue = 0;
+    failoverAt  = -1;
+  }
+  return 1;
+}
+
+
+int jq8400MediaWatcher::send(int source, int index) {
+  if(source < 0 || source >= MP3_MEDIA_SOURCES || (present >= 0 && !(present & (1 << source))) || mp3->queueRoom() < 2) {
+    return 0;
+  }
+
+  if(index <= 0) {
+    index = indexes[source] > 0 ? indexes[source] : 1;
+  }
+  if(counts[source] >= 0 && index > counts[source]) {
+    index = 1;
+  }
+
+  uint8_t data[2] = { (uint8_t)source };
+  mp3->remember(jq8400::MP3_CMD_SOURCE_SET, data, 1, 0);
+  mp3->submit(jq8400::MP3_CMD_SOURCE_SET, data, 1);
+  inUse = source;
+  if(counts[source] >= 0) {
+    mp3->fileCount = counts[source]; // No rescan
+  }
+
+  data[0] = index >> 8; // Big endian on the wire
+  data[1] = index;
+  mp3->remember(jq8400::MP3_CMD_PLAY_IDX, data, 2, 0);
+  mp3->submit(jq8400::MP3_CMD_PLAY_IDX, data, 2, 0, 0, &jq8400MediaWatcher::switched, this);
+  return 1;
+}
+
+
+void jq8400MediaWatcher::switched(jq8400Request *request, void *context) {
+  jq8400MediaWatcher *self = (jq8400MediaWatcher *)context;
+  if(self->failoverAt < 0) {
+    return;
+  }
+
+  self->lastFailover = self->mp3->millis() - self->failoverAt;
+  if(self->lastFailover > self->worstFailover) {
+    self->worstFailover = self->lastFailover;
+  }
+  self->failoverAt = -1;
+  if(request->result == MP3_FRAME_OK) {
+    self->publish(self->failoverCallback, self->failoverContext, self->inUse);
+  }
+}
+
+
+void jq8400MediaWatcher::publish(jq8400MediaCallback callback, void *context, int source) {
+  if(callback) {
+    callback(*mp3, source, context);
+  }
+}
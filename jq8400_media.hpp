@@ -0,0 +1,139 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+
+#ifndef jq8400_media_h
+#define jq8400_media_h
+
+#include "jq8400.hpp"
+
+    #define MP3_MEDIA_WATCH_MS      500     // Between readings of the available sources
+    #define MP3_MEDIA_SOURCES       3       // MP3_SRC_USB, MP3_SRC_SDCARD and MP3_SRC_FLASH, bits 0 to 2 of the sources
+
+    typedef void (*jq8400MediaCallback)(jq8400 &device, int source, void *context);
+
+    /** Watches for media being inserted and removed, and when the source in
+     *  use goes, carries on from a fallback source without rescanning it.
+     *
+     *  Every MP3_MEDIA_WATCH_MS the available sources are asked for (a
+     *  reading the jq8400 took for some other reason in the meantime does as
+     *  well), and the changes raise the inserted and removed events.
+     *
+     *  The file count and last index played of each source are kept, so that
+     *  switching back to a source needs no MP3_CMD_COUNT_FILES, a count is
+     *  forgotten when its medium is removed (it could come back different).
+     *  What the jq8400 knows of the source in use is kept when some other
+     *  medium comes or goes, rather than forgotten with the rest.
+     *
+     *      jq8400MediaWatcher media(mp3);
+     *      media.setFallback(MP3_SRC_FLASH, 1);        // "Card removed" from the flash
+     *      media.scan();                               // Counts what is there, at start up
+     *      media.onInserted(cardBack, 0);
+     *      while(1) { media.service(); ... }
+     *
+     *  Call service() from your main loop, along with or instead of
+     *  jq8400::poll(), it never blocks (scan() does).
+     */
+    class jq8400MediaWatcher
+    {
+    public:
+        jq8400MediaWatcher(jq8400 &device);
+
+        void    onInserted(jq8400MediaCallback callback, void *context)  { insertedCallback = callback; insertedContext = context; }
+        void    onRemoved(jq8400MediaCallback callback, void *context)   { removedCallback  = callback; removedContext  = context; }
+        void    onFailover(jq8400MediaCallback callback, void *context)  { failoverCallback = callback; failoverContext = context; }
+
+        /** Where to go when the source in use is removed, and the track to play
+         *  there, 0 for the last one played on it (or the first).  A source of
+         *  -1 for no failover.
+         */
+        void    setFallback(int source, int index) { fallbackSource = source; fallbackIndex = index; }
+
+        /** Counts the files of every source present, selecting each in turn and
+         *  going back to the one in use, so it stops whatever is playing.
+         *  Returns the sources counted, -1 if the module did not answer.
+         */
+        int     scan();
+        void    service();
+
+        /** To another source without counting its files, playing index there,
+         *  0 for the last one played on it (or the first).  Returns 0 if it is
+         *  not present or the queue is full.
+         */
+        int     switchTo(int source, int index = 0);
+
+        int     sources()                   { return present; }     ///< Bitmask, -1 until first known
+        int     source()                    { return inUse; }       ///< In use, -1 if not known
+        int     fileCount(int source)       { return source >= 0 && source < MP3_MEDIA_SOURCES ? counts[source]  : -1; }
+        int     lastIndex(int source)       { return source >= 0 && source < MP3_MEDIA_SOURCES ? indexes[source] : -1; }
+
+        int     inserts()                   { return inserted; }
+        int     removals()                  { return removed; }
+        int     failovers()                 { return failed; }
+        int     lastFailoverMs()            { return lastFailover; }    ///< From the removal being seen to the fallback track being sent, -1 never
+        int     worstFailoverMs()           { return worstFailover; }
+        int     queriesSent()               { return queries; }
+
+    protected:
+        static void sourcesArrived(jq8400Request *request, void *context);
+        static void countArrived(jq8400Request *request, void *context);
+        static void switched(jq8400Request *request, void *context);
+
+        void    learn();
+        void    changed(int sources);
+        void    failover();
+        int     send(int source, int index);
+        void    publish(jq8400MediaCallback callback, void *context, int source);
+
+        jq8400     *mp3;
+        int         present;
+        int         readAt;             ///< jq8400::sourcesReadAt of the reading last looked at
+        int         inUse;
+        int         counts[MP3_MEDIA_SOURCES];  ///< -1 if not known
+        int         indexes[MP3_MEDIA_SOURCES]; ///< -1 if not known
+        int         countFor;           ///< Source a count in flight is of, -1 for none
+
+        int         inFlight;
+        int         nextPollAt;         ///< millis()
+        uint8_t     sourcesBuffer[1];
+        uint8_t     countBuffer[2];
+
+        int         fallbackSource;
+        int         fallbackIndex;
+        int         failoverAt;         ///< millis() the removal was seen, -1 if not failing over
+        int         failoverDue;        ///< The fallback is still to be sent, the queue was full
+
+        int         inserted, removed, failed;
+        int         lastFailover, worstFailover;
+        int         queries;
+
+        jq8400MediaCallback insertedCallback, removedCallback, failoverCallback;
+        void               *insertedContext, *removedContext, *failoverContext;
+    };
+
+#endif //jq8400_media_h
@@ -0,0 +1,263 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#include "jq8400_monitor.hpp"
+
+jq8400StatusMonitor::jq8400StatusMonitor(jq8400 &device) {
+  mp3             = &device;
+  inFlight        = 0;
+  nextPollAt      = device.millis();
+  currentStatus   = -1;
+  candidateStatus = -1;
+  candidateCount  = 0;
+  currentIndex    = -1;
+  lengthMs        = -1;
+  playedMs        = -1;
+  lastSampleAt    = nextPollAt;
+  queries         = 0;
+  commandedPoll   = 0;
+  recheck         = 0;
+
+  stoppedCallback = playingCallback = pausedCallback = trackCallback = 0;
+  stoppedContext  = playingContext  = pausedContext  = trackContext  = 0;
+}
+
+
+void jq8400StatusMonitor::service() {
+  // The answers to queries already out when a command is sent describe things
+  // as they were before it, and would put back the status it forgot
+  if(inFlight && !commandedPoll && mp3->currentStatus < 0) {
+    recheck = 1;
+  }
+
+  mp3->poll();
+
+  if(inFlight) {
+    return;
+  }
+
+  // A command sent through the jq8400 which changes playback forgets its
+  // status, that is our cue to look now rather than when we planned to
+  int commanded = mp3->currentStatus < 0 || recheck;
+  if(!commanded && mp3->millis() - nextPollAt < 0) {
+    return;
+  }
+  commandedPoll = commanded;
+  recheck       = 0;
+
+  // Tracks change at their end (or when told to), only then is the index worth
+  // asking for, and it is asked first so that status events carry the new index
+  int remaining = this->remainingMs();
+  if(commanded || currentIndex < 0 || (currentStatus == MP3_STATUS_PLAYING && remaining < 2 * MP3_MONITOR_MIN_MS)) {
+    if(mp3->submitFrame(jq8400ConstFrame<jq8400::MP3_CMD_CURRENT_FILE_IDX>::bytes, 4, indexBuffer, 2, &jq8400StatusMonitor::indexArrived, this)) {
+      inFlight++;
+      queries++;
+    }
+  }
+
+  if(mp3->submitFrame(jq8400ConstFrame<jq8400::MP3_CMD_STATUS>::bytes, 4, statusBuffer, 1, &jq8400StatusMonitor::statusArrived, this)) {
+    inFlight++;
+    queries++;
+  }
+
+  if(currentStatus == MP3_STATUS_PLAYING && lengthMs < 0) {
+    if(mp3->submitFrame(jq8400ConstFrame<jq8400::MP3_CMD_CURRENT_FILE_LEN>::bytes, 4, lengthBuffer, 3, &jq8400StatusMonitor::lengthArrived, this)) {
+      inFlight++;
+      queries++;
+    }
+  }
+}
+
+
+// How long until the current track should end, from its length and either the
+// module's position reports (if subscribed) or how long we have seen it playing.
+// The report is read straight from the driver, it is called from callbacks
+// inside poll() and must not poll again.
+int jq8400StatusMonitor::remainingMs() {
+  if(lengthMs < 0) {
+    return -1;
+  }
+
+  int position;
+  if(mp3->positionSubscribed && mp3->positionAt >= 0) {
+    int since = mp3->millis() - mp3->positionAt;
+    position  = mp3->positionMs + (since < 1000 ? since : 1000);
+  } else if(playedMs >= 0) {
+    position = playedMs;
+    if(currentStatus == MP3_STATUS_PLAYING) {
+      position += mp3->millis() - lastSampleAt;
+    }
+  } else {
+    return -1;
+  }
+
+  return lengthMs > position ? lengthMs - position : 0;
+}
+
+
+void jq8400StatusMonitor::statusArrived(jq8400Request *request, void *context) {
+  jq8400StatusMonitor *self = (jq8400StatusMonitor *)context;
+  self->inFlight--;
+  if(request->result == MP3_FRAME_OK) {
+    self->statusSample(self->statusBuffer[0]);
+  }
+  self->schedule();
+}
+
+
+void jq8400StatusMonitor::indexArrived(jq8400Request *request, void *context) {
+  jq8400StatusMonitor *self = (jq8400StatusMonitor *)context;
+  self->inFlight--;
+  if(request->result == MP3_FRAME_OK) {
+    self->indexSample((self->indexBuffer[0] << 8) | self->indexBuffer[1]);
+  }
+  self->schedule();
+}
+
+
+void jq8400StatusMonitor::lengthArrived(jq8400Request *request, void *context) {
+  jq8400StatusMonitor *self = (jq8400StatusMonitor *)context;
+  self->inFlight--;
+  if(request->result == MP3_FRAME_OK) {
+    self->lengthMs = ((self->lengthBuffer[0]*60*60) + (self->lengthBuffer[1]*60) + self->lengthBuffer[2]) * 1000;
+    if(self->currentIndex > 0) {
+      self->mp3->rememberLength(self->currentIndex, self->lengthMs / 1000);
+    }
+  }
+  self->schedule();
+}
+
+
+void jq8400StatusMonitor::statusSample(int status) {
+  int now = mp3->millis();
+  if(currentStatus == MP3_STATUS_PLAYING && playedMs >= 0) {
+    playedMs += now - lastSampleAt;
+  }
+  lastSampleAt = now;
+
+  mp3->currentStatus = status;
+  mp3->statusReadAt  = now;
+
+  if(status == currentStatus) {
+    candidateCount = 0;
+    return;
+  }
+
+  // Playing and paused are sometimes misreported, as in jq8400::getStatus(),
+  // but stopped is fairly reliable
+  if(status != MP3_STATUS_STOPPED && MP3_STATUS_CHECKS_IN_AGREEMENT > 1) {
+    if(status != candidateStatus) {
+      candidateStatus = status;
+      candidateCount  = 1;
+      return;
+    }
+    if(++candidateCount < MP3_STATUS_CHECKS_IN_AGREEMENT) {
+      return;
+    }
+  }
+  candidateCount = 0;
+
+  int previous  = currentStatus;
+  currentStatus = status;
+
+  switch(status) {
+    case MP3_STATUS_PLAYING:
+      if(previous == MP3_STATUS_STOPPED) {
+        playedMs = 0; // Playing from a stop starts the track from the beginning
+      }
+      this->publish(playingCallback, playingContext);
+      break;
+
+    case MP3_STATUS_PAUSED:
+      this->publish(pausedCallback, pausedContext);
+      break;
+
+    default:
+      playedMs = -1;
+      this->publish(stoppedCallback, stoppedContext);
+      break;
+  }
+}
+
+
+void jq8400StatusMonitor::indexSample(int index) {
+  mp3->currentIndex = index;
+  mp3->indexReadAt  = mp3->millis();
+
+  if(index == currentIndex) {
+    return;
+  }
+
+  int previous = currentIndex;
+  int now      = mp3->millis();
+  currentIndex = index;
+  lengthMs     = -1;
+
+  // A new track starts from the beginning, but the first we see of one we did
+  // not watch being started could be anywhere in it.  One which the module went
+  // on to by itself started some time since the last sample, take the earliest
+  // so that its end is looked for too soon rather than too late.
+  if(commandedPoll) {
+    playedMs = 0;
+  } else if(previous >= 0) {
+    playedMs = (currentStatus == MP3_STATUS_PLAYING) ? now - lastSampleAt : 0;
+  } else {
+    playedMs = -1;
+  }
+  lastSampleAt = now;
+
+  if(previous >= 0) {
+    this->publish(trackCallback, trackContext);
+  }
+}
+
+
+void jq8400StatusMonitor::schedule() {
+  int interval = MP3_MONITOR_IDLE_MS;
+
+  if(candidateCount) {
+    interval = MP3_MONITOR_MIN_MS; // Confirm a change quickly
+  } else if(currentStatus == MP3_STATUS_PLAYING) {
+    int remaining = this->remainingMs();
+    if(remaining >= 0) {
+      // Halving the remaining time homes in on the end in a few polls
+      interval = remaining / 2;
+      if(interval < MP3_MONITOR_MIN_MS) interval = MP3_MONITOR_MIN_MS;
+      if(interval > MP3_MONITOR_MAX_MS) interval = MP3_MONITOR_MAX_MS;
+    }
+  }
+
+  nextPollAt = mp3->millis() + interval;
+}
+
+
+void jq8400StatusMonitor::publish(jq8400EventCallback callback, void *context) {
+  if(callback) {
+    callback(*mp3, currentIndex, context);
+  }
+}
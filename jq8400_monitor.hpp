@@ -0,0 +1,107 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#ifndef jq8400_monitor_h
+#define jq8400_monitor_h
+
+#include "jq8400.hpp"
+
+    #define MP3_MONITOR_MIN_MS      40      // Tightest status polling, used near the predicted end of a track
+    #define MP3_MONITOR_MAX_MS      2000    // Loosest status polling, used early in a long track
+    #define MP3_MONITOR_IDLE_MS     1000    // Polling while stopped or paused, or when the position is not known
+
+    typedef void (*jq8400EventCallback)(jq8400 &device, int index, void *context);
+
+    /** Publishes playback events instead of making you loop on busy()
+     *
+     *  Call service() from your main loop instead of jq8400::poll(), it never
+     *  blocks.  The status is polled asynchronously, rarely while a lot of the
+     *  track remains (known from its length and the position) and tightly as
+     *  the predicted end approaches, so the end of a track is noticed quickly
+     *  with little traffic on the UART.
+     *
+     *  Any command sent through the jq8400 which changes playback causes a poll
+     *  straight away, and what is learnt here also refreshes the jq8400's own
+     *  cached status and index, so busy() is cheap while monitoring.
+     *
+     *      jq8400StatusMonitor monitor(mp3);
+     *      monitor.onStopped(trackDone, 0);
+     *      while(1) { monitor.service(); ... }
+     */
+    class jq8400StatusMonitor
+    {
+    public:
+        jq8400StatusMonitor(jq8400 &device);
+
+        void    onStopped(jq8400EventCallback callback, void *context)      { stoppedCallback = callback; stoppedContext = context; }
+        void    onPlaying(jq8400EventCallback callback, void *context)      { playingCallback = callback; playingContext = context; }
+        void    onPaused(jq8400EventCallback callback, void *context)       { pausedCallback  = callback; pausedContext  = context; }
+        void    onTrackChanged(jq8400EventCallback callback, void *context) { trackCallback   = callback; trackContext   = context; }
+
+        void    service();
+
+        int     status()            { return currentStatus; }   ///< -1 until first known
+        int     index()             { return currentIndex;  }   ///< -1 until first known
+        int     remainingMs();                                  ///< -1 if not known
+        int     nextPollInMs()      { return nextPollAt - mp3->millis(); }
+        int     queriesSent()       { return queries; }
+
+    protected:
+        static void statusArrived(jq8400Request *request, void *context);
+        static void indexArrived(jq8400Request *request, void *context);
+        static void lengthArrived(jq8400Request *request, void *context);
+
+        void    statusSample(int status);
+        void    indexSample(int index);
+        void    schedule();
+        void    publish(jq8400EventCallback callback, void *context);
+
+        jq8400     *mp3;
+        int         inFlight;           ///< Queries submitted and not yet answered
+        int         nextPollAt;         ///< millis()
+        int         commandedPoll;      ///< The poll in flight was prompted by a command
+        int         recheck;            ///< A command was sent while a poll was in flight
+
+        int         currentStatus;
+        int         candidateStatus;    ///< Seen, but not yet MP3_STATUS_CHECKS_IN_AGREEMENT times
+        int         candidateCount;
+        int         currentIndex;
+        int         lengthMs;           ///< Of the current track, -1 if not known
+        int         playedMs;           ///< Time seen playing since the track started, -1 if not known
+        int         lastSampleAt;       ///< millis()
+        int         queries;
+
+        uint8_t     statusBuffer[1];
+        uint8_t     indexBuffer[2];
+        uint8_t     lengthBuffer[3];
+
+        jq8400EventCallback stoppedCallback, playingCallback, pausedCallback, trackCallback;
+        void               *stoppedContext, *playingContext, *pausedContext, *trackContext;
+    };
+
+#endif //jq8400_monitor_h
@@ -0,0 +1,215 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+
+#include "jq8400_phrase.hpp"
+
+void jq8400Phrase::begin(jq8400 &device, const jq8400Clip *clipTable, int length) {
+  mp3         = &device;
+  table       = clipTable;
+  tableLength = length;
+  inFlight    = 0;
+  frames      = 0;
+  queries     = 0;
+  this->clear();
+}
+
+
+void jq8400Phrase::clear() {
+  clips      = 0;
+  sentClips  = 0;
+  stage      = MP3_PHRASE_IDLE;
+}
+
+
+int jq8400Phrase::find(const char *word) {
+  for(int x = 0; x < tableLength; x++) {
+    if(!strcmp(table[x].word, word)) {
+      return x;
+    }
+  }
+  return -1;
+}
+
+
+int jq8400Phrase::clip(int entry) {
+  if(entry < 0 || entry >= tableLength || clips >= MP3_PHRASE_CLIPS) {
+    return 0;
+  }
+  entries[clips++] = entry;
+  return 1;
+}
+
+
+int jq8400Phrase::word(const char *word) {
+  return this->clip(this->find(word));
+}
+
+
+int jq8400Phrase::number(int value) {
+  int mark = clips;
+  if(value <= -1000000 || value >= 1000000 || !this->spell(value)) {
+    clips = mark; // All of it or none
+    return 0;
+  }
+  return 1;
+}
+
+
+// In words, "3 thousand 2 hundred and 40 5", each looked up in the table
+int jq8400Phrase::spell(int value) {
+  if(value < 0) {
+    if(!this->word("minus")) return 0;
+    value = -value;
+  }
+
+  int joined = 0;
+  if(value >= 1000) {
+    if(!this->spell(value / 1000) || !this->word("thousand")) return 0;
+    value %= 1000;
+    if(!value) return 1;
+    joined = 1;
+  }
+
+  if(value >= 100) {
+    if(!this->spell(value / 100) || !this->word("hundred")) return 0;
+    value %= 100;
+    if(!value) return 1;
+    joined = 1;
+  }
+
+  if(joined && this->find("and") >= 0) {
+    this->word("and");
+  }
+
+  char key[3];
+  if(value >= 20) {
+    key[0] = '0' + value / 10;
+    key[1] = '0';
+    key[2] = 0;
+    if(!this->word(key)) return 0;
+    value %= 10;
+    if(!value) return 1;
+  }
+
+  if(value >= 10) {
+    key[0] = '1';
+    key[1] = '0' + value % 10;
+    key[2] = 0;
+  } else {
+    key[0] = '0' + value;
+    key[1] = 0;
+  }
+  return this->word(key);
+}
+
+
+int jq8400Phrase::say() {
+  if(!clips) {
+    return 0;
+  }
+  sentClips = 0;
+  stage     = MP3_PHRASE_IDLE;
+  return this->sendPart();
+}
+
+
+// As many clips as one request holds, the module plays them back to back
+int jq8400Phrase::sendPart() {
+  if(!mp3->queueRoom()) {
+    return 0;
+  }
+
+  uint8_t data[MP3_MAX_REQUEST_LENGTH];
+  int     length = 0;
+  while(sentClips < clips && length + 2 <= MP3_MAX_REQUEST_LENGTH) {
+    const jq8400Clip &clip = table[entries[sentClips++]];
+    data[length++] = clip.name[0];
+    data[length++] = clip.name[1];
+  }
+
+  mp3->remember(jq8400::MP3_CMD_PLAYLIST, data, length, 0);
+  mp3->submit(jq8400::MP3_CMD_PLAYLIST, data, length);
+  frames++;
+
+  stage      = MP3_PHRASE_STARTING;
+  partSentAt = mp3->millis();
+  // With another part to come the first query goes straight behind the
+  // playlist (so is answered after it has started), the last part is only
+  // polled for speaking()
+  nextPollAt = partSentAt + (sentClips < clips ? 0 : this->pollMs());
+  return 1;
+}
+
+
+void jq8400Phrase::service() {
+  mp3->poll();
+
+  if(stage == MP3_PHRASE_IDLE || inFlight || mp3->millis() - nextPollAt < 0) {
+    return;
+  }
+
+  if(mp3->submitFrame(jq8400ConstFrame<jq8400::MP3_CMD_STATUS>::bytes, 4, statusBuffer, 1, &jq8400Phrase::statusArrived, this)) {
+    inFlight = 1;
+    queries++;
+  }
+}
+
+
+void jq8400Phrase::statusArrived(jq8400Request *request, void *context) {
+  jq8400Phrase *self = (jq8400Phrase *)context;
+  self->inFlight = 0;
+
+  int now = self->mp3->millis();
+  self->nextPollAt = now + self->pollMs();
+  if(request->result != MP3_FRAME_OK || self->stage == MP3_PHRASE_IDLE) {
+    return;
+  }
+
+  int status = self->statusBuffer[0];
+  self->mp3->currentStatus = status;
+  self->mp3->statusReadAt  = now;
+
+  if(status != MP3_STATUS_STOPPED) {
+    self->stage = MP3_PHRASE_PLAYING;
+    return;
+  }
+
+  // Stopped before it was seen playing may be the module yet to start
+  if(self->stage == MP3_PHRASE_STARTING && now - self->partSentAt < MP3_PHRASE_START_MS) {
+    return;
+  }
+
+  if(self->sentClips < self->clips) {
+    if(!self->sendPart()) {
+      self->nextPollAt = now; // Queue full, again next service()
+    }
+  } else {
+    self->stage = MP3_PHRASE_IDLE;
+  }
+}
@@ -0,0 +1,157 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+
+#ifndef jq8400_phrase_h
+#define jq8400_phrase_h
+
+#include "jq8400.hpp"
+
+    #define MP3_PHRASE_CLIPS        64      // Clips in one utterance
+    #define MP3_PHRASE_PART_CLIPS   (MP3_MAX_REQUEST_LENGTH / 2) // Clips in one MP3_CMD_PLAYLIST, two bytes each
+    #define MP3_PHRASE_POLL_MS      40      // Status polling while another part waits, for the end of the one playing
+    #define MP3_PHRASE_START_MS     1000    // A part not seen playing by then is taken as done (eg a missing clip)
+
+    /** One entry of a clip table, a word and the two character name of the
+     *  clip which says it (the module's MP3_CMD_PLAYLIST plays clips by name).
+     */
+    struct jq8400Clip
+    {
+        const char *word;
+        char        name[3];
+    };
+
+    constexpr int jq8400SameWord(const char *a, const char *b) {
+      return *a == *b && (!*a || jq8400SameWord(a + 1, b + 1));
+    }
+
+    constexpr int jq8400FindClip(const jq8400Clip *table, int length, const char *word, int at = 0) {
+      return at >= length ? -1 : jq8400SameWord(table[at].word, word) ? at : jq8400FindClip(table, length, word, at + 1);
+    }
+
+    /** The entry of a word in a constexpr clip table, found by the compiler
+     *  when the word is known at compile time, -1 if it is not in the table.
+     *
+     *      static constexpr jq8400Clip clips[] = { {"platform", "40"}, ... };
+     *      static constexpr int PLATFORM = jq8400FindClip(clips, "platform");
+     *      static_assert(PLATFORM >= 0, "no clip for platform");
+     */
+    template<int N>
+    constexpr int jq8400FindClip(const jq8400Clip (&table)[N], const char *word) {
+      return jq8400FindClip(table, N, word);
+    }
+
+    /** Says numbers and phrases made of short clips, "platform 12, 3 minutes",
+     *  as one MP3_CMD_PLAYLIST, which the module plays without a gap between
+     *  the clips and without being told when each one ends.
+     *
+     *  Words are looked up in a clip table.  For number() the table holds the
+     *  words "0" to "19", the tens "20" to "90", "hundred" and "thousand",
+     *  "minus" for negative numbers and, optionally, "and" ("one hundred and
+     *  five" rather than "one hundred five").
+     *
+     *      static constexpr jq8400Clip clips[] = {
+     *        {"0", "00"}, {"1", "01"}, ... {"90", "27"}, {"hundred", "28"},
+     *        {"thousand", "29"}, {"platform", "40"}, {"minutes", "41"}
+     *      };
+     *      jq8400Phrase phrase(mp3, clips);
+     *
+     *      phrase.clear();
+     *      phrase.clip(PLATFORM);                      // Resolved at compile time
+     *      phrase.number(12);
+     *      phrase.number(3);
+     *      phrase.word("minutes");                     // Looked up when said
+     *      phrase.say();
+     *      while(1) { phrase.service(); ... }
+     *
+     *  An utterance longer than one request carries (MP3_PHRASE_PART_CLIPS)
+     *  goes in parts, each sent when the one before has been seen to end,
+     *  which is the only time there is a gap.  The status is polled every
+     *  MP3_PHRASE_POLL_MS while another part waits, and for the last (or
+     *  only) part every MP3_PLAYBACK_CACHE_MS, just so speaking() knows when
+     *  it is done.  Call service() instead of jq8400::poll() while speaking()
+     *  and it never blocks.
+     *
+     *  Compose the next utterance once this one is done, or say() it to cut
+     *  this one short.
+     */
+    class jq8400Phrase
+    {
+    public:
+        template<int N>
+        jq8400Phrase(jq8400 &device, const jq8400Clip (&clipTable)[N]) {
+          static_assert(N <= 255, "a clip table holds up to 255 clips");
+          this->begin(device, clipTable, N);
+        }
+
+        void    clear();
+        int     clip(int entry);                ///< An entry of the table, returns 0 if the utterance is full
+        int     word(const char *word);         ///< Returns 0 if the word is not in the table (or the utterance is full)
+        int     number(int value);              ///< -999999 to 999999, nothing is added if it can not be said
+
+        int     say();                          ///< Returns 0 if there is nothing to say or the queue is full
+        void    service();
+        int     speaking()          { return stage != MP3_PHRASE_IDLE; }
+
+        int     length()            { return clips; }
+        int     parts()             { return (clips + MP3_PHRASE_PART_CLIPS - 1) / MP3_PHRASE_PART_CLIPS; }
+        int     framesSent()        { return frames; }
+        int     queriesSent()       { return queries; }
+
+    protected:
+        static const int MP3_PHRASE_IDLE     = 0;
+        static const int MP3_PHRASE_STARTING = 1;  ///< Part sent, not yet seen playing
+        static const int MP3_PHRASE_PLAYING  = 2;
+
+        void    begin(jq8400 &device, const jq8400Clip *clipTable, int length);
+        int     find(const char *word);
+        int     spell(int value);
+        int     sendPart();
+        int     pollMs()            { return sentClips < clips ? MP3_PHRASE_POLL_MS : MP3_PLAYBACK_CACHE_MS; }
+
+        static void statusArrived(jq8400Request *request, void *context);
+
+        jq8400     *mp3;
+        const jq8400Clip *table;
+        int         tableLength;
+
+        uint8_t     entries[MP3_PHRASE_CLIPS];  ///< Of the table
+        int         clips;
+        int         sentClips;                  ///< In parts already sent
+
+        int         stage;
+        int         partSentAt;                 ///< millis()
+        int         nextPollAt;                 ///< millis()
+        int         inFlight;
+        uint8_t     statusBuffer[1];
+
+        int         frames;
+        int         queries;
+    };
+
+#endif //jq8400_phrase_h
@@ -0,0 +1,273 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#include "jq8400_playlist.hpp"
+
+jq8400Playlist::jq8400Playlist(jq8400 &device, uint16_t *arena, int arenaCapacity) : statusMonitor(device) {
+  mp3              = &device;
+  entries          = arena;
+  capacity         = arenaCapacity;
+  length           = 0;
+  repeat           = MP3_PLAYLIST_REPEAT_NONE;
+  shuffling        = 0;
+  random           = 1;
+  isRunning        = 0;
+  userLoop         = device.currentLoop;
+  cursor           = 0;
+  expected         = -1;
+  played           = 0;
+  armed            = 0;
+  nextCursor       = -1;
+  nextFrameLength  = 0;
+  finishedCallback = 0;
+  finishedContext  = 0;
+
+  statusMonitor.onStopped(&jq8400Playlist::stoppedEvent, this);
+  statusMonitor.onTrackChanged(&jq8400Playlist::trackEvent, this);
+}
+
+
+int jq8400Playlist::add(int index) {
+  if(length >= capacity || index < 1 || index > 0xFFFF) {
+    return 0;
+  }
+  entries[length++] = index;
+  armed = 0; // What comes next may have changed
+  return 1;
+}
+
+
+void jq8400Playlist::clear() {
+  this->stop();
+  length = 0;
+}
+
+
+void jq8400Playlist::setShuffle(int shuffleOn, unsigned int seed) {
+  shuffling = shuffleOn;
+  random    = seed ? seed : 1;
+  if(shuffling) {
+    this->shuffle();
+  }
+}
+
+
+void jq8400Playlist::start(int position) {
+  if(position < 0 || position >= length) {
+    return;
+  }
+  if(!isRunning) {
+    userLoop = mp3->currentLoop;
+  }
+  isRunning = 1;
+  this->playEntry(position);
+}
+
+
+void jq8400Playlist::skip() {
+  if(isRunning) {
+    this->advance();
+  }
+}
+
+
+void jq8400Playlist::stop() {
+  if(!isRunning) {
+    return;
+  }
+  isRunning = 0;
+  armed     = 0;
+  mp3->stop();
+  this->restoreLoop();
+}
+
+
+// arm() changes the loop mode as it goes, put back the one the user had
+void jq8400Playlist::restoreLoop() {
+  if(mp3->currentLoop != userLoop) {
+    uint8_t mode = userLoop;
+    mp3->currentLoop = userLoop;
+    mp3->submit(jq8400::MP3_CMD_LOOP_SET, &mode, 1);
+  }
+}
+
+
+void jq8400Playlist::service() {
+  statusMonitor.service();
+
+  // Arm once the monitor knows how long the track is, from then on the end of
+  // it is only a matter of waiting
+  if(isRunning && !armed && statusMonitor.index() == expected
+      && statusMonitor.status() == MP3_STATUS_PLAYING && statusMonitor.remainingMs() >= 0) {
+    this->arm();
+  }
+}
+
+
+// Sets things up for the end of the current track, the module's loop mode and
+// the frame to send if it is up to us
+void jq8400Playlist::arm() {
+  nextCursor = this->following(cursor);
+
+  int loop = MP3_LOOP_ONE_STOP;
+  if(repeat == MP3_PLAYLIST_REPEAT_ONE) {
+    loop = MP3_LOOP_ONE;        // The module repeats it for us
+  } else if(nextCursor >= 0 && entries[nextCursor] == entries[cursor] + 1) {
+    loop = MP3_LOOP_ALL_STOP;   // The module goes on to the next index for us
+  }
+
+  if(loop != mp3->currentLoop) {
+    uint8_t mode = loop;
+    mp3->currentLoop = loop;
+    mp3->submit(jq8400::MP3_CMD_LOOP_SET, &mode, 1);
+  }
+
+  if(nextCursor >= 0) {
+    uint8_t word[2] = { (uint8_t)(entries[nextCursor] >> 8), (uint8_t)entries[nextCursor] };
+    nextFrameLength = jq8400::encodeFrame(nextFrame, jq8400::MP3_CMD_PLAY_IDX, word, 2);
+  }
+  armed = 1;
+}
+
+
+// On to the next entry now, or finish
+void jq8400Playlist::advance() {
+  if(!armed) {
+    nextCursor      = this->following(cursor);
+    nextFrameLength = 0;
+  }
+
+  if(nextCursor < 0) {
+    isRunning = 0;
+    armed     = 0;
+    this->restoreLoop();
+    if(finishedCallback) {
+      finishedCallback(*mp3, expected, finishedContext);
+    }
+    return;
+  }
+
+  if(nextFrameLength) {
+    cursor   = nextCursor;
+    expected = entries[cursor];
+    armed    = 0;
+    played++;
+    mp3->submitFrame(nextFrame, nextFrameLength);
+    mp3->invalidatePlayback();
+  } else {
+    this->playEntry(nextCursor);
+  }
+}
+
+
+void jq8400Playlist::playEntry(int position) {
+  uint8_t word[2] = { (uint8_t)(entries[position] >> 8), (uint8_t)entries[position] };
+
+  cursor   = position;
+  expected = entries[position];
+  armed    = 0;
+  played++;
+  mp3->submit(jq8400::MP3_CMD_PLAY_IDX, word, 2);
+  mp3->invalidatePlayback(); // The monitor takes this as its cue to look
+}
+
+
+// Position after the given one, -1 if there is none.  Going round again with
+// shuffle on reshuffles, so this moves entries about, but the entry at the
+// given position is put back there so that it (and cursor) still means the
+// track playing.
+int jq8400Playlist::following(int position) {
+  if(repeat == MP3_PLAYLIST_REPEAT_ONE) {
+    return position;
+  }
+  if(position + 1 < length) {
+    return position + 1;
+  }
+  if(repeat != MP3_PLAYLIST_REPEAT_ALL || !length) {
+    return -1;
+  }
+
+  if(shuffling && length > 1) {
+    uint16_t current = entries[position];
+    this->shuffle();
+    for(int x = 0; x < length; x++) {
+      if(entries[x] == current) {
+        // Back where it was, which is the end, so not the same track twice in a row
+        entries[x]        = entries[position];
+        entries[position] = current;
+        break;
+      }
+    }
+  }
+  return 0;
+}
+
+
+// Fisher-Yates, in place so no more memory is needed however long the list
+void jq8400Playlist::shuffle() {
+  for(int x = length - 1; x > 0; x--) {
+    random ^= random << 13;
+    random ^= random >> 17;
+    random ^= random << 5;
+
+    int y      = random % (x + 1);
+    uint16_t t = entries[x];
+    entries[x] = entries[y];
+    entries[y] = t;
+  }
+  armed = 0;
+}
+
+
+void jq8400Playlist::stoppedEvent(jq8400 &, int index, void *context) {
+  jq8400Playlist *self = (jq8400Playlist *)context;
+  if(self->isRunning && index == self->expected) {
+    self->advance();
+  }
+}
+
+
+// The index changed under us, either the module went on to the next entry as
+// it was armed to, or somebody else is playing something
+void jq8400Playlist::trackEvent(jq8400 &, int index, void *context) {
+  jq8400Playlist *self = (jq8400Playlist *)context;
+  if(!self->isRunning || index == self->expected) {
+    return;
+  }
+
+  if(self->armed && self->nextCursor >= 0 && index == self->entries[self->nextCursor]) {
+    self->cursor   = self->nextCursor;
+    self->expected = index;
+    self->armed    = 0;
+    self->played++;
+  } else {
+    self->isRunning = 0;
+    self->armed     = 0;
+    self->restoreLoop();
+  }
+}
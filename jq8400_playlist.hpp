@@ -0,0 +1,124 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#ifndef jq8400_playlist_h
+#define jq8400_playlist_h
+
+#include "jq8400_monitor.hpp"
+
+    #define MP3_PLAYLIST_REPEAT_NONE    0   // Stop after the last entry
+    #define MP3_PLAYLIST_REPEAT_ONE     1   // Play the current entry over and over
+    #define MP3_PLAYLIST_REPEAT_ALL     2   // Go back to the first entry after the last (reshuffled if shuffling)
+
+    /** Plays a list of file indexes of any length, sequenced from the host.
+     *
+     *  The module's own MP3_CMD_PLAYLIST only takes two character file names,
+     *  as many as fit in one frame, so this keeps the list itself: 2 bytes per
+     *  entry in storage you provide, so a few thousand entries is no problem.
+     *
+     *  Each track is armed as soon as its length is known.  If the next entry
+     *  is the following index the module is left to go on to it by itself
+     *  (MP3_LOOP_ALL_STOP) with no gap at all, otherwise it is told to stop
+     *  at the end (MP3_LOOP_ONE_STOP) and the next MP3_CMD_PLAY_IDX, already
+     *  encoded, goes out as soon as the monitor sees it stop.  So the loop mode
+     *  of the module belongs to the playlist while it is running, the one it
+     *  had before is put back when the playlist stops or finishes.
+     *
+     *      static uint16_t tracks[2000];
+     *      jq8400Playlist list(mp3, tracks, 2000);
+     *      for(...) list.add(index);
+     *      list.setShuffle(1, seed);
+     *      list.start();
+     *      while(1) { list.service(); ... }
+     *
+     *  Call service() instead of jq8400StatusMonitor::service() or
+     *  jq8400::poll(), and use stop() rather than jq8400::stop() or the next
+     *  entry is played.  The stopped and track changed callbacks of monitor()
+     *  are the playlist's, the others are free.
+     */
+    class jq8400Playlist
+    {
+    public:
+        jq8400Playlist(jq8400 &device, uint16_t *arena, int capacity);
+
+        int     add(int index);                             ///< Returns 0 if the arena is full
+        void    clear();
+        int     count()             { return length; }
+        int     entry(int position) { return entries[position]; }
+
+        void    setRepeat(int repeatMode)                   { repeat = repeatMode; armed = 0; }
+        void    setShuffle(int shuffleOn, unsigned int seed = 1);
+        void    onFinished(jq8400EventCallback callback, void *context) { finishedCallback = callback; finishedContext = context; }
+
+        void    start(int position = 0);
+        void    skip();                                     ///< Straight on to the next entry
+        void    stop();
+        void    service();
+
+        int     running()           { return isRunning; }
+        int     position()          { return cursor; }      ///< Of the entry playing
+        int     tracksPlayed()      { return played; }
+        jq8400StatusMonitor &monitor() { return statusMonitor; }
+
+    protected:
+        static void stoppedEvent(jq8400 &device, int index, void *context);
+        static void trackEvent(jq8400 &device, int index, void *context);
+
+        void    arm();
+        void    advance();
+        void    playEntry(int position);
+        void    restoreLoop();
+        int     following(int position);
+        void    shuffle();
+
+        jq8400             *mp3;
+        jq8400StatusMonitor statusMonitor;
+
+        uint16_t   *entries;
+        int         capacity;
+        int         length;
+
+        int         repeat;
+        int         shuffling;
+        unsigned    random;
+
+        int         isRunning;
+        int         userLoop;           ///< Loop mode before start(), put back after
+        int         cursor;             ///< Position of the entry playing
+        int         expected;           ///< Index we told the module to play
+        int         played;
+        int         armed;              ///< The next entry is ready to go
+        int         nextCursor;         ///< Position of the next entry, -1 at the end of the list
+        uint8_t     nextFrame[MP3_MAX_FRAME_LENGTH];
+        int         nextFrameLength;
+
+        jq8400EventCallback finishedCallback;
+        void               *finishedContext;
+    };
+
+#endif //jq8400_playlist_h
@@ -0,0 +1,278 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#if defined(JQ8400_POSIX)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "jq8400.hpp"
+
+static speed_t baudToSpeed(int baud) {
+  switch(baud) {
+    case 1200:   return B1200;
+    case 2400:   return B2400;
+    case 4800:   return B4800;
+    case 19200:  return B19200;
+    case 38400:  return B38400;
+    case 57600:  return B57600;
+    case 115200: return B115200;
+    default:     return B9600;
+  }
+}
+
+
+jq8400PosixTransport::jq8400PosixTransport(const char *device, int baud) {
+  inHead = inTail = 0;
+  outHead = outTail = 0;
+  handler        = 0;
+  handlerContext = 0;
+  inHandler      = 0;
+
+  ttyFd = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if(ttyFd < 0) {
+    return;
+  }
+
+  // Raw 8N1, no flow control, nothing translated
+  struct termios tio;
+  if(tcgetattr(ttyFd, &tio) == 0) {
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+    tio.c_cc[VMIN]  = 0;
+    tio.c_cc[VTIME] = 0;
+    cfsetispeed(&tio, baudToSpeed(baud));
+    cfsetospeed(&tio, baudToSpeed(baud));
+    tcsetattr(ttyFd, TCSANOW, &tio);
+  }
+  tcflush(ttyFd, TCIOFLUSH);
+}
+
+
+jq8400PosixTransport::~jq8400PosixTransport() {
+  if(ttyFd >= 0) {
+    close(ttyFd);
+  }
+}
+
+
+int jq8400PosixTransport::putc(int c) {
+  if(!writeable()) {
+    service(); // Make some room
+  }
+  if(writeable()) {
+    out[outHead] = c;
+    outHead = (outHead + 1) % MP3_POSIX_BUFFER;
+  }
+  return c;
+}
+
+
+int jq8400PosixTransport::getc() {
+  if(inTail == inHead) {
+    return -1;
+  }
+  int c  = in[inTail];
+  inTail = (inTail + 1) % MP3_POSIX_BUFFER;
+  return c;
+}
+
+
+void jq8400PosixTransport::delay(int ms) {
+  long long until = monotonicUs() + ms * 1000LL;
+  while(monotonicUs() < until) {
+    service();
+    usleep(1000);
+  }
+}
+
+
+void jq8400PosixTransport::service() {
+  if(ttyFd < 0) {
+    return;
+  }
+
+  while(outTail != outHead) {
+    int run = (outHead > outTail ? outHead : MP3_POSIX_BUFFER) - outTail;
+    int n   = write(ttyFd, &out[outTail], run);
+    if(n <= 0) break; // EAGAIN, the tty will take more later
+    outTail = (outTail + n) % MP3_POSIX_BUFFER;
+  }
+
+  int received = 0;
+  for(;;) {
+    // Contiguous free space, one slot is always left empty to tell full from empty
+    int space = (inHead >= inTail) ? MP3_POSIX_BUFFER - inHead - (inTail == 0) : inTail - inHead - 1;
+    if(space <= 0) break;
+    int n = read(ttyFd, &in[inHead], space);
+    if(n <= 0) break;
+    inHead    = (inHead + n) % MP3_POSIX_BUFFER;
+    received += n;
+  }
+
+  if(received && handler && !inHandler) {
+    inHandler = 1;
+    handler(handlerContext);
+    inHandler = 0;
+  }
+}
+
+
+long long jq8400PosixTransport::monotonicUs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+
+jq8400Multiplexer::jq8400Multiplexer() {
+  epollFd     = epoll_create1(EPOLL_CLOEXEC);
+  deviceCount = 0;
+  lastPending = 0;
+}
+
+
+jq8400Multiplexer::~jq8400Multiplexer() {
+  if(epollFd >= 0) {
+    close(epollFd);
+  }
+}
+
+
+int jq8400Multiplexer::add(jq8400 &device) {
+  if(deviceCount >= MP3_MUX_MAX_DEVICES || !device.isOpen()) {
+    return 0;
+  }
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events   = EPOLLIN;
+  ev.data.ptr = &device;
+  if(epoll_ctl(epollFd, EPOLL_CTL_ADD, device.fd(), &ev) != 0) {
+    return 0;
+  }
+
+  devices[deviceCount++] = &device;
+  return 1;
+}
+
+
+void jq8400Multiplexer::remove(jq8400 &device) {
+  for(int x = 0; x < deviceCount; x++) {
+    if(devices[x] == &device) {
+      epoll_ctl(epollFd, EPOLL_CTL_DEL, device.fd(), 0);
+      devices[x] = devices[--deviceCount];
+      return;
+    }
+  }
+}
+
+
+// Waits for any module to have something to read (at most maxWaitMs, or a
+// millisecond while commands are outstanding so timeouts and the gap between
+// commands are honoured), then runs every module's engine.  Returns the
+// number of commands still outstanding across all modules.
+int jq8400Multiplexer::run(int maxWaitMs) {
+  struct epoll_event events[MP3_MUX_MAX_DEVICES];
+
+  // Whatever was submitted since the last run goes out now, rather than after
+  // waiting for a descriptor which has no reason to become ready
+  int pending = 0;
+  for(int x = 0; x < deviceCount; x++) {
+    pending += devices[x]->poll();
+  }
+
+  int wait = pending ? (maxWaitMs < 1 ? maxWaitMs : 1) : maxWaitMs;
+  int n    = epoll_wait(epollFd, events, MP3_MUX_MAX_DEVICES, wait);
+  for(int x = 0; x < n; x++) {
+    ((jq8400 *)events[x].data.ptr)->service();
+  }
+
+  lastPending = 0;
+  for(int x = 0; x < deviceCount; x++) {
+    lastPending += devices[x]->poll();
+  }
+  return lastPending;
+}
+
+
+jq8400EmulatorPty::jq8400EmulatorPty(jq8400Emulator &device) {
+  emulator     = &device;
+  slaveName[0] = 0;
+  lastServiced = jq8400PosixTransport::monotonicUs();
+
+  masterFd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if(masterFd < 0) {
+    return;
+  }
+  if(grantpt(masterFd) != 0 || unlockpt(masterFd) != 0 || ptsname_r(masterFd, slaveName, sizeof(slaveName)) != 0) {
+    close(masterFd);
+    masterFd     = -1;
+    slaveName[0] = 0;
+  }
+}
+
+
+jq8400EmulatorPty::~jq8400EmulatorPty() {
+  if(masterFd >= 0) {
+    close(masterFd);
+  }
+}
+
+
+void jq8400EmulatorPty::service() {
+  if(masterFd < 0) {
+    return;
+  }
+
+  // Bring the emulator up to real time, then move bytes both ways
+  long long now = jq8400PosixTransport::monotonicUs();
+  emulator->advance(now - lastServiced);
+  lastServiced = now;
+
+  unsigned char buf[64];
+  int n;
+  while((n = read(masterFd, buf, sizeof(buf))) > 0) {
+    for(int x = 0; x < n; x++) {
+      emulator->hostWrite(buf[x]);
+    }
+  }
+
+  while(emulator->hostReadable()) {
+    unsigned char c = emulator->hostRead();
+    if(write(masterFd, &c, 1) != 1) break;
+  }
+}
+
+#endif
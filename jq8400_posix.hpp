@@ -0,0 +1,133 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#ifndef jq8400_posix_h
+#define jq8400_posix_h
+
+    #define MP3_POSIX_BUFFER        256     // Bytes buffered each way between the driver and the tty
+    #define MP3_MUX_MAX_DEVICES     64
+
+    /** Transport for the jq8400 class on a Linux tty (USB serial adapters, or the
+     *  slave side of a pseudo-tty in tests).  Build with JQ8400_POSIX defined.
+     *
+     *  The file descriptor is non-blocking, bytes are moved to and from it by
+     *  service(), which is called whenever the driver reads the clock and by
+     *  jq8400Multiplexer when epoll says the descriptor is readable.
+     */
+    class jq8400PosixTransport
+    {
+    public:
+        jq8400PosixTransport(const char *device, int baud = 9600);
+        ~jq8400PosixTransport();
+
+        int     putc(int c);
+        int     getc();
+        int     readable()          { return inTail != inHead; }
+        int     writeable()         { return ((outHead + 1) % MP3_POSIX_BUFFER) != outTail; }
+
+        void    attachRx(void (*rxHandler)(void *), void *context) {
+          handler        = rxHandler;
+          handlerContext = context;
+        }
+
+        int     millis()            { service(); return (int)(monotonicUs() / 1000); }
+        int     micros()            { service(); return (int)(monotonicUs()); }
+        void    delay(int ms);
+
+        int     fd()                { return ttyFd; }
+        int     isOpen()            { return ttyFd >= 0; }
+        void    service();
+
+        static long long monotonicUs();
+
+    protected:
+        int             ttyFd;
+        unsigned char   in[MP3_POSIX_BUFFER];
+        int             inHead, inTail;
+        unsigned char   out[MP3_POSIX_BUFFER];
+        int             outHead, outTail;
+        void          (*handler)(void *);
+        void           *handlerContext;
+        int             inHandler;
+    };
+
+    class jq8400;
+
+    /** Drives many modules from one thread
+     *
+     *  Each module keeps its own queue (see jq8400::submit()), run() waits on all
+     *  of their descriptors at once with epoll and then polls every module, so
+     *  commands on different modules overlap instead of queueing behind each
+     *  other's response waits.
+     *
+     *     jq8400Multiplexer mux;
+     *     jq8400 a("/dev/ttyUSB0"), b("/dev/ttyUSB1");
+     *     mux.add(a); mux.add(b);
+     *     a.submit(...); b.submit(...);
+     *     while(mux.run(100)) { }
+     */
+    class jq8400Multiplexer
+    {
+    public:
+        jq8400Multiplexer();
+        ~jq8400Multiplexer();
+
+        int     add(jq8400 &device);
+        void    remove(jq8400 &device);
+        int     run(int maxWaitMs);
+        int     count()             { return deviceCount; }
+
+    protected:
+        int         epollFd;
+        jq8400     *devices[MP3_MUX_MAX_DEVICES];
+        int         deviceCount;
+        int         lastPending;
+    };
+
+    /** A jq8400Emulator behind a pseudo-tty, so the tty transport and the
+     *  multiplexer can be exercised without hardware.  The emulator runs in
+     *  real time, call service() regularly (or add fd() to your own epoll set).
+     */
+    class jq8400EmulatorPty
+    {
+    public:
+        jq8400EmulatorPty(jq8400Emulator &device);
+        ~jq8400EmulatorPty();
+
+        const char *name()          { return slaveName; }
+        int     fd()                { return masterFd; }
+        void    service();
+
+    protected:
+        jq8400Emulator *emulator;
+        int             masterFd;
+        char            slaveName[64];
+        long long       lastServiced;
+    };
+
+#endif //jq8400_posix_h
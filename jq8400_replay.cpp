@@ -0,0 +1,192 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#include "jq8400.hpp"
+#include "jq8400_replay.hpp"
+
+jq8400Capture::jq8400Capture(const unsigned char *trace, int traceLength) {
+  blob    = trace;
+  entries = -1;
+  origin  = 0;
+
+  if(traceLength < 5 || trace[0] != MP3_TRACE_VERSION) {
+    return;
+  }
+  uint32_t count = ((uint32_t)trace[1] << 24) | ((uint32_t)trace[2] << 16) | (trace[3] << 8) | trace[4];
+  if((uint32_t)(traceLength - 5) / 5 < count) {
+    return;
+  }
+
+  entries = count;
+  if(entries) {
+    origin = ((uint32_t)blob[5] << 24) | ((uint32_t)blob[6] << 16) | (blob[7] << 8) | blob[8];
+  }
+}
+
+
+// The recorder's micros() wraps, 31 bits of it are kept so differences are
+// good for about 35 minutes
+int jq8400Capture::atUs(int i) {
+  const unsigned char *entry = &blob[5 + i * 5];
+  uint32_t stamp = ((uint32_t)entry[0] << 24) | ((uint32_t)entry[1] << 16) | (entry[2] << 8) | entry[3];
+  return (stamp - origin) & ~MP3_TRACE_TX;
+}
+
+
+void jq8400AnalyseCapture(jq8400Capture &capture, jq8400CaptureStats &stats) {
+  jq8400FrameDecoder decoder;
+  uint8_t            data[MP3_MAX_RESPONSE_LENGTH];
+  long long          totalResponseUs = 0;
+  int                lastSentAt      = -1;   // Of a command not yet answered
+
+  decoder.reset(-1, data, sizeof(data));
+  memset(&stats, 0, sizeof(stats));
+
+  for(int i = 0; i < capture.length(); i++) {
+    int at = capture.atUs(i);
+    stats.durationUs = at;
+
+    if(capture.sent(i)) {
+      stats.bytesSent++;
+      lastSentAt = at;
+      continue;
+    }
+
+    stats.bytesReceived++;
+    int r = decoder.feed(capture.byte(i));
+    if(r == MP3_FRAME_BAD_CHECKSUM) {
+      stats.badChecksums++;
+    } else if(r == MP3_FRAME_OK) {
+      stats.frames++;
+      if(lastSentAt >= 0) {
+        int elapsed = at - lastSentAt;
+        stats.responses++;
+        totalResponseUs += elapsed;
+        if(elapsed > stats.maxResponseUs) {
+          stats.maxResponseUs = elapsed;
+        }
+        lastSentAt = -1;
+      }
+    }
+  }
+
+  stats.meanResponseUs = stats.responses ? (int)(totalResponseUs / stats.responses) : 0;
+}
+
+
+jq8400ReplayTransport::jq8400ReplayTransport(jq8400Capture &source) {
+  capture         = &source;
+  clock           = 0;
+  costPerCall     = 5;
+  byteTime        = 10000000 / 9600;
+  lineFree        = 0;
+  rxNext          = 0;
+  rxAnchor        = 0;
+  rxAnchorAt      = 0;
+  txNext          = 0;
+  txCount         = 0;
+  txMismatches    = 0;
+  txFirstMismatch = -1;
+  handler         = 0;
+  handlerContext  = 0;
+  inHandler       = 0;
+  memset(txAt, 0, sizeof(txAt));
+
+  this->seekReceived();
+}
+
+
+int jq8400ReplayTransport::putc(int c) {
+  while(txNext < capture->length() && !capture->sent(txNext)) {
+    txNext++;
+  }
+
+  int expected = txNext < capture->length() ? capture->byte(txNext++) : -1;
+  if((c & 0xFF) != expected) {
+    if(!txMismatches++) {
+      txFirstMismatch = txCount;
+    }
+  }
+
+  txAt[txCount++ & (MP3_REPLAY_AHEAD - 1)] = clock;
+  lineFree = (clock > lineFree ? clock : lineFree) + byteTime;
+  return c;
+}
+
+
+// The next received byte is due as long after the byte sent before it as it
+// was in the capture, once the driver has sent that byte
+int jq8400ReplayTransport::readable() {
+  if(rxNext >= capture->length()) {
+    return 0;
+  }
+  if(!rxAnchor) {
+    return clock >= capture->atUs(rxNext); // Before any command, eg power on noise
+  }
+  if(txCount < rxAnchor) {
+    return 0;
+  }
+  return clock >= txAt[(rxAnchor - 1) & (MP3_REPLAY_AHEAD - 1)] + (capture->atUs(rxNext) - rxAnchorAt);
+}
+
+
+int jq8400ReplayTransport::getc() {
+  if(!this->readable()) {
+    return -1;
+  }
+  int c = capture->byte(rxNext++);
+  this->seekReceived();
+  return c;
+}
+
+
+// On past the bytes sent, to the next one received
+void jq8400ReplayTransport::seekReceived() {
+  while(rxNext < capture->length() && capture->sent(rxNext)) {
+    rxAnchor++;
+    rxAnchorAt = capture->atUs(rxNext);
+    rxNext++;
+  }
+}
+
+
+// In steps of at most a millisecond, so that the RX handler sees bytes at
+// about the time they are due, even through a long delay()
+void jq8400ReplayTransport::elapse(long long microseconds) {
+  while(microseconds > 0) {
+    long long step = microseconds < 1000 ? microseconds : 1000;
+    clock        += step;
+    microseconds -= step;
+
+    if(handler && !inHandler && this->readable()) {
+      inHandler = 1;
+      handler(handlerContext);
+      inHandler = 0;
+    }
+  }
+}
@@ -0,0 +1,140 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#ifndef jq8400_replay_h
+#define jq8400_replay_h
+
+#include <stdint.h>
+
+    #define MP3_REPLAY_AHEAD        256     // Bytes the driver may send ahead of the responses, must be a power of two
+
+    /** A trace from jq8400::exportTrace() (built with MP3_TRACE 1), read in
+     *  place.  Times are in microseconds from the first byte.
+     */
+    class jq8400Capture
+    {
+    public:
+        jq8400Capture(const unsigned char *blob, int blobLength);
+
+        int     valid()             { return entries >= 0; }
+        int     length()            { return entries; }     ///< Bytes in the trace, -1 if it is not one
+        int     sent(int i)         { return (blob[5 + i * 5] & 0x80) != 0; }
+        int     byte(int i)         { return blob[5 + i * 5 + 4]; }
+        int     atUs(int i);
+
+    protected:
+        const unsigned char *blob;
+        int                  entries;
+        uint32_t             origin;
+    };
+
+    /** What can be learnt from a capture without the driver, every byte the
+     *  module sent goes through the same jq8400FrameDecoder as the driver's.
+     */
+    struct jq8400CaptureStats
+    {
+        int     bytesSent;
+        int     bytesReceived;
+        int     frames;             ///< Received with a good checksum
+        int     badChecksums;
+        int     responses;          ///< Frames which followed a command
+        int     meanResponseUs;     ///< From the last byte of a command to the end of the frame after it
+        int     maxResponseUs;
+        int     durationUs;
+    };
+
+    void    jq8400AnalyseCapture(jq8400Capture &capture, jq8400CaptureStats &stats);
+
+    /** Transport for the jq8400 class which plays a capture back to it, build
+     *  with JQ8400_REPLAY defined to use it.
+     *
+     *  Run the same calls as were made when the capture was recorded.  Each
+     *  received byte is delivered as long after the command byte before it as
+     *  it was in the capture, so the module's side keeps its timing, and the
+     *  driver's side is free to be quicker or slower than it was: compare
+     *  elapsedUs() with the capture's duration.  What the driver sends is
+     *  checked against what was sent then.
+     *
+     *  Like jq8400EmulatedTransport the clock is virtual and each reading of
+     *  it costs a few microseconds, so a replay always gives the same result.
+     *
+     *      jq8400Capture capture(blob, blobLength);   // eg fread() from a file
+     *      jq8400 mp3(capture);
+     *      mp3.playFileByIndexNumber(3); ...          // as when recorded
+     *      if(mp3.mismatches() || !mp3.finished()) ...
+     */
+    class jq8400ReplayTransport
+    {
+    public:
+        jq8400ReplayTransport(jq8400Capture &capture);
+
+        int     putc(int c);
+        int     getc();
+        int     readable();
+        int     writeable()         { return lineFree <= clock + byteTime; } ///< Like a UART with a one byte FIFO
+
+        void    attachRx(void (*rxHandler)(void *), void *context) {
+          handler        = rxHandler;
+          handlerContext = context;
+        }
+
+        int     millis()            { elapse(costPerCall); return (int)(clock / 1000); }
+        int     micros()            { elapse(costPerCall); return (int)clock; }
+        void    delay(int ms)       { elapse(ms * 1000LL); }
+
+        int     mismatches()        { return txMismatches; }    ///< Bytes sent which differ from the capture
+        int     firstMismatch()     { return txFirstMismatch; } ///< Byte sent at which they first differ, -1 if none
+        int     finished()          { return rxNext >= capture->length(); } ///< Every received byte has been delivered
+        long long elapsedUs()       { return clock; }
+        void    setCostPerCall(int microseconds) { costPerCall = microseconds; }
+        void    setBaud(int baud)   { byteTime = 10000000 / baud; }
+
+    protected:
+        void    elapse(long long microseconds);
+        void    seekReceived();
+
+        jq8400Capture  *capture;
+        long long       clock;
+        int             costPerCall;
+        int             byteTime;
+        long long       lineFree;           ///< When the byte being sent is gone
+
+        int             rxNext;             ///< Next received byte in the capture
+        int             rxAnchor;           ///< Count of bytes sent before it in the capture
+        int             rxAnchorAt;         ///< Capture time of the last of those
+        int             txNext;             ///< Next sent byte in the capture
+        int             txCount;            ///< Bytes the driver has sent
+        int             txMismatches, txFirstMismatch;
+        long long       txAt[MP3_REPLAY_AHEAD]; ///< When the driver sent each of the last few bytes
+
+        void          (*handler)(void *);
+        void           *handlerContext;
+        int             inHandler;
+    };
+
+#endif //jq8400_replay_h
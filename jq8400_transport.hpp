@@ -0,0 +1,103 @@
+/**
+ * Arduino Library for jq8400 MP3 Module
+ *
+ * Copyright (C) 2019 James Sleeman, <http://sparks.gogo.co.nz/jq6500/index.html>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @author James Sleeman, http://sparks.gogo.co.nz/
+ * @license MIT License
+ * @file
+ */
+
+#ifndef jq8400_transport_h
+#define jq8400_transport_h
+
+    /* The jq8400 class derives from JQ8400_TRANSPORT, which is chosen at compile
+     * time so there is no virtual dispatch between the driver and the UART.
+     *
+     * A transport provides
+     *
+     *   int  putc(int c)        Send one byte
+     *   int  getc()             Read one byte, only called when readable()
+     *   int  readable()         Non zero if a byte can be read
+     *   int  writeable()        Non zero if putc() will not block
+     *   void attachRx(void (*handler)(void *), void *context)
+     *                           Call handler(context) whenever bytes arrive
+     *   int  millis()           Monotonic clock
+     *   int  micros()
+     *   void delay(int ms)
+     *
+     * On mbed the default is jq8400SerialTransport, define JQ8400_HOST to build on
+     * a desktop against the emulator (jq8400_emulator.hpp) instead, JQ8400_POSIX
+     * to drive real modules on /dev/tty* from Linux (jq8400_posix.hpp), or
+     * JQ8400_REPLAY to play a recorded trace back to the driver (jq8400_replay.hpp).
+     */
+
+    #if defined(JQ8400_REPLAY)
+        #include <string.h>
+        #include "jq8400_emulator.hpp"
+        #include "jq8400_replay.hpp"
+
+        #ifndef JQ8400_TRANSPORT
+            #define JQ8400_TRANSPORT jq8400ReplayTransport
+        #endif
+    #elif defined(JQ8400_POSIX)
+        #include <string.h>
+        #include "jq8400_emulator.hpp"
+        #include "jq8400_posix.hpp"
+
+        #ifndef JQ8400_TRANSPORT
+            #define JQ8400_TRANSPORT jq8400PosixTransport
+        #endif
+    #elif defined(JQ8400_HOST)
+        #include <string.h>
+        #include "jq8400_emulator.hpp"
+
+        #ifndef JQ8400_TRANSPORT
+            #define JQ8400_TRANSPORT jq8400EmulatedTransport
+        #endif
+    #else
+        #include "mbed.h"
+
+        class jq8400SerialTransport : public RawSerial
+        {
+        public:
+            jq8400SerialTransport(PinName _tx, PinName _rx) : RawSerial(_tx,_rx) {
+              clock.start();
+            }
+
+            void attachRx(void (*handler)(void *), void *context) {
+              this->attach(callback(handler, context), RawSerial::RxIrq);
+            }
+
+            int  millis()       { return clock.read_ms(); }
+            int  micros()       { return clock.read_us(); }
+            void delay(int ms)  { wait_ms(ms); }
+
+        protected:
+            Timer clock;
+        };
+
+        #ifndef JQ8400_TRANSPORT
+            #define JQ8400_TRANSPORT jq8400SerialTransport
+        #endif
+    #endif
+
+#endif //jq8400_transport_h